@@ -0,0 +1,1338 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "./vsclient.h"
+
+/* mirrors the server's limits on a request line, a key and a value */
+#define VSC_MAX_LINE     1024
+#define VSC_MAX_KEY      250
+#define VSC_MAX_VALUE    (64 * 1024 * 1024)
+#define VSC_READ_CHUNK   4096
+
+/* milliseconds between attempts to reopen a broken connection, and the
+ * longest a TCP connect may take */
+#define VSC_RETRY_MS     250
+#define VSC_CONNECT_MS   1000
+
+/**
+ * State shared between a blocking helper and its completion callback
+ */
+typedef struct _tag_vscwait {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  int done;
+
+  int status;
+  vsval *v;               /* value received for a GET */
+} vscwait;
+
+/*
+ * Buffers
+ */
+
+/**
+ * Makes room for at least size more bytes in a growable buffer
+ */
+int vsc_reserve(char **buf, unsigned int *cap, unsigned int len, unsigned int size) {
+  char *grown = NULL;
+  unsigned int grow = *cap ? *cap : VSC_READ_CHUNK;
+
+  if (*cap - len >= size) {
+    return ERR_SUCCESS;
+  }
+
+  while (grow - len < size) {
+    grow *= 2;
+  }
+
+  if ((grown = (char *)realloc(*buf, grow)) == NULL) {
+    return ERR_NOMEM;
+  }
+
+  *buf = grown;
+  *cap = grow;
+
+  return ERR_SUCCESS;
+}
+
+/*
+ * Transports
+ */
+
+/**
+ * Opens a TCP connection
+ */
+int vsc_open_tcp(const char *host, const char *port) {
+  int fd = -1, on = 1;
+  struct addrinfo hints, *res = NULL, *ai = NULL;
+  struct timeval tv = { VSC_CONNECT_MS / 1000, (VSC_CONNECT_MS % 1000) * 1000 };
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+
+  if (getaddrinfo(host, port, &hints, &res) != 0) {
+    return -1;
+  }
+
+  for (ai = res; ai; ai = ai->ai_next) {
+    if ((fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) < 0) {
+      continue;
+    }
+
+    /* the I/O thread reopens connections, and mustn't hang on a dead host */
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+      break;
+    }
+
+    close(fd);
+    fd = -1;
+  }
+
+  freeaddrinfo(res);
+
+  if (fd >= 0) {
+    /* pipelined requests are small; don't let them sit in the kernel */
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  }
+
+  return fd;
+}
+
+/**
+ * Opens a unix domain socket connection
+ */
+int vsc_open_unix(const char *path) {
+  int fd;
+  struct sockaddr_un addr;
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    return -1;
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+    return -1;
+  }
+
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+/**
+ * Asks the server for a shared memory channel over a unix domain socket
+ */
+int vsc_open_shm(vscconn *cn, const char *path) {
+  int fds[3], n = 0;
+  char line[64];
+  size_t size;
+  ssize_t rc;
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cmsg = NULL;
+  char control[CMSG_SPACE(sizeof(fds))];
+  shmseg *seg = MAP_FAILED;
+
+  if ((cn->sock = vsc_open_unix(path)) < 0) {
+    return ERR_CONNIO;
+  }
+
+  if (write(cn->sock, "SHM\r\n", 5) != 5) {
+    return ERR_CONNIO;
+  }
+
+  /* the reply is a single short line carrying the descriptors */
+  memset(&msg, 0, sizeof(msg));
+  iov.iov_base = line;
+  iov.iov_len = sizeof(line) - 1;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  if ((rc = recvmsg(cn->sock, &msg, MSG_CMSG_CLOEXEC)) <= 0) {
+    return ERR_CONNIO;
+  }
+
+  line[rc] = 0;
+
+  for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+      n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * (n < 3 ? n : 3));
+    }
+  }
+
+  if (n != 3 || sscanf(line, "SHM %zu", &size) != 1) {
+    for (rc = 0; rc < n && rc < 3; rc ++) {
+      close(fds[rc]);
+    }
+
+    return ERR_BADREQ;
+  }
+
+  seg = (shmseg *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+  close(fds[0]);
+
+  if (seg == MAP_FAILED || shmring_validate(seg, size) != 0 ||
+      shmlink_init(&cn->shm, seg, size, 0, fds[1], fds[2]) != 0) {
+    if (seg != MAP_FAILED) {
+      munmap(seg, size);
+    }
+
+    close(fds[1]);
+    close(fds[2]);
+    return ERR_BADREQ;
+  }
+
+  /* the I/O thread always sleeps in poll, so the server always rings */
+  atomic_store(&seg->resp.consumer_waiting, 1);
+
+  cn->is_shm = 1;
+  cn->fd = fds[1];
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Opens one pooled connection to an address
+ */
+int vsc_open(vscconn *cn, const char *address) {
+  int rc = ERR_SUCCESS;
+  char host[256], *sep = NULL;
+
+  cn->fd = cn->sock = -1;
+  cn->is_shm = 0;
+
+  if (strncmp(address, "unix:", 5) == 0) {
+    cn->fd = vsc_open_unix(address + 5);
+  } else if (strncmp(address, "shm:", 4) == 0) {
+    rc = vsc_open_shm(cn, address + 4);
+  } else {
+    if (strlen(address) >= sizeof(host) || (sep = strrchr(address, ':')) == NULL) {
+      return ERR_BADREQ;
+    }
+
+    memcpy(host, address, sep - address);
+    host[sep - address] = 0;
+
+    /* allow [v6-address]:port */
+    if (host[0] == '[' && host[strlen(host) - 1] == ']') {
+      host[strlen(host) - 1] = 0;
+      memmove(host, host + 1, strlen(host));
+    }
+
+    cn->fd = vsc_open_tcp(host, sep + 1);
+  }
+
+  if (rc != ERR_SUCCESS || cn->fd < 0) {
+    if (cn->sock >= 0) {
+      close(cn->sock);
+    }
+
+    return rc != ERR_SUCCESS ? rc : ERR_CONNIO;
+  }
+
+  if (!cn->is_shm) {
+    fcntl(cn->fd, F_SETFL, fcntl(cn->fd, F_GETFL) | O_NONBLOCK);
+  }
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Closes a pooled connection's transport
+ */
+void vsc_close(vscconn *cn) {
+  if (cn->is_shm) {
+    shmlink_close(&cn->shm);
+    close(cn->sock);
+  } else if (cn->fd >= 0) {
+    close(cn->fd);
+  }
+
+  cn->fd = cn->sock = -1;
+}
+
+/**
+ * Hands bytes to the transport without blocking
+ * @returns The number of bytes taken, otherwise -1 on a broken connection
+ */
+ssize_t vsc_send(vscconn *cn, const struct iovec *iov, int iovcnt) {
+  ssize_t rc;
+  struct msghdr msg;
+
+  if (cn->is_shm) {
+    return shmlink_send(&cn->shm, iov, iovcnt);
+  }
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = (struct iovec *)iov;
+  msg.msg_iovlen = iovcnt;
+
+  do {
+    rc = sendmsg(cn->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+  } while (rc < 0 && errno == EINTR);
+
+  if (rc < 0) {
+    return (errno == EWOULDBLOCK) ? 0 : -1;
+  }
+
+  return rc;
+}
+
+/**
+ * Writes whatever submitted output the transport will take; called with
+ * the connection locked
+ */
+int vsc_flush(vscconn *cn) {
+  ssize_t rc;
+  struct iovec iov;
+
+  if (cn->out_len == 0) {
+    return ERR_SUCCESS;
+  }
+
+  iov.iov_base = cn->out;
+  iov.iov_len = cn->out_len;
+
+  if ((rc = vsc_send(cn, &iov, 1)) < 0) {
+    return ERR_CONNIO;
+  }
+
+  memmove(cn->out, cn->out + rc, cn->out_len - rc);
+  cn->out_len -= rc;
+
+  return ERR_SUCCESS;
+}
+
+/*
+ * Requests
+ */
+
+/**
+ * Checks that a key, or watch pattern, goes on the wire as one argument
+ * the server accepts; anything else would split the request, or get the
+ * connection dropped, and throw every later reply on it out of step
+ * @returns ERR_SUCCESS, otherwise ERR_BADREQ
+ */
+int vsc_check_key(const char *key) {
+  size_t len;
+
+  if (key == NULL || (len = strlen(key)) == 0 || len > VSC_MAX_KEY ||
+      strpbrk(key, " \t\r\n") != NULL) {
+    return ERR_BADREQ;
+  }
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Fails every outstanding request on a connection that has broken
+ */
+void vsc_fail(vscconn *cn) {
+  vscreq *req = NULL, *next = NULL;
+  vsreply r;
+
+  pthread_mutex_lock(&cn->lock);
+  cn->broken = 1;
+  cn->out_len = 0;
+  req = cn->head;
+  cn->head = cn->tail = NULL;
+  cn->outstanding = 0;
+  pthread_mutex_unlock(&cn->lock);
+
+  memset(&r, 0, sizeof(r));
+  r.status = ERR_CONNIO;
+  r.error = "connection lost";
+
+  for (; req; req = next) {
+    next = req->next;
+
+    if (req->cb) {
+      req->cb(&r, req->arg);
+    }
+
+    free(req);
+  }
+}
+
+/**
+ * Wakes the I/O thread so it notices new output to wait on
+ */
+void vsc_wake(vsclient *c) {
+  uint64_t one = 1;
+
+  while (write(c->wake_fd, &one, sizeof(one)) < 0 && errno == EINTR);
+}
+
+/**
+ * Picks the least busy connection that isn't broken
+ * @returns The connection, otherwise NULL
+ */
+vscconn* vsc_pick(vsclient *c) {
+  int i;
+  unsigned int outstanding, fewest = 0;
+  vscconn *best = NULL;
+
+  /* the outstanding counts are only a hint; a connection that breaks
+   * meanwhile is caught once it's locked */
+  for (i = 0; i < c->n_conns; i ++) {
+    if (atomic_load(&c->conns[i].broken)) {
+      continue;
+    }
+
+    outstanding = atomic_load(&c->conns[i].outstanding);
+
+    if (best == NULL || outstanding < fewest) {
+      best = &c->conns[i];
+      fewest = outstanding;
+    }
+  }
+
+  return best;
+}
+
+/**
+ * Pipelines a request on a connection; called with the connection locked
+ */
+int vsc_queue(vscconn *cn, const struct iovec *iov, int iovcnt, vsc_callback cb, void *arg) {
+  int i, rc = ERR_SUCCESS;
+  ssize_t sent = 0;
+  unsigned int total = 0;
+  vscreq *req = NULL;
+
+  if (atomic_load(&cn->broken)) {
+    return ERR_CONNIO;
+  }
+
+  for (i = 0; i < iovcnt; i ++) {
+    total += iov[i].iov_len;
+  }
+
+  if ((req = (vscreq *)malloc(sizeof(vscreq))) == NULL) {
+    return ERR_NOMEM;
+  }
+
+  req->next = NULL;
+  req->cb = cb;
+  req->arg = arg;
+
+  /* write straight from the caller's buffers unless output is backed up */
+  if (cn->out_len == 0 && (sent = vsc_send(cn, iov, iovcnt)) < 0) {
+    rc = ERR_CONNIO;
+  }
+
+  if (rc == ERR_SUCCESS && sent < total) {
+    if (vsc_reserve(&cn->out, &cn->out_cap, cn->out_len, total - sent) != ERR_SUCCESS) {
+      rc = ERR_NOMEM;
+    }
+
+    for (i = 0; rc == ERR_SUCCESS && i < iovcnt; i ++) {
+      if (sent >= iov[i].iov_len) {
+        sent -= iov[i].iov_len;
+        continue;
+      }
+
+      memcpy(cn->out + cn->out_len, (char *)iov[i].iov_base + sent, iov[i].iov_len - sent);
+      cn->out_len += iov[i].iov_len - sent;
+      sent = 0;
+    }
+  }
+
+  if (rc != ERR_SUCCESS) {
+    free(req);
+    return rc;
+  }
+
+  if (cn->tail) {
+    cn->tail->next = req;
+  } else {
+    cn->head = req;
+  }
+
+  cn->tail = req;
+  cn->outstanding ++;
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Pipelines a request on the least busy connection
+ */
+int vsc_submit(vsclient *c, const struct iovec *iov, int iovcnt, vsc_callback cb, void *arg) {
+  int rc, backed_up;
+  vscconn *cn = vsc_pick(c);
+
+  if (cn == NULL) {
+    return ERR_CONNIO;
+  }
+
+  pthread_mutex_lock(&cn->lock);
+  rc = vsc_queue(cn, iov, iovcnt, cb, arg);
+  backed_up = cn->out_len > 0;
+  pthread_mutex_unlock(&cn->lock);
+
+  /* the I/O thread has to wait for the socket to take the rest */
+  if (rc == ERR_SUCCESS && backed_up) {
+    vsc_wake(c);
+  }
+
+  return rc;
+}
+
+/**
+ * Submits a single line request
+ */
+int vsc_submit_line(vsclient *c, const char *line, vsc_callback cb, void *arg) {
+  struct iovec iov;
+
+  iov.iov_base = (void *)line;
+  iov.iov_len = strlen(line);
+
+  return vsc_submit(c, &iov, 1, cb, arg);
+}
+
+/*
+ * Replies
+ */
+
+/**
+ * Completes the oldest outstanding request on a connection
+ */
+void vsc_complete(vscconn *cn, const vsreply *r) {
+  vscreq *req = NULL;
+
+  pthread_mutex_lock(&cn->lock);
+
+  if ((req = cn->head) != NULL) {
+    if ((cn->head = req->next) == NULL) {
+      cn->tail = NULL;
+    }
+
+    cn->outstanding --;
+  }
+
+  pthread_mutex_unlock(&cn->lock);
+
+  if (req) {
+    if (req->cb) {
+      req->cb(r, req->arg);
+    }
+
+    free(req);
+  }
+}
+
+/**
+ * Works out the extent of a sized value block following a line
+ * @returns 1 when the block has arrived, 0 when more is needed, otherwise -1
+ */
+int vsc_value_block(const char *buf, unsigned int avail, unsigned int length) {
+  if (length > VSC_MAX_VALUE) {
+    return -1;
+  }
+
+  if (avail < length + 2) {
+    return 0;
+  }
+
+  return (buf[length] == '\r' && buf[length + 1] == '\n') ? 1 : -1;
+}
+
+/**
+ * Parses the reply at the front of a connection's input
+ * @param used Receives the bytes the reply occupied, or 0 when incomplete
+ * @returns ERR_SUCCESS, otherwise ERR_BADREQ on a malformed reply
+ */
+int vsc_reply(vsclient *c, vscconn *cn, const char *buf, unsigned int len, unsigned int *used) {
+  int rc, n = 0;
+  char line[VSC_MAX_LINE + 1], event[16], key[VSC_MAX_LINE], type[32];
+  unsigned int line_len, head_len, length = 0;
+  const char *nl = memchr(buf, '\n', len < VSC_MAX_LINE ? len : VSC_MAX_LINE);
+  type_desc *desc = NULL;
+  vsreply r;
+
+  *used = 0;
+
+  if (nl == NULL) {
+    return len >= VSC_MAX_LINE ? ERR_BADREQ : ERR_SUCCESS;
+  }
+
+  head_len = (nl - buf) + 1;
+  line_len = head_len - 1;
+
+  if (line_len > 0 && buf[line_len - 1] == '\r') {
+    line_len --;
+  }
+
+  memcpy(line, buf, line_len);
+  line[line_len] = 0;
+
+  memset(&r, 0, sizeof(r));
+
+  if (strncmp(line, "VALUE ", 6) == 0) {
+    if (sscanf(line, "VALUE %31s %u", type, &length) != 2 ||
+        (desc = lookup_type_by_name(type)) == NULL) {
+      return ERR_BADREQ;
+    }
+
+    if ((rc = vsc_value_block(buf + head_len, len - head_len, length)) <= 0) {
+      return rc < 0 ? ERR_BADREQ : ERR_SUCCESS;
+    }
+
+    r.status = ERR_SUCCESS;
+    r.type_id = desc->id;
+    r.data = buf + head_len;
+    r.length = length;
+    *used = head_len + length + 2;
+
+    vsc_complete(cn, &r);
+    return ERR_SUCCESS;
+  }
+
+  /* pushed notifications aren't replies to anything */
+  if (strncmp(line, "NOTIFY ", 7) == 0) {
+    n = sscanf(line, "NOTIFY %15s %1023s %31s %u", event, key, type, &length);
+
+    if (n == 4) {
+      if ((desc = lookup_type_by_name(type)) == NULL) {
+        return ERR_BADREQ;
+      }
+
+      if ((rc = vsc_value_block(buf + head_len, len - head_len, length)) <= 0) {
+        return rc < 0 ? ERR_BADREQ : ERR_SUCCESS;
+      }
+
+      r.status = ERR_SUCCESS;
+      r.type_id = desc->id;
+      r.data = buf + head_len;
+      r.length = length;
+      *used = head_len + length + 2;
+    } else if (n == 2) {
+      *used = head_len;
+    } else {
+      return ERR_BADREQ;
+    }
+
+    if (c->notify) {
+      c->notify(event, key, n == 4 ? &r : NULL, c->notify_arg);
+    }
+
+    return ERR_SUCCESS;
+  }
+
+  *used = head_len;
+
+  if (strcmp(line, "OK") == 0) {
+    r.status = ERR_SUCCESS;
+  } else if (strcmp(line, "NOTFOUND") == 0) {
+    r.status = ERR_NOTFOUND;
+  } else if (strncmp(line, "ERR", 3) == 0) {
+    r.status = ERR_BADREQ;
+    r.error = line[3] ? line + 4 : "";
+  } else {
+    return ERR_BADREQ;
+  }
+
+  vsc_complete(cn, &r);
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Reads what a connection has received and completes its requests
+ * @returns ERR_SUCCESS, otherwise an error after which the connection fails
+ */
+int vsc_service(vsclient *c, vscconn *cn) {
+  ssize_t rc;
+  unsigned int pos = 0, used = 0;
+  uint32_t pending;
+
+  if (cn->is_shm) {
+    shmlink_clear(&cn->shm);
+
+    /* the server may have been waiting on room in the request ring */
+    pthread_mutex_lock(&cn->lock);
+    rc = vsc_flush(cn);
+    pthread_mutex_unlock(&cn->lock);
+
+    if (rc != ERR_SUCCESS) {
+      return ERR_CONNIO;
+    }
+
+    pending = shmlink_pending(&cn->shm);
+
+    if (pending == 0) {
+      return atomic_load(&cn->shm.seg->closed) ? ERR_CONNIO : ERR_SUCCESS;
+    }
+
+    if (vsc_reserve(&cn->in, &cn->in_cap, cn->in_len, pending) != ERR_SUCCESS) {
+      return ERR_NOMEM;
+    }
+
+    /* pending bytes that can't be read mean the ring has been corrupted */
+    if ((rc = shmlink_recv(&cn->shm, cn->in + cn->in_len, cn->in_cap - cn->in_len)) == 0) {
+      return ERR_CONNIO;
+    }
+
+    cn->in_len += rc;
+  } else {
+    if (vsc_reserve(&cn->in, &cn->in_cap, cn->in_len, VSC_READ_CHUNK) != ERR_SUCCESS) {
+      return ERR_NOMEM;
+    }
+
+    do {
+      rc = recv(cn->fd, cn->in + cn->in_len, cn->in_cap - cn->in_len, 0);
+    } while (rc < 0 && errno == EINTR);
+
+    if (rc == 0 || (rc < 0 && errno != EWOULDBLOCK)) {
+      return ERR_CONNIO;
+    }
+
+    if (rc > 0) {
+      cn->in_len += rc;
+    }
+  }
+
+  while (pos < cn->in_len) {
+    if (vsc_reply(c, cn, cn->in + pos, cn->in_len - pos, &used) != ERR_SUCCESS) {
+      return ERR_BADREQ;
+    }
+
+    if (used == 0) {
+      break;
+    }
+
+    pos += used;
+  }
+
+  memmove(cn->in, cn->in + pos, cn->in_len - pos);
+  cn->in_len -= pos;
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Reads the monotonic clock in milliseconds
+ */
+long long vsc_now() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Tells the application that a connection broke or was reopened
+ */
+void vsc_event(vsclient *c, const char *event) {
+  if (c->notify) {
+    c->notify(event, NULL, NULL, c->notify_arg);
+  }
+}
+
+/**
+ * Formats the request that makes a watch
+ * @returns ERR_SUCCESS, otherwise ERR_BADREQ for a pattern that isn't a key
+ */
+int vsc_watch_line(char *line, size_t size, const char *pattern, int values) {
+  if (vsc_check_key(pattern) != ERR_SUCCESS ||
+      snprintf(line, size, "WATCH %s%s\r\n", pattern, values ? " VALUES" : "") >= size) {
+    return ERR_BADREQ;
+  }
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Reopens a broken connection and makes its watches again, ahead of any
+ * other request on it; runs on the I/O thread
+ * @returns ERR_SUCCESS, otherwise an error with the connection still broken
+ */
+int vsc_reopen(vsclient *c, vscconn *cn) {
+  int rc;
+  char line[VSC_MAX_LINE];
+  struct iovec iov;
+  vscwatch *w = NULL;
+
+  if ((rc = vsc_open(cn, c->address)) != ERR_SUCCESS) {
+    return rc;
+  }
+
+  cn->in_len = 0;
+  iov.iov_base = line;
+
+  pthread_mutex_lock(&cn->lock);
+  atomic_store(&cn->broken, 0);
+
+  for (w = cn->watches; w && rc == ERR_SUCCESS; w = w->next) {
+    vsc_watch_line(line, sizeof(line), w->pattern, w->values);
+    iov.iov_len = strlen(line);
+    rc = vsc_queue(cn, &iov, 1, NULL, NULL);
+  }
+
+  pthread_mutex_unlock(&cn->lock);
+
+  if (rc != ERR_SUCCESS) {
+    vsc_fail(cn);
+    vsc_close(cn);
+  }
+
+  return rc;
+}
+
+/**
+ * The I/O thread; waits on every connection and completes requests
+ */
+void* vsc_io_main(void *arg) {
+  int i, rc, timeout;
+  long long now;
+  uint64_t count;
+  vsclient *c = (vsclient *)arg;
+  vscconn *cn = NULL;
+  struct pollfd *fds = (struct pollfd *)calloc(c->n_conns + 1, sizeof(struct pollfd));
+
+  if (!fds) {
+    return NULL;
+  }
+
+  while (atomic_load(&c->running)) {
+    fds[0].fd = c->wake_fd;
+    fds[0].events = POLLIN;
+    timeout = -1;
+    now = vsc_now();
+
+    for (i = 0; i < c->n_conns; i ++) {
+      cn = &c->conns[i];
+
+      /* broken connections are reopened every so often */
+      if (atomic_load(&cn->broken) && now >= cn->retry_at) {
+        if (vsc_reopen(c, cn) == ERR_SUCCESS) {
+          vsc_event(c, "RECONNECT");
+        } else {
+          cn->retry_at = now + VSC_RETRY_MS;
+        }
+      }
+
+      if (atomic_load(&cn->broken) && (timeout < 0 || cn->retry_at - now < timeout)) {
+        timeout = cn->retry_at - now;
+      }
+
+      pthread_mutex_lock(&cn->lock);
+      fds[i + 1].fd = cn->broken ? -1 : cn->fd;
+      fds[i + 1].events = POLLIN | ((cn->out_len && !cn->is_shm) ? POLLOUT : 0);
+      pthread_mutex_unlock(&cn->lock);
+    }
+
+    if ((rc = poll(fds, c->n_conns + 1, timeout)) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+
+      break;
+    }
+
+    if (fds[0].revents & POLLIN) {
+      while (read(c->wake_fd, &count, sizeof(count)) < 0 && errno == EINTR);
+    }
+
+    for (i = 0; i < c->n_conns; i ++) {
+      cn = &c->conns[i];
+      rc = ERR_SUCCESS;
+
+      if (fds[i + 1].revents == 0) {
+        continue;
+      }
+
+      if (fds[i + 1].revents & POLLOUT) {
+        pthread_mutex_lock(&cn->lock);
+        rc = vsc_flush(cn);
+        pthread_mutex_unlock(&cn->lock);
+      }
+
+      if (rc == ERR_SUCCESS && (fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR))) {
+        rc = vsc_service(c, cn);
+      }
+
+      /* it's tried again straight away, in case the server restarted */
+      if (rc != ERR_SUCCESS) {
+        vsc_fail(cn);
+        vsc_close(cn);
+        cn->retry_at = 0;
+        vsc_event(c, "DISCONNECT");
+      }
+    }
+  }
+
+  free(fds);
+
+  return NULL;
+}
+
+/*
+ * Client
+ */
+
+/**
+ * Connects a pool of connections to a server
+ */
+vsclient* vsc_connect(const char *address, int pool_size) {
+  int i;
+  vsclient *c = NULL;
+
+  if (pool_size <= 0 || (c = (vsclient *)calloc(1, sizeof(vsclient))) == NULL) {
+    return NULL;
+  }
+
+  c->wake_fd = -1;
+
+  if ((c->address = strdup(address)) == NULL ||
+      (c->conns = (vscconn *)calloc(pool_size, sizeof(vscconn))) == NULL ||
+      (c->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+    vsc_destroy(&c);
+    return NULL;
+  }
+
+  for (i = 0; i < pool_size; i ++) {
+    pthread_mutex_init(&c->conns[i].lock, NULL);
+    c->n_conns ++;
+
+    if (vsc_open(&c->conns[i], address) != ERR_SUCCESS) {
+      c->conns[i].broken = 1;
+      vsc_destroy(&c);
+      return NULL;
+    }
+  }
+
+  atomic_store(&c->running, 1);
+
+  if (pthread_create(&c->io, NULL, vsc_io_main, c) != 0) {
+    atomic_store(&c->running, 0);
+    vsc_destroy(&c);
+    return NULL;
+  }
+
+  return c;
+}
+
+/**
+ * Closes a client's connections
+ */
+int vsc_destroy(vsclient **c) {
+  int i;
+  vscwatch *w = NULL;
+
+  if (!c || !(*c)) {
+    return ERR_INVPTR;
+  }
+
+  if (atomic_exchange(&(*c)->running, 0)) {
+    vsc_wake(*c);
+    pthread_join((*c)->io, NULL);
+  }
+
+  for (i = 0; i < (*c)->n_conns; i ++) {
+    vsc_fail(&(*c)->conns[i]);
+
+    if ((*c)->conns[i].fd >= 0) {
+      vsc_close(&(*c)->conns[i]);
+    }
+
+    while ((w = (*c)->conns[i].watches) != NULL) {
+      (*c)->conns[i].watches = w->next;
+      free(w->pattern);
+      free(w);
+    }
+
+    free((*c)->conns[i].out);
+    free((*c)->conns[i].in);
+    pthread_mutex_destroy(&(*c)->conns[i].lock);
+  }
+
+  if ((*c)->wake_fd >= 0) {
+    close((*c)->wake_fd);
+  }
+
+  free((*c)->conns);
+  free((*c)->address);
+  free(*c);
+  *c = NULL;
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Sets the callback that receives change notifications
+ */
+void vsc_set_notify(vsclient *c, vsc_notify fn, void *arg) {
+  c->notify_arg = arg;
+  c->notify = fn;
+}
+
+/*
+ * Asynchronous requests
+ */
+
+int vsc_get_async(vsclient *c, const char *key, vsc_callback cb, void *arg) {
+  char line[VSC_MAX_LINE];
+
+  if (vsc_check_key(key) != ERR_SUCCESS ||
+      snprintf(line, sizeof(line), "GET %s\r\n", key) >= sizeof(line)) {
+    return ERR_BADREQ;
+  }
+
+  return vsc_submit_line(c, line, cb, arg);
+}
+
+int vsc_set_async(vsclient *c, const char *key, vsval *v, vsc_callback cb, void *arg) {
+  int n;
+  char line[VSC_MAX_LINE], scratch[64];
+  const void *data = NULL;
+  unsigned int length = 0;
+  type_desc *desc = NULL;
+  struct iovec iov[3];
+
+  if (vsc_check_key(key) != ERR_SUCCESS) {
+    return ERR_BADREQ;
+  }
+
+  if (!v || (desc = lookup_type(v->type_id)) == NULL || desc->id == 0 ||
+      vsval_payload(v, scratch, sizeof(scratch), &data, &length) != ERR_SUCCESS) {
+    return ERR_INVTYPE;
+  }
+
+  n = snprintf(line, sizeof(line), "SET %s %s %u\r\n", key, desc->name, length);
+
+  if (n >= sizeof(line)) {
+    return ERR_BADREQ;
+  }
+
+  iov[0].iov_base = line;
+  iov[0].iov_len = n;
+  iov[1].iov_base = (void *)data;
+  iov[1].iov_len = length;
+  iov[2].iov_base = "\r\n";
+  iov[2].iov_len = 2;
+
+  return vsc_submit(c, iov, 3, cb, arg);
+}
+
+int vsc_del_async(vsclient *c, const char *key, vsc_callback cb, void *arg) {
+  char line[VSC_MAX_LINE];
+
+  if (vsc_check_key(key) != ERR_SUCCESS ||
+      snprintf(line, sizeof(line), "DEL %s\r\n", key) >= sizeof(line)) {
+    return ERR_BADREQ;
+  }
+
+  return vsc_submit_line(c, line, cb, arg);
+}
+
+int vsc_watch_async(vsclient *c, const char *pattern, int values, vsc_callback cb, void *arg) {
+  int rc, backed_up;
+  char line[VSC_MAX_LINE];
+  struct iovec iov;
+  vscconn *cn = NULL;
+  vscwatch *w = NULL;
+
+  if (vsc_watch_line(line, sizeof(line), pattern, values) != ERR_SUCCESS) {
+    return ERR_BADREQ;
+  }
+
+  if ((cn = vsc_pick(c)) == NULL) {
+    return ERR_CONNIO;
+  }
+
+  if ((w = (vscwatch *)malloc(sizeof(vscwatch))) == NULL || (w->pattern = strdup(pattern)) == NULL) {
+    free(w);
+    return ERR_NOMEM;
+  }
+
+  w->values = values;
+  iov.iov_base = line;
+  iov.iov_len = strlen(line);
+
+  /* the watch is kept with the connection, so that it's made again there */
+  pthread_mutex_lock(&cn->lock);
+
+  if ((rc = vsc_queue(cn, &iov, 1, cb, arg)) == ERR_SUCCESS) {
+    w->next = cn->watches;
+    cn->watches = w;
+  }
+
+  backed_up = cn->out_len > 0;
+  pthread_mutex_unlock(&cn->lock);
+
+  if (rc != ERR_SUCCESS) {
+    free(w->pattern);
+    free(w);
+  } else if (backed_up) {
+    vsc_wake(c);
+  }
+
+  return rc;
+}
+
+/*
+ * Blocking requests
+ */
+
+/**
+ * Completion callback for blocking requests
+ */
+void vsc_wait_done(const vsreply *r, void *arg) {
+  vscwait *w = (vscwait *)arg;
+  type_desc *desc = NULL;
+
+  pthread_mutex_lock(&w->lock);
+
+  w->status = r->status;
+
+  /* hold on to a returned value; the reply's data goes with the callback */
+  if (r->status == ERR_SUCCESS && r->data && (desc = lookup_type(r->type_id)) != NULL) {
+    if (vsval_create((char *)desc->name, &w->v) != ERR_SUCCESS ||
+        vsval_parse(w->v, r->type_id, r->data, r->length) != ERR_SUCCESS) {
+      if (w->v) {
+        vsval_destroy(&w->v);
+      }
+
+      w->status = ERR_INVTYPE;
+    }
+  }
+
+  w->done = 1;
+  pthread_cond_signal(&w->cond);
+  pthread_mutex_unlock(&w->lock);
+}
+
+/**
+ * Prepares to wait on a blocking request
+ */
+void vsc_wait_init(vscwait *w) {
+  pthread_mutex_init(&w->lock, NULL);
+  pthread_cond_init(&w->cond, NULL);
+  w->done = 0;
+  w->status = ERR_SUCCESS;
+  w->v = NULL;
+}
+
+/**
+ * Waits for a submitted blocking request to complete
+ * @returns The request's status
+ */
+int vsc_wait(vscwait *w, int rc) {
+  if (rc == ERR_SUCCESS) {
+    pthread_mutex_lock(&w->lock);
+
+    while (!w->done) {
+      pthread_cond_wait(&w->cond, &w->lock);
+    }
+
+    pthread_mutex_unlock(&w->lock);
+    rc = w->status;
+  }
+
+  pthread_cond_destroy(&w->cond);
+  pthread_mutex_destroy(&w->lock);
+
+  return rc;
+}
+
+int vsc_get(vsclient *c, const char *key, vsval **v) {
+  int rc;
+  vscwait w;
+
+  vsc_wait_init(&w);
+  rc = vsc_wait(&w, vsc_get_async(c, key, vsc_wait_done, &w));
+  *v = w.v;
+
+  return rc;
+}
+
+int vsc_set(vsclient *c, const char *key, vsval *v) {
+  vscwait w;
+
+  vsc_wait_init(&w);
+  return vsc_wait(&w, vsc_set_async(c, key, v, vsc_wait_done, &w));
+}
+
+int vsc_del(vsclient *c, const char *key) {
+  vscwait w;
+
+  vsc_wait_init(&w);
+  return vsc_wait(&w, vsc_del_async(c, key, vsc_wait_done, &w));
+}
+
+int vsc_watch(vsclient *c, const char *pattern, int values) {
+  vscwait w;
+
+  vsc_wait_init(&w);
+  return vsc_wait(&w, vsc_watch_async(c, pattern, values, vsc_wait_done, &w));
+}
+
+/*
+ * Typed helpers
+ */
+
+/**
+ * Sets a fixed width value from its raw bytes
+ */
+int vsc_set_raw(vsclient *c, const char *key, char *type_name, void *data, unsigned int length) {
+  int rc;
+  vsval *v = NULL;
+
+  if ((rc = vsval_create(type_name, &v)) != ERR_SUCCESS) {
+    return rc;
+  }
+
+  if ((rc = vsval_set(v, v->type_id, data, length)) == ERR_SUCCESS) {
+    rc = vsc_set(c, key, v);
+  }
+
+  vsval_destroy(&v);
+
+  return rc;
+}
+
+int vsc_set_int32(vsclient *c, const char *key, int32_t i) {
+  return vsc_set_raw(c, key, "int32", &i, sizeof(i));
+}
+
+int vsc_set_int64(vsclient *c, const char *key, int64_t i) {
+  return vsc_set_raw(c, key, "int64", &i, sizeof(i));
+}
+
+int vsc_set_double(vsclient *c, const char *key, double d) {
+  return vsc_set_raw(c, key, "float8", &d, sizeof(d));
+}
+
+int vsc_set_text(vsclient *c, const char *key, const char *s) {
+  return vsc_set_raw(c, key, "text", (void *)s, strlen(s));
+}
+
+/**
+ * Fetches a numeric value of any width
+ */
+int vsc_get_numeric(vsclient *c, const char *key, int64_t *i) {
+  int rc;
+  vsval *v = NULL;
+  type_desc *desc = NULL;
+
+  if ((rc = vsc_get(c, key, &v)) != ERR_SUCCESS) {
+    return rc;
+  }
+
+  desc = lookup_type(v->type_id);
+  rc = ERR_SUCCESS;
+
+  if (desc == NULL || !vst_is_numeric(desc)) {
+    rc = ERR_INVTYPE;
+  } else if (desc->length == 1) {
+    *i = *(char *)v->data;
+  } else if (desc->length == 2) {
+    *i = *(short *)v->data;
+  } else if (desc->length == 4) {
+    *i = *(int *)v->data;
+  } else if (desc->length == 8) {
+    *i = *(long *)v->data;
+  } else {
+    rc = ERR_INVTYPE;
+  }
+
+  vsval_destroy(&v);
+
+  return rc;
+}
+
+int vsc_get_int32(vsclient *c, const char *key, int32_t *i) {
+  int rc;
+  int64_t wide = 0;
+
+  if ((rc = vsc_get_numeric(c, key, &wide)) == ERR_SUCCESS) {
+    if (wide < INT32_MIN || wide > INT32_MAX) {
+      return ERR_INVTYPE;
+    }
+
+    *i = (int32_t)wide;
+  }
+
+  return rc;
+}
+
+int vsc_get_int64(vsclient *c, const char *key, int64_t *i) {
+  return vsc_get_numeric(c, key, i);
+}
+
+int vsc_get_double(vsclient *c, const char *key, double *d) {
+  int rc;
+  vsval *v = NULL;
+  type_desc *desc = NULL;
+
+  if ((rc = vsc_get(c, key, &v)) != ERR_SUCCESS) {
+    return rc;
+  }
+
+  desc = lookup_type(v->type_id);
+  rc = ERR_SUCCESS;
+
+  if (desc == NULL || !vst_is_floating(desc)) {
+    rc = ERR_INVTYPE;
+  } else if (desc->length == 4) {
+    *d = *(float *)v->data;
+  } else {
+    *d = *(double *)v->data;
+  }
+
+  vsval_destroy(&v);
+
+  return rc;
+}
+
+int vsc_get_text(vsclient *c, const char *key, char **s) {
+  int rc;
+  vsval *v = NULL;
+  type_desc *desc = NULL;
+
+  if ((rc = vsc_get(c, key, &v)) != ERR_SUCCESS) {
+    return rc;
+  }
+
+  desc = lookup_type(v->type_id);
+
+  if (desc == NULL || !vst_is_text(desc)) {
+    rc = ERR_INVTYPE;
+  } else if ((*s = (char *)malloc(v->length + 1)) == NULL) {
+    rc = ERR_NOMEM;
+  } else {
+    memcpy(*s, v->data, v->length);
+    (*s)[v->length] = 0;
+  }
+
+  vsval_destroy(&v);
+
+  return rc;
+}
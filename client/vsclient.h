@@ -0,0 +1,209 @@
+#ifndef __varsvr_vsclient_h_
+
+#define __varsvr_vsclient_h_
+
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "../src/typesys.h"
+#include "../src/shmring.h"
+#include "../src/errors.h"
+
+/*
+ * Client library for var-server. A client holds a small pool of
+ * connections shared by every application thread. Requests are pipelined:
+ * each is written as soon as it is submitted and its completion callback
+ * runs, on the client's I/O thread, when the matching reply arrives.
+ * Requests are spread over the pool by picking the connection with the
+ * fewest replies outstanding, so requests are only ordered with respect to
+ * others on the same connection; wait for a completion before issuing a
+ * request that depends on it.
+ *
+ * Addresses take one of the forms
+ *
+ *   host:port       TCP
+ *   unix:<path>     unix domain socket
+ *   shm:<path>      shared memory channels, opened through the unix socket
+ *
+ * A connection that breaks fails the requests outstanding on it with
+ * ERR_CONNIO, and the I/O thread then reopens it every so often until it
+ * succeeds, making the watches that were made on it again.
+ *
+ * The blocking helpers (vsc_get, vsc_set, ...) wait on the I/O thread and
+ * so must not be called from a completion callback.
+ */
+
+/**
+ * @struct _tag_vsreply
+ * @brief A reply handed to a completion callback. The data is only valid
+ *        for the duration of the callback
+ */
+typedef struct _tag_vsreply {
+  int status;             /* ERR_SUCCESS, ERR_NOTFOUND, ERR_BADREQ or ERR_CONNIO */
+  const char *error;      /* the server's reason when status is ERR_BADREQ */
+
+  unsigned int type_id;   /* type of a returned value */
+  const char *data;       /* wire representation of a returned value */
+  unsigned int length;
+} vsreply;
+
+/**
+ * Completion callback signature
+ */
+typedef void(*vsc_callback)(const vsreply *r, void *arg);
+
+/**
+ * Change notification callback signature; the reply is NULL unless the
+ * watch was made with values, or the key was deleted. A connection that
+ * breaks is reported as a "DISCONNECT" event, and its reopening as a
+ * "RECONNECT" event, both with a NULL key; changes made in between to
+ * what it watched are not notified
+ */
+typedef void(*vsc_notify)(const char *event, const char *key, const vsreply *r, void *arg);
+
+/**
+ * @struct _tag_vscreq
+ * @brief A request waiting for its reply
+ */
+typedef struct _tag_vscreq {
+  struct _tag_vscreq *next;
+
+  vsc_callback cb;
+  void *arg;
+} vscreq;
+
+/**
+ * @struct _tag_vscwatch
+ * @brief A watch made on a connection, made again when it is reopened
+ */
+typedef struct _tag_vscwatch {
+  struct _tag_vscwatch *next;
+
+  char *pattern;
+  int values;
+} vscwatch;
+
+/**
+ * @struct _tag_vscconn
+ * @brief A pooled connection and the requests pipelined on it
+ */
+typedef struct _tag_vscconn {
+  pthread_mutex_t lock;   /* guards output, the outstanding requests and the watches */
+
+  int fd;                 /* socket, or the client's doorbell for shm */
+  int sock;               /* socket holding a shared memory channel open */
+  shmlink shm;
+  int is_shm;
+  atomic_int broken;      /* only changed by the I/O thread, under the lock */
+  long long retry_at;     /* when a broken connection is next reopened */
+
+  char *out;              /* submitted bytes the transport hasn't taken */
+  unsigned int out_len;
+  unsigned int out_cap;
+
+  char *in;               /* received bytes; only touched by the I/O thread */
+  unsigned int in_len;
+  unsigned int in_cap;
+
+  vscreq *head;           /* outstanding requests, oldest first */
+  vscreq *tail;
+  atomic_uint outstanding;
+
+  vscwatch *watches;
+} vscconn;
+
+/**
+ * @struct _tag_vsclient
+ * @brief A pool of connections to a server, driven by an I/O thread
+ */
+typedef struct _tag_vsclient {
+  vscconn *conns;
+  int n_conns;
+  char *address;          /* broken connections are reopened to it */
+
+  pthread_t io;           /* reads replies and runs callbacks */
+  int wake_fd;            /* interrupts the I/O thread's poll */
+  atomic_int running;
+
+  vsc_notify notify;
+  void *notify_arg;
+} vsclient;
+
+/**
+ * Connects a pool of connections to a server
+ * @param address Where the server is; see above
+ * @param pool_size Number of connections to open
+ * @returns The client, otherwise NULL
+ */
+vsclient* vsc_connect(const char *address, int pool_size);
+
+/**
+ * Closes a client's connections; outstanding requests fail with ERR_CONNIO
+ */
+int vsc_destroy(vsclient **c);
+
+/**
+ * Sets the callback that receives change notifications
+ */
+void vsc_set_notify(vsclient *c, vsc_notify fn, void *arg);
+
+/*
+ * Asynchronous requests. Each returns once the request has been handed to
+ * a connection; the callback later receives the reply. A key or pattern
+ * that is empty, longer than 250 bytes, or holds a space, tab, CR or LF is
+ * refused with ERR_BADREQ before anything is sent
+ */
+
+int vsc_get_async(vsclient *c, const char *key, vsc_callback cb, void *arg);
+int vsc_set_async(vsclient *c, const char *key, vsval *v, vsc_callback cb, void *arg);
+int vsc_del_async(vsclient *c, const char *key, vsc_callback cb, void *arg);
+int vsc_watch_async(vsclient *c, const char *pattern, int values, vsc_callback cb, void *arg);
+
+/*
+ * Blocking requests
+ */
+
+/**
+ * Fetches the value held under a key
+ * @param v Receives a new value container the caller destroys
+ * @returns ERR_SUCCESS, ERR_NOTFOUND, otherwise an error
+ */
+int vsc_get(vsclient *c, const char *key, vsval **v);
+
+/**
+ * Sets the value held under a key
+ */
+int vsc_set(vsclient *c, const char *key, vsval *v);
+
+/**
+ * Removes a key
+ * @returns ERR_SUCCESS, ERR_NOTFOUND, otherwise an error
+ */
+int vsc_del(vsclient *c, const char *key);
+
+/**
+ * Watches a key, or a key prefix ending in '*'
+ */
+int vsc_watch(vsclient *c, const char *pattern, int values);
+
+/*
+ * Typed helpers over the vsval type ids
+ */
+
+int vsc_set_int32(vsclient *c, const char *key, int32_t i);
+int vsc_set_int64(vsclient *c, const char *key, int64_t i);
+int vsc_set_double(vsclient *c, const char *key, double d);
+int vsc_set_text(vsclient *c, const char *key, const char *s);
+
+int vsc_get_int32(vsclient *c, const char *key, int32_t *i);
+int vsc_get_int64(vsclient *c, const char *key, int64_t *i);
+int vsc_get_double(vsclient *c, const char *key, double *d);
+
+/**
+ * Fetches a text value
+ * @param s Receives a terminated copy of the text the caller frees
+ */
+int vsc_get_text(vsclient *c, const char *key, char **s);
+
+#endif /* __varsvr_vsclient_h_ */
@@ -0,0 +1,310 @@
+#include "./admit.h"
+
+/* connection cap (0 for none), request rates per second (0 for none), and
+ * requests served per connection in a pass of the event loop */
+int vs_max_conns = 0;
+int vs_conn_rate = 0;
+int vs_ip_rate = 0;
+int vs_request_budget = 64;
+
+/* connections open across every worker */
+atomic_int vs_admit_conns = 0;
+
+vsclientip *vs_admit_ips[ADMIT_IP_SLOTS];
+pthread_mutex_t vs_admit_locks[ADMIT_IP_STRIPES];
+
+/**
+ * Creates the source address table
+ */
+int admit_init() {
+  int i;
+
+  memset(vs_admit_ips, 0, sizeof(vs_admit_ips));
+
+  for (i = 0; i < ADMIT_IP_STRIPES; i ++) {
+    pthread_mutex_init(&vs_admit_locks[i], NULL);
+  }
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Releases the source address table
+ */
+int admit_teardown() {
+  int i;
+  vsclientip *ip = NULL, *next = NULL;
+
+  for (i = 0; i < ADMIT_IP_SLOTS; i ++) {
+    for (ip = vs_admit_ips[i]; ip; ip = next) {
+      next = ip->next;
+      free(ip);
+    }
+
+    vs_admit_ips[i] = NULL;
+  }
+
+  for (i = 0; i < ADMIT_IP_STRIPES; i ++) {
+    pthread_mutex_destroy(&vs_admit_locks[i]);
+  }
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Reads the clock that rate limits are kept by
+ */
+unsigned long long admit_now() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Takes a place for a newly accepted connection under the connection cap
+ */
+int admit_accept() {
+  if (atomic_fetch_add(&vs_admit_conns, 1) >= vs_max_conns && vs_max_conns > 0) {
+    atomic_fetch_sub(&vs_admit_conns, 1);
+    return ERR_FULL;
+  }
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Counts the connections open across every worker
+ */
+int admit_count() {
+  return atomic_load(&vs_admit_conns);
+}
+
+/**
+ * Gives back a place taken for a connection that was never set up
+ */
+void admit_cancel() {
+  atomic_fetch_sub(&vs_admit_conns, 1);
+}
+
+/**
+ * Finds the table slot for an address
+ */
+unsigned int admit_slot(const unsigned char *addr) {
+  int i;
+  unsigned int h = 2166136261u;
+
+  for (i = 0; i < 16; i ++) {
+    h = (h ^ addr[i]) * 16777619u;
+  }
+
+  return h % ADMIT_IP_SLOTS;
+}
+
+/**
+ * Counts a set up connection against the cap and its source address
+ */
+int admit_attach(vsconn *c, struct sockaddr *addr) {
+  unsigned char key[16];
+  unsigned int slot;
+  pthread_mutex_t *lock = NULL;
+  vsclientip *ip = NULL;
+
+  c->admitted = 1;
+  c->tokens = vs_conn_rate;
+  c->refilled = admit_now();
+
+  if (vs_ip_rate <= 0 || addr == NULL) {
+    return ERR_SUCCESS;
+  }
+
+  if (addr->sa_family == AF_INET6) {
+    memcpy(key, &((struct sockaddr_in6 *)addr)->sin6_addr, 16);
+  } else if (addr->sa_family == AF_INET) {
+    memset(key, 0, 10);
+    key[10] = key[11] = 0xff;
+    memcpy(key + 12, &((struct sockaddr_in *)addr)->sin_addr, 4);
+  } else {
+    return ERR_SUCCESS;
+  }
+
+  slot = admit_slot(key);
+  lock = &vs_admit_locks[slot % ADMIT_IP_STRIPES];
+  pthread_mutex_lock(lock);
+
+  for (ip = vs_admit_ips[slot]; ip && memcmp(ip->addr, key, 16) != 0; ip = ip->next);
+
+  if (ip == NULL) {
+    if ((ip = (vsclientip *)calloc(1, sizeof(vsclientip))) == NULL) {
+      pthread_mutex_unlock(lock);
+      return ERR_NOMEM;
+    }
+
+    memcpy(ip->addr, key, 16);
+    ip->tokens = vs_ip_rate;
+    ip->refilled = c->refilled;
+    ip->next = vs_admit_ips[slot];
+    vs_admit_ips[slot] = ip;
+  }
+
+  ip->conns ++;
+  c->ip = ip;
+  pthread_mutex_unlock(lock);
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Releases everything a connection holds against the cap and its address
+ */
+void admit_release(vsconn *c) {
+  unsigned int slot;
+  pthread_mutex_t *lock = NULL;
+  vsclientip **ip = NULL, *gone = NULL;
+
+  if (!c->admitted) {
+    return;
+  }
+
+  c->admitted = 0;
+  atomic_fetch_sub(&vs_admit_conns, 1);
+
+  if (c->ip == NULL) {
+    return;
+  }
+
+  slot = admit_slot(c->ip->addr);
+  lock = &vs_admit_locks[slot % ADMIT_IP_STRIPES];
+  pthread_mutex_lock(lock);
+
+  /* an address is forgotten along with its last connection */
+  if (-- c->ip->conns == 0) {
+    for (ip = &vs_admit_ips[slot]; *ip != c->ip; ip = &(*ip)->next);
+    gone = *ip;
+    *ip = gone->next;
+    free(gone);
+  }
+
+  pthread_mutex_unlock(lock);
+  c->ip = NULL;
+}
+
+/**
+ * Tops a bucket up for the time since it was last refilled, then takes a
+ * token from it
+ * @returns 0, otherwise the nanoseconds until a token is due
+ */
+unsigned long long admit_bucket(double *tokens, unsigned long long *refilled, int rate,
+                                unsigned long long now) {
+  if (now > *refilled) {
+    *tokens += (double)(now - *refilled) * rate / 1e9;
+    *refilled = now;
+
+    if (*tokens > rate) {
+      *tokens = rate;
+    }
+  }
+
+  if (*tokens >= 1.0) {
+    *tokens -= 1.0;
+    return 0;
+  }
+
+  return (unsigned long long)((1.0 - *tokens) * 1e9 / rate) + 1;
+}
+
+/**
+ * Takes a token for a request from the connection's buckets
+ */
+int admit_take(vsconn *c) {
+  unsigned long long now, wait = 0;
+  pthread_mutex_t *lock = NULL;
+
+  if ((vs_conn_rate <= 0 && c->ip == NULL) || c->upstream) {
+    return ERR_SUCCESS;
+  }
+
+  now = admit_now();
+
+  if (vs_conn_rate > 0) {
+    wait = admit_bucket(&c->tokens, &c->refilled, vs_conn_rate, now);
+  }
+
+  if (wait == 0 && c->ip != NULL) {
+    lock = &vs_admit_locks[admit_slot(c->ip->addr) % ADMIT_IP_STRIPES];
+    pthread_mutex_lock(lock);
+    wait = admit_bucket(&c->ip->tokens, &c->ip->refilled, vs_ip_rate, now);
+    pthread_mutex_unlock(lock);
+
+    /* the connection's own token goes back when its address has none */
+    if (wait && vs_conn_rate > 0) {
+      c->tokens += 1.0;
+    }
+  }
+
+  if (wait) {
+    c->held_until = now + wait;
+    return ERR_FULL;
+  }
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Returns a token taken for a request that hadn't all arrived
+ */
+void admit_refund(vsconn *c) {
+  pthread_mutex_t *lock = NULL;
+
+  if (c->upstream) {
+    return;
+  }
+
+  if (vs_conn_rate > 0) {
+    c->tokens += 1.0;
+  }
+
+  if (c->ip != NULL) {
+    lock = &vs_admit_locks[admit_slot(c->ip->addr) % ADMIT_IP_STRIPES];
+    pthread_mutex_lock(lock);
+    c->ip->tokens += 1.0;
+    pthread_mutex_unlock(lock);
+  }
+}
+
+/**
+ * Determines if a connection has requests left to serve without waiting
+ * for more input
+ */
+int admit_ready(vsconn *c, unsigned long long now) {
+  if (c->held_until) {
+    if (now < c->held_until) {
+      return 0;
+    }
+
+    c->held_until = 0;
+    return 1;
+  }
+
+  return c->backlog;
+}
+
+/**
+ * Works out how long the event loop may sleep
+ */
+int admit_poll_timeout(vsconn *c, unsigned long long now, int timeout) {
+  unsigned long long ms;
+
+  if (c->backlog && !c->held_until) {
+    return 0;
+  }
+
+  if (c->held_until == 0) {
+    return timeout;
+  }
+
+  ms = c->held_until > now ? (c->held_until - now + 999999) / 1000000 : 0;
+
+  return (timeout < 0 || ms < (unsigned long long)timeout) ? (int)ms : timeout;
+}
@@ -0,0 +1,127 @@
+#ifndef __varsvr_admit_h_
+
+#define __varsvr_admit_h_
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "./conn.h"
+#include "./errors.h"
+
+/*
+ * Admission control, so that no one client can crowd out the rest:
+ *
+ *  - a cap on the connections open across every worker; connections past
+ *    it are told so and closed as soon as they're accepted
+ *  - token buckets limiting the request rate of each connection and of
+ *    each source address (across all of that address' connections); a
+ *    client that runs out has its remaining requests held, unread, until
+ *    the bucket has refilled
+ *  - a budget of requests served per connection in each pass of the event
+ *    loop; a pipelined burst past it is left for following passes, in which
+ *    the worker's other ready connections get their turn first
+ *
+ * Buckets hold a second's worth of requests, so a client may burst up to
+ * its rate before being held. Rate limits don't apply to a replica's link
+ * to its primary.
+ */
+
+/* most connections a listener accepts in one pass of the event loop */
+#define ADMIT_ACCEPT_BATCH  32
+
+/* locks guarding the source address table, each covering a slice of it */
+#define ADMIT_IP_STRIPES    64
+#define ADMIT_IP_SLOTS      1024
+
+/**
+ * @struct _tag_vsclientip
+ * @brief A source address with open connections, and its rate limit
+ */
+typedef struct _tag_vsclientip {
+  struct _tag_vsclientip *next;
+
+  unsigned char addr[16]; /* IPv4 addresses are held IPv4 mapped */
+  unsigned int conns;     /* open connections from the address */
+
+  double tokens;
+  unsigned long long refilled;
+} vsclientip;
+
+extern int vs_max_conns;
+extern int vs_conn_rate;
+extern int vs_ip_rate;
+extern int vs_request_budget;
+
+/**
+ * Creates the source address table
+ */
+int admit_init();
+
+/**
+ * Releases the source address table
+ */
+int admit_teardown();
+
+/**
+ * Reads the clock that rate limits are kept by, in nanoseconds
+ */
+unsigned long long admit_now();
+
+/**
+ * Takes a place for a newly accepted connection under the connection cap
+ * @returns ERR_SUCCESS, otherwise ERR_FULL when the server is at its cap
+ */
+int admit_accept();
+
+/**
+ * Counts the connections open across every worker
+ */
+int admit_count();
+
+/**
+ * Gives back a place taken by admit_accept for a connection that was never
+ * set up
+ */
+void admit_cancel();
+
+/**
+ * Counts a set up connection against the cap and its source address
+ */
+int admit_attach(vsconn *c, struct sockaddr *addr);
+
+/**
+ * Releases everything a connection holds against the cap and its address
+ */
+void admit_release(vsconn *c);
+
+/**
+ * Takes a token for a request from the connection's buckets. When either
+ * is empty the connection is held until a token is due
+ * @returns ERR_SUCCESS, otherwise ERR_FULL when the request must wait
+ */
+int admit_take(vsconn *c);
+
+/**
+ * Returns a token taken for a request that hadn't all arrived
+ */
+void admit_refund(vsconn *c);
+
+/**
+ * Determines if a connection has requests left to serve without waiting
+ * for more input, releasing it from a hold that has expired
+ */
+int admit_ready(vsconn *c, unsigned long long now);
+
+/**
+ * Works out how long the event loop may sleep, given a connection that is
+ * waiting on admission control
+ */
+int admit_poll_timeout(vsconn *c, unsigned long long now, int timeout);
+
+#endif /* __varsvr_admit_h_ */
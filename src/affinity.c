@@ -0,0 +1,68 @@
+#include "./affinity.h"
+
+/**
+ * Pins the calling thread to a CPU
+ */
+int affinity_pin(int cpu) {
+  int rc;
+  cpu_set_t set;
+
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+
+  if ((rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) != 0) {
+    log_error("Unable to pin to cpu %d (errno=%d)", cpu, rc);
+    return ERR_DMINIT;
+  }
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Finds the NUMA node a CPU belongs to
+ */
+int affinity_node(int cpu) {
+  int node = -1;
+  char path[64];
+  DIR *dir = NULL;
+  struct dirent *ent = NULL;
+
+  /* sysfs links each cpu to its node as cpuN/nodeM */
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+
+  if ((dir = opendir(path)) == NULL) {
+    return -1;
+  }
+
+  while ((ent = readdir(dir)) != NULL) {
+    if (strncmp(ent->d_name, "node", 4) == 0 && sscanf(ent->d_name + 4, "%d", &node) == 1) {
+      break;
+    }
+  }
+
+  closedir(dir);
+
+  return node;
+}
+
+/**
+ * Asks for the pages of a region to live on a node as they are touched
+ */
+int affinity_bind(void *p, size_t len, int node) {
+  unsigned long mask[4];
+
+  if (node < 0 || node >= sizeof(mask) * 8) {
+    return ERR_INVPTR;
+  }
+
+  memset(mask, 0, sizeof(mask));
+  mask[node / (sizeof(unsigned long) * 8)] = 1UL << (node % (sizeof(unsigned long) * 8));
+
+  /* preferred rather than bound, so a full node spills over instead of
+   * failing the allocation */
+  if (syscall(SYS_mbind, p, len, MPOL_PREFERRED, mask, sizeof(mask) * 8, 0) != 0) {
+    return ERR_NOMEM;
+  }
+
+  return ERR_SUCCESS;
+}
@@ -0,0 +1,50 @@
+#ifndef __varsvr_affinity_h_
+
+#define __varsvr_affinity_h_
+
+/* CPU affinity */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#include "./log.h"
+#include "./errors.h"
+
+/*
+ * CPU and NUMA placement. Event loop threads are pinned to CPUs, and memory
+ * that a thread keeps for itself is asked to live on that CPU's node. The
+ * kernel's mbind is called directly, so that nothing beyond libc is needed;
+ * where it isn't available, memory still lands on the node of the thread
+ * that first touches it.
+ */
+
+/**
+ * Pins the calling thread to a CPU
+ */
+int affinity_pin(int cpu);
+
+/**
+ * Finds the NUMA node a CPU belongs to
+ * @returns The node, otherwise -1 when the system doesn't say
+ */
+int affinity_node(int cpu);
+
+/**
+ * Asks for the pages of a region to live on a node as they are touched.
+ * The region must be whole pages of its own, such as a fresh mapping, for
+ * the policy applies to everything else on them too
+ */
+int affinity_bind(void *p, size_t len, int node);
+
+#endif /* __varsvr_affinity_h_ */
@@ -1,11 +1,87 @@
-
 #include "bintree.h"
 
-int bintree_cmp_str(const void *a, const void *b) {
-  char *s1 = (char *)a;
-  char *s2 = (char *)b;
+/**
+ * Measures and hashes a key (32 bit FNV-1a) in a single pass
+ */
+void bintree_probe_init(bintree_probe *p, const char *key) {
+   const unsigned char *c = (const unsigned char *)key;
+   unsigned int h = 2166136261u;
+
+   while (*c) {
+      h = (h ^ *c ++) * 16777619u;
+   }
+
+   p->key = key;
+   p->len = (unsigned int)((const char *)c - key);
+   p->hash = h;
+}
+
+/**
+ * Compares a key with a node's, given a prefix they are known to share
+ * @param skip Bytes at the start of both keys known to be equal
+ * @param lcp Receives the length of the prefix the keys share
+ * @returns <0, 0 or >0 as the key orders before, with or after the node's
+ */
+int bintree_compare(const bintree_probe *p, const bintree_node *n,
+                    unsigned int skip, unsigned int *lcp) {
+   unsigned int i = skip, end = (p->len < n->len) ? p->len : n->len;
+   unsigned long long a, b;
+
+   /* equal keys are recognised by their hash and length first */
+   if (p->hash == n->hash && p->len == n->len &&
+       memcmp(p->key + skip, n->key + skip, p->len - skip) == 0) {
+      *lcp = p->len;
+      return 0;
+   }
+
+   /* otherwise find where they part, a word at a time */
+   while (i + sizeof(a) <= end) {
+      memcpy(&a, p->key + i, sizeof(a));
+      memcpy(&b, n->key + i, sizeof(b));
+
+      if (a != b)
+         break;
+
+      i += sizeof(a);
+   }
+
+   while (i < end && p->key[i] == n->key[i]) {
+      i ++;
+   }
+
+   *lcp = i;
+
+   if (i < end)
+      return (int)(unsigned char)p->key[i] - (int)(unsigned char)n->key[i];
+
+   return (p->len > n->len) - (p->len < n->len);
+}
 
-  return strcmp(s1, s2);
+/**
+ * Finds the link that points at a key's node, or at where it belongs
+ * @returns The link, whose target is NULL when the key isn't in the tree
+ */
+bintree_node** bintree_find_link(bintree *t, const bintree_probe *p) {
+   int cval;
+   unsigned int lo = 0, hi = 0, lcp = 0;
+   bintree_node **link = &t->root, *n = NULL;
+
+   /* lo and hi are the prefixes the key shares with the nearest nodes
+    * descended past on either side; every node below shares the lesser */
+   while ((n = *link) != NULL) {
+      if ((cval = bintree_compare(p, n, (lo < hi) ? lo : hi, &lcp)) == 0)
+         break;
+
+      if (cval < 0) {
+         hi = lcp;
+         link = &n->left;
+      } else {
+         lo = lcp;
+         link = &n->right;
+      }
+   }
+
+   return link;
 }
 
 /**
@@ -19,15 +95,23 @@ bintree* bintree_create() {
       return NULL;
    }
 
-   t->comp = bintree_cmp_str;
    t->root = NULL;
+   t->alloc = malloc;
+   t->release = free;
 
    return t;
 }
 
 /**
  */
-void bintree_destroy_branch(bintree_node *n) {
+void bintree_set_allocator(bintree *t, bintree_alloc alloc, bintree_release release) {
+   t->alloc = alloc;
+   t->release = release;
+}
+
+/**
+ */
+void bintree_destroy_branch(bintree *t, bintree_node *n) {
 
    /* protect against a bad node */
    if (!n)
@@ -35,18 +119,18 @@ void bintree_destroy_branch(bintree_node *n) {
 
    /* check and destroy any candidate to the left */
    if (n->left) {
-      bintree_destroy_branch(n->left);
+      bintree_destroy_branch(t, n->left);
       n->left = NULL;
    }
 
    /* check and destroy any candidate to the right */
    if (n->right) {
-      bintree_destroy_branch(n->right);
+      bintree_destroy_branch(t, n->right);
       n->right = NULL;
    }
 
    /* release the memory for this node */
-   free(n);
+   t->release(n);
    n = NULL;
 }
 
@@ -59,7 +143,7 @@ int bintree_destroy(bintree **t) {
    }
 
    /* destroy the tree at the root */
-   bintree_destroy_branch((*t)->root);
+   bintree_destroy_branch(*t, (*t)->root);
 
    /* destroy the container */
    free(*t);
@@ -69,111 +153,212 @@ int bintree_destroy(bintree **t) {
 }
 
 /**
- * Traverses the tree and finds the most appropriate place to put
- * a new node
- * @returns The added leaf. Failure results in NULL
  */
-bintree_node* bintree_create_leaf(bintree *t,
-                                  bintree_node *n,
-                                  void *key,
-                                  void *data) {
-   int cval = t->comp(key, n->key);
-   bintree_node *l = NULL;
-
-   /* if the comparator told us the keys are the same, bail out
-    * as we can't add the same key to this tree more than once */
-   if (cval == 0)
-      return NULL;
+int bintree_insert(bintree *t, const char *key, void *data) {
+   bintree_probe p;
+   bintree_node **link = NULL, *l = NULL;
 
-   /* recurse into the structure if required */
-   if ((cval == -1) && (n->left)) {
-      bintree_create_leaf(t, n->left, key, data);
-      return n->left;
-   } else if ((cval == 1) && (n->right)) {
-      bintree_create_leaf(t, n->right, key, data);
-      return n->right;
+   /* sanity check the tree */
+   if (!t || !key) {
+      return -1;
    }
 
-   /* create the new leaf */
-   l = (bintree_node*)malloc(sizeof(bintree_node));
-   l->left = n->right = NULL;
-   l->key = key;
+   bintree_probe_init(&p, key);
+   link = bintree_find_link(t, &p);
+
+   /* we can't add the same key to this tree more than once */
+   if (*link)
+      return -1;
+
+   /* create the new leaf, its key stored inline */
+   l = (bintree_node*)t->alloc(bintree_node_size(p.len));
+
+   if (!l)
+      return -1;
+
+   l->left = l->right = NULL;
    l->data = data;
+   l->hash = p.hash;
+   l->len = p.len;
+   memcpy(l->key, key, p.len + 1);
 
    /* place the node in the structure */
-   if (cval == -1) {
-      n->left = l;
-   } else if (cval == 1) {
-      n->right = l;
+   *link = l;
+
+   return 0;
+}
+
+/**
+ */
+void* bintree_find(bintree *t, const char *key) {
+   bintree_probe p;
+   bintree_node *leaf = NULL;
+
+   /* sanity check the tree */
+   if (!t || !t->root || !key) {
+      return NULL;
    }
 
-   return n;
+   /* try to find the right item */
+   bintree_probe_init(&p, key);
+   leaf = *bintree_find_link(t, &p);
+
+   return leaf != NULL ? leaf->data : NULL;
 }
 
 /**
+ * Visits a branch of the tree in key order
+ * @returns 0 to keep walking, otherwise the visitor's non-zero result
  */
-int bintree_insert(bintree *t, void *key, void *data) {
+int bintree_walk_branch(bintree_node *n, bintree_visitor fn, void *arg) {
+   int rc;
+
+   if (!n)
+      return 0;
+
+   if ((rc = bintree_walk_branch(n->left, fn, arg)) != 0)
+      return rc;
+
+   if ((rc = fn(n->key, n->data, arg)) != 0)
+      return rc;
+
+   return bintree_walk_branch(n->right, fn, arg);
+}
+
+/**
+ */
+int bintree_walk(bintree *t, bintree_visitor fn, void *arg) {
 
    /* sanity check the tree */
-   if (!t) {
+   if (!t || !fn) {
       return -1;
    }
 
-   /* sanity check the root */
-   if (t->root) {
-      /* insert the item */
-      return (bintree_create_leaf(t, t->root, key, data) != NULL ? 0 : -1);
+   return bintree_walk_branch(t->root, fn, arg);
+}
+
+/**
+ */
+bintree_node* bintree_detach(bintree *t, const char *key) {
+   bintree_probe p;
+   bintree_node **link = NULL, **slink = NULL, *n = NULL, *s = NULL;
+
+   /* sanity check the tree */
+   if (!t || !key) {
+      return NULL;
+   }
+
+   /* find the link that points at the matching node */
+   bintree_probe_init(&p, key);
+   link = bintree_find_link(t, &p);
+
+   if ((n = *link) == NULL) {
+      return NULL;
    }
 
-   /* the root needs to be constructed */
-   t->root = (bintree_node*)malloc(sizeof(bintree_node));
-   t->root->left = t->root->right = NULL;
-   t->root->key = key;
-   t->root->data = data;
+   if (n->left && n->right) {
+      /* a node with two children is replaced by its in-order successor,
+       * which is unlinked from below it first; keys live in their nodes,
+       * so the node itself moves rather than its key */
+      slink = &n->right;
+
+      while ((*slink)->left) {
+         slink = &(*slink)->left;
+      }
+
+      s = *slink;
+      *slink = s->right;
+      s->left = n->left;
+      s->right = n->right;
+      *link = s;
+   } else {
+      *link = n->left ? n->left : n->right;
+   }
 
-   return 0;
+   n->left = n->right = NULL;
+
+   return n;
 }
 
 /**
- * Recurses into the tree searching for a key match
- * @returns The node if one is found, otherwise NULL
  */
-bintree_node* bintree_find_leaf(bintree *t,
-                                bintree_node *n,
-                                void *key) {
-   int cval = t->comp(key, n->key);
-   bintree_node *leaf = NULL;
+int bintree_attach(bintree *t, bintree_node *n) {
+   bintree_probe p;
+   bintree_node **link = NULL;
 
-   /* if the comparator told us the keys are the same, we have
-    * found the value we're looking for! */
-   if (cval == 0)
-      return n;
+   /* sanity check the tree */
+   if (!t || !n) {
+      return -1;
+   }
+
+   /* the node goes back wherever its key now belongs */
+   bintree_probe_init(&p, n->key);
+   link = bintree_find_link(t, &p);
 
-   /* recurse into the structure if required */
-   if ((cval == -1) && (n->left)) {
-      leaf = bintree_find_leaf(t, n->left, key);
-   } else if ((cval == 1) && (n->right)) {
-      leaf = bintree_find_leaf(t, n->right, key);
+   if (*link)
+      return -1;
+
+   *link = n;
+
+   return 0;
+}
+
+/**
+ */
+int bintree_delete(bintree *t, const char *key, void **odata) {
+   bintree_node *n = bintree_detach(t, key);
+
+   if (!n) {
+      return -1;
    }
 
-   /* send the leaf out */
-   return leaf;
+   /* hand the stored data back so the caller can release it */
+   if (odata)
+      *odata = n->data;
+
+   t->release(n);
+
+   return 0;
 }
 
 /**
+ * Visits the links in a branch of the tree in key order
+ * @returns 0 to keep walking, otherwise the visitor's non-zero result
  */
-void* bintree_find(bintree *t, void *key) {
+int bintree_walk_links_branch(bintree_node **link, const bintree_probe *after,
+                              bintree_link_visitor fn, void *arg) {
+   int rc;
+   unsigned int lcp;
 
-   bintree_node *leaf = NULL;
+   if (!*link)
+      return 0;
+
+   /* nothing to the left of a node at or before the start is visited */
+   if (after && bintree_compare(after, *link, 0, &lcp) >= 0)
+      return bintree_walk_links_branch(&(*link)->right, after, fn, arg);
+
+   if ((rc = bintree_walk_links_branch(&(*link)->left, after, fn, arg)) != 0)
+      return rc;
+
+   if ((rc = fn(link, arg)) != 0)
+      return rc;
+
+   /* the visitor may have moved the node, so its link is read again */
+   return bintree_walk_links_branch(&(*link)->right, NULL, fn, arg);
+}
+
+/**
+ */
+int bintree_walk_links(bintree *t, const char *after, bintree_link_visitor fn, void *arg) {
+   bintree_probe p;
 
    /* sanity check the tree */
-   if (!t) {
-      return NULL;
+   if (!t || !fn) {
+      return -1;
    }
 
-   /* try to find the right item */
-   leaf = bintree_find_leaf(t, t->root, key);
+   if (after)
+      bintree_probe_init(&p, after);
 
-   return leaf != NULL ? leaf->data : NULL;
+   return bintree_walk_links_branch(&t->root, after ? &p : NULL, fn, arg);
 }
-
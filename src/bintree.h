@@ -8,12 +8,29 @@
 /*
  * Binary tree implementation
  * http://en.wikipedia.org/wiki/Binary_tree
+ *
+ * Keys are strings, ordered bytewise, and the tree keeps its own copy of
+ * each: a node is allocated with its key inline after the key's length and
+ * hash, so that no key costs an allocation or a pointer to chase of its
+ * own. A key is hashed once per operation; a node whose hash and length
+ * match is checked with one memcmp, and otherwise the keys are compared
+ * from the prefix they are already known to share. Descending the tree
+ * narrows the range the key falls in, and every key in that range shares
+ * the prefix common to the key and both of the range's bounds, so long
+ * keys sharing a hierarchical prefix aren't compared from the start at
+ * every level.
  */
 
 /**
- * b-tree comparator function signature
+ * b-tree visitor function signature; a non-zero return stops the walk
  */
-typedef int(*bintree_cmp)(const void *, const void *);
+typedef int(*bintree_visitor)(void *key, void *data, void *arg);
+
+/**
+ * b-tree node allocator signatures
+ */
+typedef void*(*bintree_alloc)(size_t size);
+typedef void(*bintree_release)(void *p);
 
 /**
  * @struct bintree_node_t
@@ -23,17 +40,39 @@ typedef struct bintree_node_t {
    struct bintree_node_t *left;  /* left leaf node */
    struct bintree_node_t *right; /* right leaf node */
 
-   void *key;                  /* key identifying this node */
    void *data;                 /* data at this node */
+   unsigned int hash;          /* hash of the key */
+   unsigned int len;           /* length of the key */
+   char key[];                 /* key identifying this node, NUL terminated */
 } bintree_node;
 
+/* bytes allocated for a node holding a key of some length */
+#define bintree_node_size(len) (sizeof(bintree_node) + (len) + 1)
+
+/**
+ * b-tree link visitor signature; it may point the link at a copy of its
+ * node, and a non-zero return stops the walk
+ */
+typedef int(*bintree_link_visitor)(bintree_node **link, void *arg);
+
+/**
+ * @struct bintree_probe_t
+ * @brief A key being looked for, measured and hashed once
+ */
+typedef struct bintree_probe_t {
+   const char *key;
+   unsigned int len;
+   unsigned int hash;
+} bintree_probe;
+
 /**
  * @struct bintree_t
  * @brief Defines a b-tree structure
  */
 typedef struct bintree_t {
-   bintree_cmp             comp; /* the comparator used on key items */
    struct bintree_node_t  *root; /* root node of the tree */
+   bintree_alloc          alloc; /* allocates nodes */
+   bintree_release      release; /* frees nodes */
 } bintree;
 
 /**
@@ -42,6 +81,14 @@ typedef struct bintree_t {
  */
 bintree* bintree_create();
 
+/**
+ * Has an empty tree allocate its nodes with something other than malloc
+ * @param t The tree
+ * @param alloc Allocates nodes
+ * @param release Frees nodes
+ */
+void bintree_set_allocator(bintree *t, bintree_alloc alloc, bintree_release release);
+
 /**
  * Destroys a binary tree
  * @param t The tree to destroy
@@ -52,11 +99,11 @@ int bintree_destroy(bintree **t);
 /**
  * Inserts an item into the tree
  * @param t The tree to insert into
- * @param key The key to store the value with
+ * @param key The key to store the value with; the tree keeps a copy
  * @param data The data to store
  * @returns 0 on success, otherwise -1
  */
-int bintree_insert(bintree *t, void *key, void *data);
+int bintree_insert(bintree *t, const char *key, void *data);
 
 /**
  * Attempts to find an item in the tree
@@ -64,6 +111,53 @@ int bintree_insert(bintree *t, void *key, void *data);
  * @param key The key to look for
  * @returns The data value if the key is found, otherwise NULL
  */
-void* bintree_find(bintree *t, void *key);
+void* bintree_find(bintree *t, const char *key);
+
+/**
+ * Removes an item from the tree
+ * @param t The tree to remove from
+ * @param key The key of the item to remove
+ * @param odata Receives the data that was stored with the item; may be NULL
+ * @returns 0 on success, otherwise -1
+ */
+int bintree_delete(bintree *t, const char *key, void **odata);
+
+/**
+ * Takes an item's node out of the tree without releasing it
+ * @param t The tree to take it from
+ * @param key The key of the item
+ * @returns The node, otherwise NULL when the key isn't in the tree
+ */
+bintree_node* bintree_detach(bintree *t, const char *key);
+
+/**
+ * Puts a node taken out with bintree_detach back into the tree; nothing
+ * is allocated, so this can't run out of memory
+ * @param t The tree it was taken from
+ * @param n The node
+ * @returns 0 on success, otherwise -1 when its key is in the tree again
+ */
+int bintree_attach(bintree *t, bintree_node *n);
+
+/**
+ * Visits every item in the tree in key order
+ * @param t The tree to walk
+ * @param fn The visitor to call for each key/data pair; the key it is
+ *           handed belongs to the tree
+ * @param arg Caller state handed to the visitor
+ * @returns 0 when every item was visited, otherwise the visitor's result
+ */
+int bintree_walk(bintree *t, bintree_visitor fn, void *arg);
+
+/**
+ * Visits the link to every node whose key orders after a given key, in key
+ * order, so that nodes can be moved
+ * @param t The tree to walk
+ * @param after The key to start after, or NULL to visit every node
+ * @param fn The visitor to call for each link
+ * @param arg Caller state handed to the visitor
+ * @returns 0 when every node was visited, otherwise the visitor's result
+ */
+int bintree_walk_links(bintree *t, const char *after, bintree_link_visitor fn, void *arg);
 
 #endif /* __libced_bintree_h_ */
@@ -0,0 +1,349 @@
+#include "./config.h"
+#include "./daemon.h"
+#include "./poller.h"
+
+int vs_foreground = 0;
+int vs_workers = 1;
+int vs_cpus[CONFIG_MAX_CPUS];
+int vs_n_cpus = 0;
+
+/**
+ * Parses a whole, positive integer
+ */
+int config_int(const char *value, int *out) {
+  char *end = NULL;
+  long n;
+
+  errno = 0;
+  n = strtol(value, &end, 10);
+
+  if (errno || end == value || *end != 0 || n <= 0 || n > 0x7fffffff) {
+    return ERR_BADREQ;
+  }
+
+  *out = (int)n;
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Parses file permissions given in octal
+ */
+int config_mode(const char *value, int *out) {
+  char *end = NULL;
+  long n;
+
+  errno = 0;
+  n = strtol(value, &end, 8);
+
+  if (errno || end == value || *end != 0 || n < 0 || n > 0777) {
+    return ERR_BADREQ;
+  }
+
+  *out = (int)n;
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Parses a TCP port number
+ */
+int config_port(const char *value, int *out) {
+  char *end = NULL;
+  long n;
+
+  errno = 0;
+  n = strtol(value, &end, 10);
+
+  if (errno || end == value || *end != 0 || n < 1 || n > 65535) {
+    return ERR_BADREQ;
+  }
+
+  *out = (int)n;
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Makes a relative path absolute, from the current directory, so that it
+ * still means the same once the daemon has changed directory
+ * @returns The path in memory of its own, otherwise NULL
+ */
+char* config_path(const char *value) {
+  char cwd[PATH_MAX], *path = NULL;
+  size_t len;
+
+  if (value[0] == '/') {
+    return strdup(value);
+  }
+
+  if (getcwd(cwd, sizeof(cwd)) == NULL) {
+    return NULL;
+  }
+
+  len = strlen(cwd) + strlen(value) + 2;
+
+  if ((path = (char *)malloc(len)) != NULL) {
+    snprintf(path, len, "%s/%s", cwd, value);
+  }
+
+  return path;
+}
+
+/**
+ * Parses a byte count with an optional K, M or G suffix
+ */
+int config_size(const char *value, unsigned long long *out) {
+  char *end = NULL;
+  unsigned long long n;
+
+  errno = 0;
+  n = strtoull(value, &end, 10);
+
+  if (errno || end == value || value[0] == '-') {
+    return ERR_BADREQ;
+  }
+
+  switch (toupper((unsigned char)*end)) {
+    case 'G': n <<= 10; /* fall through */
+    case 'M': n <<= 10; /* fall through */
+    case 'K': n <<= 10; end ++; break;
+    case 0: break;
+    default: return ERR_BADREQ;
+  }
+
+  if (*end != 0 && !(toupper((unsigned char)*end) == 'B' && end[1] == 0)) {
+    return ERR_BADREQ;
+  }
+
+  *out = n;
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Parses yes/no, on/off, true/false or 1/0
+ */
+int config_bool(const char *value, int *out) {
+  if (!strcmp(value, "yes") || !strcmp(value, "on") || !strcmp(value, "true") || !strcmp(value, "1")) {
+    *out = 1;
+  } else if (!strcmp(value, "no") || !strcmp(value, "off") || !strcmp(value, "false") || !strcmp(value, "0")) {
+    *out = 0;
+  } else {
+    return ERR_BADREQ;
+  }
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Parses a CPU list such as 0-3,8,10-11
+ */
+int config_cpus(const char *value) {
+  int n = 0, cpu;
+  long lo, hi;
+  const char *p = value;
+  char *end = NULL;
+
+  while (*p) {
+    lo = hi = strtol(p, &end, 10);
+
+    if (end == p || lo < 0) {
+      return ERR_BADREQ;
+    }
+
+    if (*end == '-') {
+      p = end + 1;
+      hi = strtol(p, &end, 10);
+
+      if (end == p || hi < lo) {
+        return ERR_BADREQ;
+      }
+    }
+
+    for (cpu = lo; cpu <= hi; cpu ++) {
+      if (n >= CONFIG_MAX_CPUS) {
+        return ERR_BADREQ;
+      }
+
+      vs_cpus[n ++] = cpu;
+    }
+
+    if (*end == ',') {
+      end ++;
+    } else if (*end != 0) {
+      return ERR_BADREQ;
+    }
+
+    p = end;
+  }
+
+  if (n == 0) {
+    return ERR_BADREQ;
+  }
+
+  vs_n_cpus = n;
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Splits a host:port (or [host]:port) specification
+ */
+int config_host_port(char *spec, char **host, int *port) {
+  char *sep = strrchr(spec, ':');
+
+  if (sep == NULL || sep == spec || config_port(sep + 1, port) != ERR_SUCCESS) {
+    return ERR_BADREQ;
+  }
+
+  *sep = 0;
+
+  if (spec[0] == '[' && sep[-1] == ']') {
+    sep[-1] = 0;
+    spec ++;
+  }
+
+  *host = spec;
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Applies a single setting
+ */
+int config_set(const char *name, const char *value) {
+  int engine, n;
+  char *copy = NULL;
+
+  if (!strcmp(name, "port")) {
+    return config_port(value, &vs_port);
+  } else if (!strcmp(name, "backlog")) {
+    return config_int(value, &vs_backlog);
+  } else if (!strcmp(name, "workers")) {
+    if (config_int(value, &n) != ERR_SUCCESS || n > WORKER_MAX) {
+      return ERR_BADREQ;
+    }
+
+    vs_workers = n;
+    return ERR_SUCCESS;
+  } else if (!strcmp(name, "poll-timeout")) {
+    return config_int(value, &vs_poll_timeout);
+  } else if (!strcmp(name, "foreground")) {
+    return config_bool(value, &vs_foreground);
+  } else if (!strcmp(name, "memory-limit")) {
+    return config_size(value, &vs_memory_limit);
+  } else if (!strcmp(name, "latency-tracing")) {
+    return config_bool(value, &vs_trace);
+  } else if (!strcmp(name, "slowlog-threshold")) {
+    if (config_int(value, &n) != ERR_SUCCESS) {
+      return ERR_BADREQ;
+    }
+
+    /* given in microseconds */
+    vs_slowlog_threshold = (unsigned long long)n * 1000;
+    return ERR_SUCCESS;
+  } else if (!strcmp(name, "max-connections")) {
+    return config_int(value, &vs_max_conns);
+  } else if (!strcmp(name, "client-rate")) {
+    return config_int(value, &vs_conn_rate);
+  } else if (!strcmp(name, "address-rate")) {
+    return config_int(value, &vs_ip_rate);
+  } else if (!strcmp(name, "request-budget")) {
+    return config_int(value, &vs_request_budget);
+  } else if (!strcmp(name, "hot-key-cache")) {
+    return config_bool(value, &vs_hot_cache);
+  } else if (!strcmp(name, "active-defrag")) {
+    return config_bool(value, &vs_defrag);
+  } else if (!strcmp(name, "defrag-threshold")) {
+    return config_int(value, &vs_defrag_threshold);
+  } else if (!strcmp(name, "defrag-step")) {
+    return config_int(value, &vs_defrag_step);
+  } else if (!strcmp(name, "defrag-min-waste")) {
+    return config_size(value, &vs_defrag_min_waste);
+  } else if (!strcmp(name, "cpus")) {
+    return config_cpus(value);
+  } else if (!strcmp(name, "unix-socket-mode")) {
+    return config_mode(value, &vs_unix_mode);
+  } else if (!strcmp(name, "io-engine")) {
+    if ((engine = poller_engine(value)) < 0) {
+      return ERR_BADREQ;
+    }
+
+    vs_io_engine = engine;
+    return ERR_SUCCESS;
+  }
+
+  /* the remaining settings keep hold of their text */
+  if (strcmp(name, "unix-socket") && strcmp(name, "replica-of")) {
+    return ERR_NOTFOUND;
+  }
+
+  if ((copy = !strcmp(name, "unix-socket") ? config_path(value) : strdup(value)) == NULL) {
+    return ERR_NOMEM;
+  }
+
+  if (!strcmp(name, "unix-socket")) {
+    vs_unix_path = copy;
+  } else if (config_host_port(copy, &vs_repl_host, &vs_repl_port) != ERR_SUCCESS) {
+    free(copy);
+    return ERR_BADREQ;
+  }
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Applies every setting in a config file
+ */
+int config_load(const char *path) {
+  int rc = ERR_SUCCESS, line_no = 0;
+  char line[CONFIG_MAX_LINE], *name = NULL, *value = NULL, *end = NULL;
+  FILE *f = fopen(path, "r");
+
+  if (f == NULL) {
+    fprintf(stderr, "%s: unable to open config file (errno=%d)\n", path, errno);
+    return ERR_NOTFOUND;
+  }
+
+  while (rc == ERR_SUCCESS && fgets(line, sizeof(line), f)) {
+    line_no ++;
+
+    if ((end = strchr(line, '#')) != NULL) {
+      *end = 0;
+    }
+
+    /* trim the line, then split the name from its value */
+    for (end = line + strlen(line); end > line && isspace((unsigned char)end[-1]); end --);
+    *end = 0;
+
+    for (name = line; isspace((unsigned char)*name); name ++);
+
+    if (*name == 0) {
+      continue;
+    }
+
+    for (value = name; *value && !isspace((unsigned char)*value) && *value != '='; value ++);
+
+    if (*value) {
+      *value ++ = 0;
+    }
+
+    while (isspace((unsigned char)*value) || *value == '=') {
+      value ++;
+    }
+
+    if (*value == 0) {
+      fprintf(stderr, "%s:%d: no value for '%s'\n", path, line_no, name);
+      rc = ERR_BADREQ;
+    } else if ((rc = config_set(name, value)) == ERR_NOTFOUND) {
+      fprintf(stderr, "%s:%d: unknown setting '%s'\n", path, line_no, name);
+    } else if (rc != ERR_SUCCESS) {
+      fprintf(stderr, "%s:%d: invalid value for '%s'\n", path, line_no, name);
+    }
+  }
+
+  fclose(f);
+
+  return rc;
+}
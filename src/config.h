@@ -0,0 +1,81 @@
+#ifndef __varsvr_config_h_
+
+#define __varsvr_config_h_
+
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "./errors.h"
+
+/*
+ * Runtime configuration. Every setting can be given in a config file, one
+ * per line as
+ *
+ *   <name> <value>        (or <name> = <value>; '#' starts a comment)
+ *
+ * or on the command line, where it overrides the file:
+ *
+ *   port            -p  TCP port to listen on
+ *   unix-socket     -s  path of a unix domain socket to also listen on; a
+ *                       relative path is taken from the directory started in
+ *   unix-socket-mode    permissions of the unix domain socket, in octal
+ *                       (default 0600)
+ *   replica-of      -r  host:port of a primary to replicate
+ *   foreground      -f  stay attached to the terminal and log to stderr
+ *   backlog         -b  listen backlog
+ *   workers         -w  number of event loop threads
+ *   cpus            -a  CPUs to pin event loops to, e.g. 0-3,8
+ *   memory-limit    -m  most bytes the store may hold; K, M and G suffixes
+ *   io-engine       -e  poll or epoll
+ *   poll-timeout        longest an idle event loop sleeps, in milliseconds
+ *   max-connections     most clients connected at once (see admit.h)
+ *   client-rate         most requests per second from one connection
+ *   address-rate        most requests per second from one source address
+ *   request-budget      most requests served per connection in each pass
+ *                       of the event loop
+ *   hot-key-cache       cache replies for hot keys in each worker (see
+ *                       hotkey.h)
+ *   active-defrag       defragment the store in the background (see
+ *                       defrag.h)
+ *   defrag-threshold    fragmentation, as a percentage of the memory in
+ *                       use, past which defragmentation starts
+ *   defrag-min-waste    least wasted memory worth defragmenting; K, M and
+ *                       G suffixes
+ *   defrag-step         longest a defragmentation step holds the store,
+ *                       in microseconds
+ *   latency-tracing     time each phase of every request (see trace.h)
+ *   slowlog-threshold   request time, in microseconds, past which a traced
+ *                       request goes to the slow log
+ */
+
+#define CONFIG_MAX_LINE   1024
+#define CONFIG_MAX_CPUS   256
+
+extern int vs_foreground;
+extern int vs_workers;
+extern int vs_cpus[CONFIG_MAX_CPUS];
+extern int vs_n_cpus;
+
+/**
+ * Applies a single setting
+ * @returns ERR_SUCCESS, ERR_NOTFOUND for an unknown name, otherwise
+ *          ERR_BADREQ for a value that doesn't parse
+ */
+int config_set(const char *name, const char *value);
+
+/**
+ * Applies every setting in a config file, reporting problems on stderr
+ */
+int config_load(const char *path);
+
+/**
+ * Splits a host:port (or [host]:port) specification
+ */
+int config_host_port(char *spec, char **host, int *port);
+
+#endif /* __varsvr_config_h_ */
@@ -0,0 +1,490 @@
+#include "./conn.h"
+#include "./admit.h"
+#include "./txn.h"
+
+/**
+ * Creates the state for a newly accepted client
+ */
+vsconn* conn_create(int fd) {
+  vsconn *c = (vsconn *)malloc(sizeof(vsconn));
+
+  if (!c) {
+    return NULL;
+  }
+
+  c->fd = fd;
+  c->in = NULL;
+  c->out_head = c->out_tail = NULL;
+  c->out_bytes = 0;
+  c->paused = 0;
+  c->closing = 0;
+  c->watches = 0;
+  atomic_init(&c->missed, 0);
+  c->unflushed = NULL;
+  c->flush_pending = 0;
+  c->connecting = 0;
+  c->upstream = 0;
+  c->downstream = 0;
+  c->repl_offset = 0;
+  c->repl_held = 0;
+  c->repl_generation = 0;
+  c->repl_snapshot = 0;
+  c->repl_cursor = NULL;
+  c->local = 0;
+  c->shm = NULL;
+  c->link = NULL;
+  c->worker = NULL;
+  c->txn = NULL;
+  c->admitted = 0;
+  c->ip = NULL;
+  c->tokens = 0;
+  c->refilled = 0;
+  c->held_until = 0;
+  c->backlog = 0;
+
+  return c;
+}
+
+/**
+ * Closes a client connection and releases its state
+ */
+int conn_destroy(vsconn **c) {
+  vschunk *chunk = NULL;
+
+  if (!c || !(*c)) {
+    return ERR_INVPTR;
+  }
+
+  /* a shared memory channel's descriptor is its doorbell, closed along
+   * with the rest of the link */
+  if ((*c)->shm) {
+    shmlink_close((*c)->shm);
+    free((*c)->shm);
+  } else if ((*c)->fd >= 0) {
+    close((*c)->fd);
+  }
+
+  while ((chunk = (*c)->out_head) != NULL) {
+    (*c)->out_head = chunk->next;
+    vsbuf_release(&chunk->buf);
+    free(chunk);
+  }
+
+  txn_destroy(&(*c)->txn);
+  free((*c)->repl_cursor);
+  admit_release(*c);
+  vsbuf_release(&(*c)->in);
+  free(*c);
+  *c = NULL;
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Makes room for at least size more bytes in the input buffer
+ */
+int conn_reserve(vsconn *c, unsigned int size) {
+  unsigned int grow;
+  vsbuf *grown = NULL;
+
+  if (c->in == NULL) {
+    if ((c->in = vsbuf_alloc(size)) == NULL) {
+      log_error("Unable to allocate input buffer");
+      return ERR_NOMEM;
+    }
+  } else if (c->in->cap - c->in->len < size) {
+    grow = c->in->cap * 2;
+
+    if (grow < c->in->len + size) {
+      grow = c->in->len + size;
+    }
+
+    if ((grown = vsbuf_grow(c->in, grow)) == NULL) {
+      log_error("Unable to grow input buffer to %u bytes", grow);
+      return ERR_NOMEM;
+    }
+
+    c->in = grown;
+  }
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Takes whatever requests a shared memory client has produced
+ */
+int conn_read_shm(vsconn *c) {
+  uint32_t pending = shmlink_pending(c->shm);
+
+  if (pending == 0 && atomic_load(&c->shm->seg->closed)) {
+    return 0;
+  }
+
+  /* a paused or held client is left to wait on a full ring */
+  if (pending == 0 || c->paused || c->held_until || c->backlog) {
+    errno = EWOULDBLOCK;
+    return -1;
+  }
+
+  /* pending is at most the ring's size, whatever the client has written
+   * into the segment; bytes that can't be read mean it has been corrupted,
+   * and the channel is closed as though the client had gone */
+  if (conn_reserve(c, pending) != ERR_SUCCESS) {
+    return -1;
+  }
+
+  pending = shmlink_recv(c->shm, c->in->data + c->in->len, c->in->cap - c->in->len);
+  c->in->len += pending;
+
+  return pending;
+}
+
+/**
+ * Receives whatever is available on the socket into the input buffer
+ */
+int conn_read(vsconn *c) {
+  int rc;
+
+  if (c->shm) {
+    return conn_read_shm(c);
+  }
+
+  /* make sure there's a reasonable amount of room to receive into */
+  if (conn_reserve(c, CONN_READ_CHUNK) != ERR_SUCCESS) {
+    return -1;
+  }
+
+  do {
+    rc = recv(c->fd, c->in->data + c->in->len, c->in->cap - c->in->len, 0);
+  } while (rc < 0 && errno == EINTR);
+
+  if (rc < 0) {
+    if (errno != EWOULDBLOCK) {
+      log_error("Failed to receive from socket (errno=%d)", errno);
+    }
+
+    return -1;
+  }
+
+  c->in->len += rc;
+
+  return rc;
+}
+
+/**
+ * Discards processed bytes from the front of the input buffer
+ */
+void conn_consume(vsconn *c, unsigned int n) {
+  if (c->in == NULL) {
+    return ;
+  }
+
+  /* an idle connection hands its input buffer back to the pool */
+  if (n >= c->in->len) {
+    vsbuf_release(&c->in);
+    return ;
+  }
+
+  memmove(c->in->data, c->in->data + n, c->in->len - n);
+  c->in->len -= n;
+}
+
+/**
+ * Adds a chunk to the end of the output queue
+ */
+int conn_queue_chunk(vsconn *c, vsbuf *b, unsigned int off) {
+  vschunk *chunk = (vschunk *)malloc(sizeof(vschunk));
+
+  if (!chunk) {
+    return ERR_NOMEM;
+  }
+
+  chunk->next = NULL;
+  chunk->buf = b;
+  chunk->off = off;
+
+  if (c->out_tail) {
+    c->out_tail->next = chunk;
+  } else {
+    c->out_head = chunk;
+  }
+
+  c->out_tail = chunk;
+  c->out_bytes += b->len - off;
+
+  if (c->out_bytes >= CONN_HIGH_WATERMARK) {
+    c->paused = 1;
+  }
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Copies bytes onto the end of the output queue, filling the last queued
+ * buffer before drawing another from the pool
+ */
+int conn_queue_copy(vsconn *c, const char *data, unsigned int len) {
+  unsigned int n;
+  vsbuf *b = NULL;
+  vschunk *tail = c->out_tail;
+
+  /* only buffers this connection holds alone can be appended to */
+  if (tail && tail->buf->refs == 1 && tail->buf->cap > tail->buf->len) {
+    n = tail->buf->cap - tail->buf->len;
+    n = n < len ? n : len;
+
+    memcpy(tail->buf->data + tail->buf->len, data, n);
+    tail->buf->len += n;
+    c->out_bytes += n;
+
+    data += n;
+    len -= n;
+  }
+
+  if (len == 0) {
+    return ERR_SUCCESS;
+  }
+
+  if ((b = vsbuf_alloc(len)) == NULL) {
+    return ERR_NOMEM;
+  }
+
+  memcpy(b->data, data, len);
+  b->len = len;
+
+  if (conn_queue_chunk(c, b, 0) != ERR_SUCCESS) {
+    vsbuf_release(&b);
+    return ERR_NOMEM;
+  }
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Sends a set of buffers without blocking
+ * @returns The number of bytes sent, 0 when the socket is full, otherwise -1
+ */
+ssize_t conn_send(vsconn *c, struct iovec *iov, int iovcnt) {
+  ssize_t rc;
+  struct msghdr msg;
+
+  if (c->shm) {
+    return shmlink_send(c->shm, iov, iovcnt);
+  }
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = iovcnt;
+
+  /* a peer that has gone away must not raise SIGPIPE on the daemon */
+  do {
+    rc = sendmsg(c->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+  } while (rc < 0 && errno == EINTR);
+
+  if (rc < 0) {
+    if (errno == EWOULDBLOCK) {
+      return 0;
+    }
+
+    log_error("Failed to send to socket (errno=%d)", errno);
+    return -1;
+  }
+
+  return rc;
+}
+
+/**
+ * Writes a set of buffers to the client, in order
+ */
+int conn_writev(vsconn *c, struct iovec *iov, int iovcnt) {
+  ssize_t rc;
+
+  /* with nothing queued ahead, send directly from the caller's buffers */
+  while (c->out_head == NULL && !c->connecting && iovcnt > 0) {
+    if ((rc = conn_send(c, iov, iovcnt)) < 0) {
+      return ERR_CONNIO;
+    }
+
+    if (rc == 0) {
+      break;
+    }
+
+    /* step over everything that was fully written */
+    while (iovcnt > 0 && (size_t)rc >= iov->iov_len) {
+      rc -= iov->iov_len;
+      iov ++;
+      iovcnt --;
+    }
+
+    /* pick up from the middle of a partially written buffer */
+    if (iovcnt > 0) {
+      iov->iov_base = (char *)iov->iov_base + rc;
+      iov->iov_len -= rc;
+    }
+  }
+
+  /* the socket is full, so hold on to what's left */
+  for (; iovcnt > 0; iov ++, iovcnt --) {
+    if (conn_queue_copy(c, iov->iov_base, iov->iov_len) != ERR_SUCCESS) {
+      log_error("Unable to queue %u bytes of output", (unsigned int)iov->iov_len);
+      return ERR_NOMEM;
+    }
+  }
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Sends a message carrying open descriptors to a unix domain socket client
+ */
+int conn_send_fds(vsconn *c, const char *data, unsigned int len, int *fds, int nfds) {
+  ssize_t rc;
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cmsg = NULL;
+  char control[CMSG_SPACE(sizeof(int) * 4)];
+
+  if (!c->local || c->shm || nfds > 4) {
+    return ERR_BADREQ;
+  }
+
+  /* replies to earlier requests have to arrive first */
+  if (c->out_head) {
+    return ERR_PENDING;
+  }
+
+  iov.iov_base = (void *)data;
+  iov.iov_len = len;
+
+  memset(&msg, 0, sizeof(msg));
+  memset(control, 0, sizeof(control));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nfds);
+
+  do {
+    rc = sendmsg(c->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+  } while (rc < 0 && errno == EINTR);
+
+  /* the descriptors ride along with the first byte, so a short send still
+   * delivered them; the rest of the message is queued as normal */
+  if (rc < 0) {
+    log_error("Failed to pass descriptors (errno=%d)", errno);
+    return ERR_CONNIO;
+  }
+
+  if (rc < len) {
+    return conn_queue_copy(c, data + rc, len - rc);
+  }
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Queues a reference to a buffer for sending, without copying it
+ */
+int conn_queue(vsconn *c, vsbuf *b) {
+  int rc;
+
+  if (b->len == 0) {
+    return ERR_SUCCESS;
+  }
+
+  if ((rc = conn_queue_chunk(c, vsbuf_ref(b), 0)) != ERR_SUCCESS) {
+    vsbuf_release(&b);
+  }
+
+  return rc;
+}
+
+/**
+ * Sends as much queued output as the socket will take
+ */
+int conn_flush(vsconn *c) {
+  int n, err = 0;
+  ssize_t rc;
+  socklen_t err_len = sizeof(err);
+  vschunk *chunk = NULL;
+  struct iovec iov[CONN_MAX_IOV];
+
+  /* a writable socket that was connecting has either connected or failed */
+  if (c->connecting) {
+    if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &err_len) < 0 || err != 0) {
+      log_error("Failed to connect (errno=%d)", err ? err : errno);
+      return ERR_CONNIO;
+    }
+
+    c->connecting = 0;
+  }
+
+  while (c->out_head) {
+    for (n = 0, chunk = c->out_head; chunk && n < CONN_MAX_IOV; chunk = chunk->next, n ++) {
+      iov[n].iov_base = chunk->buf->data + chunk->off;
+      iov[n].iov_len = chunk->buf->len - chunk->off;
+    }
+
+    if ((rc = conn_send(c, iov, n)) < 0) {
+      return ERR_CONNIO;
+    }
+
+    if (rc == 0) {
+      break;
+    }
+
+    c->out_bytes -= rc;
+
+    /* release every chunk that has been completely sent */
+    while ((chunk = c->out_head) != NULL && rc >= chunk->buf->len - chunk->off) {
+      rc -= chunk->buf->len - chunk->off;
+
+      if ((c->out_head = chunk->next) == NULL) {
+        c->out_tail = NULL;
+      }
+
+      vsbuf_release(&chunk->buf);
+      free(chunk);
+    }
+
+    if (chunk) {
+      chunk->off += rc;
+    }
+  }
+
+  /* once the client has caught up, start serving it again */
+  if (c->paused && c->out_bytes <= CONN_LOW_WATERMARK) {
+    c->paused = 0;
+  }
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Works out which poll events the connection is interested in
+ */
+short conn_events(vsconn *c) {
+  short events = 0;
+
+  /* the doorbell of a shared memory channel announces both new requests
+   * and freed reply space */
+  if (c->shm) {
+    return POLLIN;
+  }
+
+  /* nothing more is read while earlier requests are still to be served */
+  if (!c->paused && !c->held_until && !c->backlog) {
+    events |= POLLIN;
+  }
+
+  if (c->out_head || c->connecting) {
+    events |= POLLOUT;
+  }
+
+  return events;
+}
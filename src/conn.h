@@ -0,0 +1,138 @@
+#ifndef __varsvr_conn_h_
+
+#define __varsvr_conn_h_
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "./log.h"
+#include "./errors.h"
+#include "./vsbuf.h"
+#include "./shmring.h"
+
+/* amount of free space made available ahead of each read */
+#define CONN_READ_CHUNK       4096
+
+/* queued output at which a connection stops being served, and the level
+ * it has to drain back down to before it is served again */
+#define CONN_HIGH_WATERMARK   (1024 * 1024)
+#define CONN_LOW_WATERMARK    (256 * 1024)
+
+/* most queued chunks handed to the kernel in one send */
+#define CONN_MAX_IOV          64
+
+/**
+ * @struct _tag_vschunk
+ * @brief A buffer queued for sending on a connection
+ */
+typedef struct _tag_vschunk {
+  struct _tag_vschunk *next;
+
+  vsbuf *buf;             /* the queued bytes; possibly shared */
+  unsigned int off;       /* number of bytes of buf already sent */
+} vschunk;
+
+/**
+ * @struct _tag_vsconn
+ * @brief A client connection with its buffered input and queued output
+ */
+typedef struct _tag_vsconn {
+  int fd;                 /* socket for this client */
+
+  vsbuf *in;              /* received bytes not yet processed; NULL when idle */
+
+  vschunk *out_head;      /* output waiting for the socket to become writable */
+  vschunk *out_tail;
+  unsigned int out_bytes; /* number of unsent bytes queued */
+
+  int paused;             /* set while the client isn't keeping up with output */
+  int closing;            /* set once the connection is to be dropped */
+
+  unsigned int watches;   /* number of patterns this client is watching */
+  atomic_int missed;      /* set by another worker when a notification to it was lost */
+  struct _tag_vsconn *unflushed; /* next watcher with notifications to send */
+  int flush_pending;      /* set while on its worker's list of those */
+
+  int connecting;         /* set while an outbound connect is in progress */
+  int upstream;           /* set on a replica's link to its primary */
+  int downstream;         /* set on a primary's link to one of its replicas */
+  unsigned long long repl_offset; /* next mutation log byte for a replica */
+  unsigned int repl_held; /* log bytes received inside an unfinished transaction */
+  unsigned int repl_generation; /* generation of the log a replica is following */
+  int repl_snapshot;      /* set while a replica is being sent the whole store */
+  char *repl_cursor;      /* last key of the store it has been sent, or NULL */
+
+  int local;              /* set for clients on the unix domain socket */
+  shmlink *shm;           /* set when requests travel through shared memory */
+  struct _tag_vsconn *link; /* pairs a shared memory channel with its socket */
+
+  struct _tag_vsworker *worker; /* event loop that owns the connection */
+  struct _tag_vstxn *txn;       /* writes staged since MULTI, or NULL */
+
+  int admitted;           /* set once counted against the connection cap */
+  struct _tag_vsclientip *ip; /* source address it's rate limited with */
+  double tokens;          /* requests it may make before being held */
+  unsigned long long refilled; /* when its tokens were last topped up */
+  unsigned long long held_until; /* while rate limited, when it may go on */
+  int backlog;            /* set when requests were left for the next pass */
+} vsconn;
+
+/**
+ * Creates the state for a newly accepted client
+ */
+vsconn* conn_create(int fd);
+
+/**
+ * Closes a client connection and releases its state
+ */
+int conn_destroy(vsconn **c);
+
+/**
+ * Receives whatever is available on the socket into the input buffer
+ * @returns The number of bytes received, 0 when the peer closed, otherwise -1
+ */
+int conn_read(vsconn *c);
+
+/**
+ * Discards processed bytes from the front of the input buffer
+ */
+void conn_consume(vsconn *c, unsigned int n);
+
+/**
+ * Writes a set of buffers to the client, in order. Whatever the socket
+ * takes immediately is sent straight from the caller's buffers; only the
+ * remainder is copied and queued for when the socket becomes writable
+ */
+int conn_writev(vsconn *c, struct iovec *iov, int iovcnt);
+
+/**
+ * Sends a message carrying open descriptors to a unix domain socket client.
+ * Only possible while no other output is queued
+ * @returns ERR_SUCCESS, ERR_PENDING while earlier output is still queued,
+ *          otherwise ERR_BADREQ when the connection can't carry descriptors
+ */
+int conn_send_fds(vsconn *c, const char *data, unsigned int len, int *fds, int nfds);
+
+/**
+ * Queues a reference to a buffer for sending, without copying it
+ */
+int conn_queue(vsconn *c, vsbuf *b);
+
+/**
+ * Sends as much queued output as the socket will take, first completing
+ * any outbound connect that was in progress
+ */
+int conn_flush(vsconn *c);
+
+/**
+ * Works out which poll events the connection is interested in
+ */
+short conn_events(vsconn *c);
+
+#endif /* __varsvr_conn_h_ */
@@ -1,40 +1,108 @@
-
 #include "./daemon.h"
 
 pid_t vs_daemon_pid;
-int vs_daemon_running;
-int vs_listener;
+atomic_int vs_daemon_running;
+atomic_int vs_daemon_signal;
+int vs_unix_listener = -1;
+char *vs_unix_path = NULL;
+int vs_unix_mode = 0600;
 
+/* defaults; see config.h for the settings that change them */
 int vs_port = 25052;
 int vs_backlog = 32;
 
 /* polling timeout is 3 minutes */
 int vs_poll_timeout = (3 * 60 * 1000);
 
-struct pollfd client_fds[200];
-int n_client_fds = 1;
+/**
+ * Initialize the unix domain socket listener
+ */
+int server_init_unix(const char *path, int backlog) {
+  int on = 1, rc;
+  mode_t mask;
+  struct sockaddr_un addr;
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    log_error("Unix socket path is too long: %s", path);
+    return ERR_SRINIT;
+  }
+
+  if ((vs_unix_listener = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+    log_error("Unable to create unix socket (errno=%d)", errno);
+    return ERR_SRINIT;
+  }
+
+  if (ioctl(vs_unix_listener, FIONBIO, (char *)&on) < 0) {
+    log_error("Unable to set unix socket non-blocking (errno=%d)", errno);
+    return ERR_SRINIT;
+  }
+
+  /* clear away a socket left behind by an earlier run */
+  unlink(path);
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  /* the socket is created accessible to nobody else, whatever the umask,
+   * and only then opened up as far as configured */
+  mask = umask(0177);
+  rc = bind(vs_unix_listener, (struct sockaddr *)&addr, sizeof(addr));
+  umask(mask);
+
+  if (rc < 0) {
+    log_error("Unable to bind unix socket %s (errno=%d)", path, errno);
+    return ERR_SRINIT;
+  }
+
+  if (chmod(path, vs_unix_mode) < 0) {
+    log_error("Unable to set the mode of unix socket %s (errno=%d)", path, errno);
+    return ERR_SRINIT;
+  }
+
+  if (listen(vs_unix_listener, backlog) < 0) {
+    log_error("Unable to listen on unix socket (errno=%d)", errno);
+    return ERR_SRINIT;
+  }
+
+  return ERR_SUCCESS;
+}
 
 /**
- * Initialize the network server
+ * Initialize a worker's TCP listener. With several workers every one of
+ * them listens on the port, and the kernel spreads connections over them
  */
-int server_init(int port, int backlog) {
+int server_init_listener(vsworker *w, int port, int backlog) {
   int rc = 0, on = 1;
   struct sockaddr_in6 addr;
 
   /* create an AF_INET6 stream socket as the main listener */
-  if ((vs_listener = socket(AF_INET6, SOCK_STREAM, 0)) < 0) {
+  if ((w->listener = socket(AF_INET6, SOCK_STREAM, 0)) < 0) {
     log_error("Unable to create main socket (errno=%d)", errno);
     return ERR_SRINIT;
   }
 
   /* allow the socket descriptor to be reusable */
-  if ((rc = setsockopt(vs_listener, SOL_SOCKET, SO_REUSEADDR, (char *)&on, sizeof(on))) < 0) {
+  if ((rc = setsockopt(w->listener, SOL_SOCKET, SO_REUSEADDR, (char *)&on, sizeof(on))) < 0) {
     log_error("Unable to setsockopt (errno=%d)", errno);
     return ERR_SRINIT;
   }
 
+  if (vs_n_worker_set > 1 &&
+      (rc = setsockopt(w->listener, SOL_SOCKET, SO_REUSEPORT, (char *)&on, sizeof(on))) < 0) {
+    log_error("Unable to share the port between workers (errno=%d)", errno);
+    return ERR_SRINIT;
+  }
+
+  /* a listener on the CPU that took a connection's packets is preferred
+   * for it */
+  if (w->cpu >= 0 &&
+      setsockopt(w->listener, SOL_SOCKET, SO_INCOMING_CPU, (char *)&w->cpu, sizeof(w->cpu)) < 0) {
+    log_warn("Unable to steer connections to cpu %d (errno=%d)", w->cpu, errno);
+  }
+
   /* set the socket to be non-blocking */
-  if ((rc = ioctl(vs_listener, FIONBIO, (char *)&on)) < 0) {
+  if ((rc = ioctl(w->listener, FIONBIO, (char *)&on)) < 0) {
     log_error("Unable to set non-blocking (errno=%d)", errno);
     return ERR_SRINIT;
   }
@@ -45,41 +113,202 @@ int server_init(int port, int backlog) {
   addr.sin6_family = AF_INET6;
   addr.sin6_port = htons(port);
 
-  if ((rc = bind(vs_listener, (struct sockaddr *)&addr, sizeof(addr))) < 0) {
+  if ((rc = bind(w->listener, (struct sockaddr *)&addr, sizeof(addr))) < 0) {
     log_error("Unable to bind socket (errno=%d)", errno);
     return ERR_SRINIT;
   }
   
   /* start listening */
-  if ((rc = listen(vs_listener, backlog)) < 0) {
+  if ((rc = listen(w->listener, backlog)) < 0) {
     log_error("Unable to listen (errno=%d)", errno);
     return ERR_SRINIT;
   }
 
-  /* initialize the client file descriptor structure */
-  memset(client_fds, 0, sizeof(client_fds));
-  client_fds[0].fd = vs_listener;
-  client_fds[0].events = POLLIN;
+  return ERR_SUCCESS;
+}
+
+/**
+ * Initialize the network server
+ */
+int server_init(int port, int backlog) {
+  int i, rc;
+
+  if ((rc = worker_init(vs_workers)) != ERR_SUCCESS) {
+    log_error("Unable to create %d workers", vs_workers);
+    return rc;
+  }
+
+  if ((rc = trace_init(vs_n_worker_set)) != ERR_SUCCESS ||
+      (rc = hotkey_init(vs_n_worker_set)) != ERR_SUCCESS) {
+    return rc;
+  }
+
+  for (i = 0; i < vs_n_worker_set; i ++) {
+    /* workers take the configured CPUs in turn */
+    if (vs_n_cpus > 0) {
+      vs_worker_set[i].cpu = vs_cpus[i % vs_n_cpus];
+      vs_worker_set[i].node = affinity_node(vs_worker_set[i].cpu);
+    }
+
+    if ((rc = server_init_listener(&vs_worker_set[i], port, backlog)) != ERR_SUCCESS) {
+      return rc;
+    }
+  }
+
+  /* co-located clients can also come in over a unix domain socket */
+  if (vs_unix_path && (rc = server_init_unix(vs_unix_path, backlog)) != ERR_SUCCESS) {
+    return rc;
+  }
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Sets up a worker's descriptor table. This runs on the worker's own
+ * thread once it has been placed, so the table is local to it
+ */
+int server_prepare(vsworker *w) {
+  int rc;
+
+  w->fds = (struct pollfd *)calloc(VS_MAX_CLIENTS, sizeof(struct pollfd));
+  w->conns = (vsconn **)calloc(VS_MAX_CLIENTS, sizeof(vsconn *));
+
+  if (w->fds == NULL || w->conns == NULL) {
+    return ERR_NOMEM;
+  }
+
+  if ((rc = poller_init(&w->poller, VS_MAX_CLIENTS)) != ERR_SUCCESS) {
+    log_error("Unable to setup the %s engine", vs_io_engine == POLLER_EPOLL ? "epoll" : "poll");
+    return rc;
+  }
+
+  /* the wake descriptor and the listeners lead the table */
+  w->n_fds = 0;
+  w->fds[w->n_fds].fd = w->wake_fd;
+  w->fds[w->n_fds ++].events = POLLIN;
+  w->fds[w->n_fds].fd = w->listener;
+  w->fds[w->n_fds ++].events = POLLIN;
+
+  if (w->id == 0 && vs_unix_listener >= 0) {
+    w->fds[w->n_fds].fd = vs_unix_listener;
+    w->fds[w->n_fds ++].events = POLLIN;
+  }
+
+  w->n_listeners = w->n_fds;
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Removes closed descriptors from the poll table
+ */
+void server_compress(vsworker *w) {
+  int i, j;
+
+  for (i = 0; i < w->n_fds; i ++) {
+    if (w->fds[i].fd == -1) {
+      for (j = i; j < w->n_fds - 1; j ++) {
+        w->fds[j] = w->fds[j + 1];
+        w->conns[j] = w->conns[j + 1];
+      }
+
+      i --;
+      w->n_fds --;
+    }
+  }
+}
+
+/**
+ * Adds a connection to the poll table
+ */
+int server_add_conn(vsworker *w, vsconn *c) {
+  if (w->n_fds >= VS_MAX_CLIENTS) {
+    return ERR_NOMEM;
+  }
+
+  c->worker = w;
+  w->conns[w->n_fds] = c;
+  w->fds[w->n_fds].fd = c->fd;
+  w->fds[w->n_fds].events = conn_events(c);
+  w->fds[w->n_fds].revents = 0;
+  w->n_fds ++;
 
   return ERR_SUCCESS;
 }
 
+/**
+ * Closes the client connection held in a poll slot. The slot is reclaimed
+ * when the descriptor table is next compressed
+ */
+void server_close_client(vsworker *w, int i) {
+  vsconn *c = w->conns[i];
+
+  /* no other worker can be passing it anything once it's out of the
+   * registry */
+  store_write_lock();
+
+  if (c->upstream) {
+    repl_upstream_lost();
+  }
+
+  pubsub_unwatch_all(c);
+  worker_purge(w, c);
+  store_unlock();
+
+  /* a shared memory channel goes when its socket does */
+  if (c->link) {
+    if (!c->shm) {
+      c->link->closing = 1;
+    }
+
+    c->link->link = NULL;
+  }
+
+  poller_forget(&w->poller, c->fd);
+  conn_destroy(&w->conns[i]);
+  w->fds[i].fd = -1;
+}
+
 /**
  * Tears down the server
  */
 int server_teardown() {
-  int i;
+  int i, j;
+  vsworker *w = NULL;
+
+  for (i = 0; i < vs_n_worker_set; i ++) {
+    w = &vs_worker_set[i];
 
-  /* close down any listening socket */
-  for (i = 0; i < n_client_fds; i ++) {
-    if (client_fds[i].fd >= 0) {
-      close(client_fds[i].fd);
+    /* close down any client connections */
+    for (j = w->n_listeners; w->conns && j < w->n_fds; j ++) {
+      if (w->conns[j]) {
+        server_close_client(w, j);
+      }
+    }
+
+    /* close the listener */
+    if (w->listener >= 0) {
+      close(w->listener);
+      w->listener = -1;
     }
+
+    poller_teardown(&w->poller);
+    free(w->fds);
+    free(w->conns);
+    w->fds = NULL;
+    w->conns = NULL;
+    w->n_fds = w->n_listeners = 0;
   }
 
-  /* close the listener */
-  close(vs_listener);
-  vs_listener = 0;
+  if (vs_unix_listener >= 0) {
+    close(vs_unix_listener);
+    unlink(vs_unix_path);
+    vs_unix_listener = -1;
+  }
+
+  worker_teardown();
+  trace_teardown();
+  hotkey_teardown();
 
   return ERR_SUCCESS;
 }
@@ -92,23 +321,28 @@ int server_teardown() {
  * The var server's signal handler 
  */
 void daemon_signal_handler(int sig) {
-  log_info("Server received signal %d", sig);
+  int saved = errno;
 
   switch (sig) {
     case SIGHUP:
+    case SIGINT:
     case SIGTERM:
+      /* logging isn't safe in here; it's left to the main thread */
+      vs_daemon_signal = sig;
       vs_daemon_running = 0;
+
+      /* the other workers may be asleep */
+      worker_wake_all();
       break;
   }
-}
 
+  errno = saved;
+}
 
 /**
- * Daemonizes this application so that it will run in the background
+ * Detaches from the terminal so that the process runs in the background
  */
-int daemon_init() {
-
-  vs_daemon_running = 0;
+int daemon_detach() {
 
   /* first fork */
   pid_t pid = fork();
@@ -150,8 +384,6 @@ int daemon_init() {
   signal(SIGTSTP, SIG_IGN);
   signal(SIGTTOU, SIG_IGN);
   signal(SIGTTIN, SIG_IGN);
-  signal(SIGHUP, daemon_signal_handler);
-  signal(SIGTERM, daemon_signal_handler);
   
   /* set the umask */
   umask(0);
@@ -176,6 +408,69 @@ int daemon_init() {
     return ERR_DMINIT;
   }
 
+  return ERR_SUCCESS;
+}
+
+/**
+ * Places the calling thread for a worker: pinned to its CPU, with its
+ * buffers drawn from the CPU's NUMA node
+ */
+int daemon_place(vsworker *w) {
+  worker_enter(w);
+
+  if (w->cpu < 0) {
+    return ERR_SUCCESS;
+  }
+
+  if (affinity_pin(w->cpu) != ERR_SUCCESS) {
+    return ERR_DMINIT;
+  }
+
+  vsbuf_pool_node(w->node);
+  log_info("Worker %d pinned to cpu %d (node %d)", w->id, w->cpu, w->node);
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Daemonizes this application so that it will run in the background
+ */
+int daemon_init() {
+
+  vs_daemon_running = 0;
+
+  if (!vs_foreground && daemon_detach() != ERR_SUCCESS) {
+    return ERR_DMINIT;
+  }
+
+  signal(SIGHUP, daemon_signal_handler);
+  signal(SIGINT, daemon_signal_handler);
+  signal(SIGTERM, daemon_signal_handler);
+
+  /* setup the variable store */
+  if (store_init() != ERR_SUCCESS) {
+    log_error("Failed to setup the variable store; terminating daemon");
+    return ERR_DMINIT;
+  }
+
+  /* setup admission control */
+  if (admit_init() != ERR_SUCCESS) {
+    log_error("Failed to setup admission control; terminating daemon");
+    return ERR_DMINIT;
+  }
+
+  /* setup the change notification registry */
+  if (pubsub_init() != ERR_SUCCESS) {
+    log_error("Failed to setup the watch registry; terminating daemon");
+    return ERR_DMINIT;
+  }
+
+  /* setup replication */
+  if (repl_init() != ERR_SUCCESS) {
+    log_error("Failed to setup replication; terminating daemon");
+    return ERR_DMINIT;
+  }
+
   /* setup the server now */
   if (server_init(vs_port, vs_backlog) != ERR_SUCCESS) {
     log_error("Failed to setup the server; terminating daemon");
@@ -193,31 +488,236 @@ int daemon_init() {
  */
 int daemon_teardown() {
   server_teardown();
-
-  log_info("Killing server pid %d", vs_daemon_pid);
-  kill(vs_daemon_pid, SIGTERM);
+  admit_teardown();
+  repl_teardown();
+  pubsub_teardown();
+  defrag_teardown();
+  store_teardown();
+  vsbuf_pool_teardown();
+
+  if (!vs_foreground) {
+    log_info("Killing server pid %d", vs_daemon_pid);
+    kill(vs_daemon_pid, SIGTERM);
+  }
 
   return ERR_SUCCESS;
 }
 
 /**
- * Runs the daemon process
+ * Acts on what other workers have left in a worker's mailbox
  */
-int daemon_run() {
-  int i, j, rc, current_size, client_sd;
-  int close_conn, len, compress_required = 0;
+void daemon_drain(vsworker *w) {
+  vsmail *m = NULL, *next = NULL;
+
+  for (m = worker_take(w); m; m = next) {
+    next = m->next;
+
+    if (m->buf) {
+      pubsub_deliver(m->conn, m->buf);
+      vsbuf_release(&m->buf);
+    } else if (server_add_conn(w, m->conn) != ERR_SUCCESS) {
+      log_warn("Refusing client connection; no room left");
+
+      if (m->conn->link) {
+        m->conn->link->link = NULL;
+      }
+
+      conn_destroy(&m->conn);
+    }
+
+    free(m);
+  }
+
+  pubsub_flush();
+}
+
+/**
+ * Turns a connection away because the server is at its connection cap
+ */
+void daemon_reject(int client_sd) {
+  static const char msg[] = "ERR too many connections\r\n";
+
+  send(client_sd, msg, sizeof(msg) - 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+  close(client_sd);
+}
+
+/**
+ * Accepts the connections waiting on a listener, up to a batch at a time;
+ * any left over are picked up in the next pass
+ */
+int daemon_accept(vsworker *w, int fd) {
+  int client_sd, on = 1, cpu, n = 0;
+  socklen_t len = sizeof(cpu), addr_len;
+  unsigned long long start;
+  struct sockaddr_storage addr;
+  vsconn *c = NULL;
+  vsworker *target = NULL;
+
+  /* accept the incoming connections now */
+  do {
+
+    start = trace_now();
+    addr_len = sizeof(addr);
+    client_sd = accept(fd, (struct sockaddr *)&addr, &addr_len);
+
+    if (client_sd < 0) {
+
+      if (errno != EWOULDBLOCK) {
+        log_error("Failed to accept socket (errno=%d)", errno);
+        return ERR_SRINIT;
+      }
+
+      break;
+    }
+
+    n ++;
+
+    /* turned away before anything is spent on it */
+    if (admit_accept() != ERR_SUCCESS) {
+      daemon_reject(client_sd);
+      continue;
+    }
+
+    /* clients are serviced without blocking the loop */
+    if (ioctl(client_sd, FIONBIO, (char *)&on) < 0) {
+      log_error("Unable to set client non-blocking (errno=%d)", errno);
+      admit_cancel();
+      close(client_sd);
+      continue;
+    }
+
+    if ((c = conn_create(client_sd)) == NULL) {
+      log_error("Unable to allocate client connection");
+      admit_cancel();
+      close(client_sd);
+      continue;
+    }
+
+    c->local = (fd == vs_unix_listener);
 
-  unsigned char buffer[1024];
+    if (admit_attach(c, (struct sockaddr *)&addr) != ERR_SUCCESS) {
+      log_error("Unable to allocate client address");
+      conn_destroy(&c);
+      continue;
+    }
 
-  log_info("Daemon is running");
+    /* a connection is best served on the CPU its packets arrive at, so
+     * one accepted elsewhere goes to the worker pinned there */
+    if (!c->local && w->cpu >= 0 &&
+        getsockopt(client_sd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) == 0 &&
+        (target = worker_for_cpu(cpu)) != NULL && target != w) {
+      if (worker_adopt(target, c) != ERR_SUCCESS) {
+        conn_destroy(&c);
+      }
+
+      continue;
+    }
+
+    if (server_add_conn(w, c) != ERR_SUCCESS) {
+      log_warn("Refusing client connection; no room left");
+      conn_destroy(&c);
+      continue;
+    }
+
+    trace_since(TRACE_ACCEPT, start);
+
+  } while (client_sd != -1 && n < ADMIT_ACCEPT_BATCH);
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Runs a worker's event loop
+ */
+int daemon_loop(vsworker *w) {
+  int i, k, rc, current_size, clients, replicas, timeout;
+  int close_conn, compress_required = 0;
+  unsigned long long start, now;
+  vsconn *c = NULL;
+
+  log_info("Worker %d is running", w->id);
 
   /* keep going until the daemon is signalled */
   while (vs_daemon_running) {
 
+    /* a replica keeps a link open to its primary */
+    if (w->id == 0 && (c = repl_connect()) != NULL && server_add_conn(w, c) != ERR_SUCCESS) {
+      repl_upstream_lost();
+      conn_destroy(&c);
+    }
+
+    /* bring in notifications and connections from other workers, and any
+     * newly opened shared memory channels */
+    daemon_drain(w);
+
+    /* the store is defragmented a little at a time, between passes */
+    if (w->id == 0) {
+      defrag_cron();
+    }
+
+    /* other clients' activity may have queued output on any connection;
+     * replicas are sent this pass's mutations in one batch, and watchers
+     * or replicas that fell too far behind are dropped */
+    replicas = 0;
+    timeout = w->id == 0 ? defrag_poll_timeout(repl_poll_timeout(vs_poll_timeout)) : vs_poll_timeout;
+    now = admit_now();
+
+    for (i = w->n_listeners; i < w->n_fds; i ++) {
+      c = w->conns[i];
+
+      /* a watcher another worker couldn't notify has missed a change */
+      if (atomic_load(&c->missed)) {
+        c->closing = 1;
+      }
+
+      /* requests held back by the budget or a rate limit go ahead of new
+       * input; a shared memory client's ring was left unread meanwhile */
+      if (!c->closing && admit_ready(c, now)) {
+        if (c->shm) {
+          c->backlog = 0;
+          c->closing = (conn_read(c) == 0);
+        }
+
+        if (!c->closing && proto_process(c) != ERR_SUCCESS) {
+          c->closing = 1;
+        }
+      }
+
+      timeout = admit_poll_timeout(c, now, timeout);
+
+      if (w->conns[i]->downstream) {
+        store_read_lock();
+        repl_pump(w->conns[i]);
+        store_unlock();
+        timeout = repl_conn_poll_timeout(w->conns[i], timeout);
+        replicas ++;
+      }
+
+      if (w->conns[i]->closing) {
+        server_close_client(w, i);
+        compress_required = 1;
+      } else {
+        w->fds[i].events = conn_events(w->conns[i]);
+      }
+    }
+
+    atomic_store(&w->replicas, replicas);
+
+    if (compress_required) {
+      server_compress(w);
+      compress_required = 0;
+    }
+
     log_debug("Polling");
 
     /* poll available sockets, or timeout */
-    if ((rc = poll(client_fds, n_client_fds, vs_poll_timeout)) < 0) {
+    rc = poller_wait(&w->poller, w->fds, w->n_fds, timeout);
+
+    if (rc < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+
       log_error("Failed to poll sockets (errno=%d)", errno);
       break;
     }
@@ -227,76 +727,83 @@ int daemon_run() {
       continue;
     }
 
-    current_size = n_client_fds;
-    for (i = 0; i < current_size; i ++) {
+    current_size = w->n_fds;
+    clients = current_size - w->n_listeners;
+    w->next_client = clients > 0 ? (w->next_client + 1) % clients : 0;
+
+    for (k = 0; k < current_size; k ++) {
+      /* ready clients are served in turn from a rotating start, so the
+       * same ones aren't always first */
+      i = k < w->n_listeners ? k : w->n_listeners + (k - w->n_listeners + w->next_client) % clients;
 
       /* process any descriptor that returns POLLIN */
-      if (client_fds[i].revents == 0) {
+      if (w->fds[i].revents == 0) {
         continue;
       }
 
-      /* not getting POLLIN is unexpected; so log and get out */
-      if (client_fds[i].revents != POLLIN) {
-        log_error("Unexpected value (revents=%d", client_fds[i].revents);
-        vs_daemon_running = 0;
-        break;
+      /* another worker wants attention; its mail is picked up next pass */
+      if (w->fds[i].fd == w->wake_fd) {
+        worker_clear(w);
+        continue;
       }
 
-      /* check if the listening socket is readable */
-      if (client_fds[i].fd == vs_listener) {
-
-        /* accept all of the incoming connections now */
-        do {
+      /* check if a listening socket is readable */
+      if (i < w->n_listeners) {
 
-          client_sd = accept(vs_listener, NULL, NULL);
+        /* not getting POLLIN on the listener is unexpected; so log and get out */
+        if (w->fds[i].revents != POLLIN) {
+          log_error("Unexpected value (revents=%d)", w->fds[i].revents);
+          vs_daemon_running = 0;
+          break;
+        }
 
-          if (client_sd < 0) {
+        if (daemon_accept(w, w->fds[i].fd) != ERR_SUCCESS) {
+          vs_daemon_running = 0;
+          break;
+        }
 
-            if (errno != EWOULDBLOCK) {
-              log_error("Failed to accept socket (errno=%d)", errno);
-              vs_daemon_running = 0;
-            }
+      } else {
+        c = w->conns[i];
+        close_conn = 0;
 
-            break;
-          }
+        if (w->fds[i].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+          close_conn = 1;
+        }
 
-          client_fds[n_client_fds].fd = client_sd;
-          client_fds[n_client_fds].events = POLLIN;
-          n_client_fds ++;
+        /* answer a shared memory doorbell before looking at the rings, so
+         * that a ring arriving while they're serviced isn't lost */
+        if (c->shm && (w->fds[i].revents & POLLIN)) {
+          shmlink_clear(c->shm);
+        }
 
-        } while (client_sd != -1);
+        /* continue any output the socket couldn't take earlier; a shared
+         * memory doorbell may also mean the client has freed reply space */
+        if (!close_conn && ((w->fds[i].revents & POLLOUT) ||
+                            (c->shm && (w->fds[i].revents & POLLIN)))) {
+          close_conn = (conn_flush(c) != ERR_SUCCESS);
+        }
 
-      } else {
-        close_conn = 1;
+        /* receive the incoming data */
+        if (!close_conn && (w->fds[i].revents & POLLIN)) {
+          start = trace_now();
 
-        /* receive all of the incoming data on client connections */
-        if ((rc = recv(client_fds[i].fd, buffer, sizeof(buffer), 0)) < 0) {
-          
-          if (errno != EWOULDBLOCK) {
-            log_error("Failed to receive from socket (errno=%d)", errno);
+          if ((rc = conn_read(c)) < 0) {
+            close_conn = (errno != EWOULDBLOCK);
+          } else if (rc == 0) {
             close_conn = 1;
+          } else {
+            trace_since(TRACE_READ, start);
           }
-
-          break;
         }
 
-        /* check if the connection has already been closed */
-        if (rc == 0) {
+        /* process any complete requests; this also picks up requests left
+         * waiting while the client was paused */
+        if (!close_conn && proto_process(c) != ERR_SUCCESS) {
           close_conn = 1;
-          break;
         }
 
-        /* data was received */
-        len = rc;
-
-        if ((rc = send(client_fds[i].fd, buffer, len, 0)) < 0) {
-          close_conn = 1;
-          break;
-        }
-
-        if (close_conn) {
-          close(client_fds[i].fd);
-          client_fds[i].fd = -1;
+        if (close_conn || c->closing) {
+          server_close_client(w, i);
           compress_required = 1;
         }
 
@@ -305,20 +812,77 @@ int daemon_run() {
     }
 
     if (compress_required) {
+      server_compress(w);
       compress_required = 0;
+    }
 
-      for (i = 0; i < n_client_fds; i ++) {
-        if (client_fds[i].fd == -1) {
-          for (j = i; j < n_client_fds; j ++) {
-            client_fds[j].fd = client_fds[j + 1].fd;
-          }
+  }
 
-          i --;
-          n_client_fds --;
-        }
-      }
+  /* whichever worker stops first stops the rest */
+  vs_daemon_running = 0;
+  worker_wake_all();
+
+  log_info("Worker %d is stopping", w->id);
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Entry point of the threads running workers after the first
+ */
+void* daemon_worker(void *arg) {
+  vsworker *w = (vsworker *)arg;
+
+  if (daemon_place(w) == ERR_SUCCESS && server_prepare(w) == ERR_SUCCESS) {
+    daemon_loop(w);
+  } else {
+    log_error("Worker %d failed to start; terminating daemon", w->id);
+    vs_daemon_running = 0;
+    worker_wake_all();
+  }
+
+  vsbuf_pool_teardown();
+
+  return NULL;
+}
+
+/**
+ * Runs the daemon process
+ */
+int daemon_run() {
+  int i, started = 1;
+  sigset_t all, old;
+
+  log_info("Daemon is running on port %d with %d workers", vs_port, vs_n_worker_set);
+
+  /* signals are left to the main thread, which runs the first worker */
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &old);
+
+  for (i = 1; i < vs_n_worker_set; i ++, started ++) {
+    if (pthread_create(&vs_worker_set[i].thread, NULL, daemon_worker, &vs_worker_set[i]) != 0) {
+      log_error("Unable to start worker %d (errno=%d)", i, errno);
+      vs_daemon_running = 0;
+      break;
     }
+  }
+
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+  if (vs_daemon_running && daemon_place(&vs_worker_set[0]) == ERR_SUCCESS &&
+      server_prepare(&vs_worker_set[0]) == ERR_SUCCESS) {
+    daemon_loop(&vs_worker_set[0]);
+  }
+
+  vs_daemon_running = 0;
+  worker_wake_all();
+
+  if (vs_daemon_signal) {
+    log_info("Server received signal %d", (int)vs_daemon_signal);
+  }
 
+  for (i = 1; i < started; i ++) {
+    pthread_join(vs_worker_set[i].thread, NULL);
   }
 
   log_info("Daemon is stopping");
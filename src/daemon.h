@@ -2,24 +2,57 @@
 
 #define __varsvr_daemon_h_
 
+/* CPU affinity */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <errno.h>
 #include <stdlib.h>
 #include <signal.h>
 #include <string.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/poll.h>
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <sys/un.h>
 #include <netinet/in.h>
 
 #include "./log.h"
 #include "./errors.h"
+#include "./conn.h"
+#include "./proto.h"
+#include "./store.h"
+#include "./pubsub.h"
+#include "./repl.h"
+#include "./shm.h"
+#include "./config.h"
+#include "./poller.h"
+#include "./worker.h"
+#include "./admit.h"
+#include "./affinity.h"
+#include "./trace.h"
+#include "./defrag.h"
+
+/* maximum number of polled descriptors per worker, including the
+ * listeners and its wake descriptor */
+#define VS_MAX_CLIENTS 200
+
+extern int vs_port;
+extern int vs_backlog;
+extern int vs_poll_timeout;
+extern char *vs_unix_path;
+extern int vs_unix_mode;
 
 /**
- * Daemonizes this application so that it will run in the background
+ * Daemonizes this application so that it will run in the background, unless
+ * it was configured to stay in the foreground
  */
 int daemon_init();
 
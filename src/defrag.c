@@ -0,0 +1,215 @@
+#include "./defrag.h"
+
+/* set to defragment; the ratio, as a percentage over 100, at which a pass
+ * starts; the longest a step runs, in microseconds; and the least waste
+ * worth a pass */
+int vs_defrag = 0;
+int vs_defrag_threshold = 10;
+int vs_defrag_step = 1000;
+unsigned long long vs_defrag_min_waste = 16 * 1024 * 1024;
+
+/* objects moved; changed and read under the store lock */
+unsigned long long vs_defrag_moved = 0;
+
+/* the first worker's progress through a pass */
+int vs_defrag_active = 0;
+char *vs_defrag_cursor = NULL;
+unsigned long long vs_defrag_next = 0;
+unsigned long long vs_defrag_backoff = DEFRAG_CHECK_MS;
+unsigned long long vs_defrag_pass_moved = 0;
+
+/**
+ * Forgets any pass in progress
+ */
+int defrag_teardown() {
+  free(vs_defrag_cursor);
+  vs_defrag_cursor = NULL;
+  vs_defrag_active = 0;
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Reads the clock defragmentation is paced by, in nanoseconds
+ */
+unsigned long long defrag_now() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Reads the size of the resident set
+ */
+unsigned long long defrag_rss() {
+  unsigned long long pages = 0;
+  FILE *f = fopen("/proc/self/statm", "r");
+
+  if (f == NULL) {
+    return 0;
+  }
+
+  if (fscanf(f, "%*s %llu", &pages) != 1) {
+    pages = 0;
+  }
+
+  fclose(f);
+
+  return pages * (unsigned long long)sysconf(_SC_PAGESIZE);
+}
+
+/**
+ * Works out the fragmentation ratio
+ */
+double defrag_ratio(unsigned long long *waste) {
+  struct mallinfo2 mi = mallinfo2();
+  unsigned long long rss = defrag_rss(), used, reserved, unused;
+
+  /* slabs are mapped apart from the heap, so the allocator doesn't see them */
+  slab_stats(&reserved, &unused);
+  used = mi.uordblks + mi.hblkhd + reserved - unused;
+
+  if (waste) {
+    *waste = rss > used ? rss - used : 0;
+  }
+
+  return used ? (double)rss / used : 1.0;
+}
+
+/**
+ * Moves a node of the store's index, and the value it holds, to where
+ * they sit more densely
+ * @returns 0 to keep going, otherwise 1 once the step's time is up
+ */
+int defrag_node(bintree_node **link, void *arg) {
+  vsdefragstep *st = (vsdefragstep *)arg;
+  bintree_node *n = *link, *m = NULL;
+  vsval *v = (vsval *)n->data, *nv = NULL;
+  size_t size = bintree_node_size(n->len);
+  void *d = NULL;
+
+  if (slab_movable(n, size) && (m = (bintree_node *)slab_alloc(size)) != NULL) {
+    memcpy(m, n, size);
+    *link = m;
+    slab_free(n);
+    n = m;
+    vs_defrag_moved ++;
+  }
+
+  if (slab_movable(v, sizeof(vsval)) && (nv = (vsval *)slab_alloc(sizeof(vsval))) != NULL) {
+    *nv = *v;
+    n->data = nv;
+    slab_free(v);
+    v = nv;
+    vs_defrag_moved ++;
+  }
+
+  if (slab_movable(v->data, v->length) && (d = slab_alloc(v->length)) != NULL) {
+    memcpy(d, v->data, v->length);
+    slab_free(v->data);
+    v->data = d;
+    vs_defrag_moved ++;
+  }
+
+  st->last = n->key;
+
+  return ++ st->visited % DEFRAG_BATCH == 0 && defrag_now() >= st->deadline;
+}
+
+/**
+ * Runs a step of the pass in progress, the caller holding the store lock
+ * exclusively
+ * @returns 1 once the pass has walked the whole index, otherwise 0
+ */
+int defrag_step(unsigned long long deadline) {
+  char *cursor = NULL;
+  vsdefragstep st;
+
+  memset(&st, 0, sizeof(st));
+  st.deadline = deadline;
+
+  if (store_walk_links(vs_defrag_cursor, defrag_node, &st) == 0) {
+    free(vs_defrag_cursor);
+    vs_defrag_cursor = NULL;
+    return 1;
+  }
+
+  /* should the cursor not be copied, the next step starts over */
+  cursor = strdup(st.last);
+  free(vs_defrag_cursor);
+  vs_defrag_cursor = cursor;
+
+  return 0;
+}
+
+/**
+ * Runs a step of defragmentation when one is due
+ */
+void defrag_cron() {
+  int done;
+  double ratio;
+  unsigned long long now, waste, moved;
+
+  if (!vs_defrag || (now = defrag_now()) < vs_defrag_next) {
+    return;
+  }
+
+  if (!vs_defrag_active) {
+    vs_defrag_next = now + vs_defrag_backoff * 1000000ULL;
+
+    store_read_lock();
+    ratio = defrag_ratio(&waste);
+    moved = vs_defrag_moved;
+    store_unlock();
+
+    if (ratio * 100 < 100 + vs_defrag_threshold || waste < vs_defrag_min_waste) {
+      return;
+    }
+
+    log_info("Defragmenting; fragmentation ratio %.2f, %llu bytes wasted", ratio, waste);
+    vs_defrag_active = 1;
+    vs_defrag_pass_moved = moved;
+  }
+
+  store_write_lock();
+  done = defrag_step(now + (unsigned long long)vs_defrag_step * 1000);
+  moved = vs_defrag_moved - vs_defrag_pass_moved;
+  store_unlock();
+
+  vs_defrag_next = defrag_now() + DEFRAG_INTERVAL_MS * 1000000ULL;
+
+  if (!done) {
+    return;
+  }
+
+  /* holes the pass opened up go back to the system, and a pass that found
+   * nothing to move puts the next check off for longer */
+  malloc_trim(0);
+  vs_defrag_active = 0;
+  vs_defrag_backoff = moved ? DEFRAG_CHECK_MS : vs_defrag_backoff * 2;
+
+  if (vs_defrag_backoff > DEFRAG_BACKOFF_MS) {
+    vs_defrag_backoff = DEFRAG_BACKOFF_MS;
+  }
+
+  vs_defrag_next = defrag_now() + vs_defrag_backoff * 1000000ULL;
+  log_info("Defragmentation pass moved %llu objects", moved);
+}
+
+/**
+ * Works out how long the first worker's event loop may sleep
+ */
+int defrag_poll_timeout(int timeout) {
+  unsigned long long now, ms;
+
+  if (!vs_defrag) {
+    return timeout;
+  }
+
+  now = defrag_now();
+  ms = vs_defrag_next > now ? (vs_defrag_next - now + 999999) / 1000000 : 0;
+
+  return (timeout < 0 || ms < (unsigned long long)timeout) ? (int)ms : timeout;
+}
@@ -0,0 +1,81 @@
+#ifndef __varsvr_defrag_h_
+
+#define __varsvr_defrag_h_
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <malloc.h>
+#include <unistd.h>
+
+#include "./store.h"
+#include "./slab.h"
+#include "./log.h"
+#include "./errors.h"
+
+/*
+ * Incremental defragmentation. Churn through SET and DEL leaves the heap
+ * full of holes, so the process holds far more memory than the data it
+ * keeps. The fragmentation ratio is the resident set over the bytes in
+ * use: allocated from the heap, less what is free in slabs.
+ *
+ * The first worker checks the ratio every DEFRAG_CHECK_MS. Once it passes
+ * the threshold, and the waste is worth the effort, the worker walks the
+ * store's index in key order, a step every DEFRAG_INTERVAL_MS, moving
+ * index nodes, value containers and short values that sit on the heap or
+ * in sparse slabs into the densest slabs (see slab.h). A step holds the
+ * store's write lock for no longer than the step time, and the next one
+ * picks up after the last key visited. Once the whole index has been
+ * walked, heap pages left free are handed back to the system.
+ */
+
+#define DEFRAG_CHECK_MS     1000
+#define DEFRAG_INTERVAL_MS  10
+
+/* longest the check interval grows to after passes that move nothing */
+#define DEFRAG_BACKOFF_MS   (60 * 1000)
+
+/* nodes visited between readings of the clock */
+#define DEFRAG_BATCH        32
+
+/**
+ * @struct _tag_vsdefragstep
+ * @brief A step of a defragmentation pass, bounded in time
+ */
+typedef struct _tag_vsdefragstep {
+  unsigned long long deadline;
+  unsigned int visited;
+  const char *last;       /* key of the last node visited */
+} vsdefragstep;
+
+extern int vs_defrag;
+extern int vs_defrag_threshold;
+extern int vs_defrag_step;
+extern unsigned long long vs_defrag_min_waste;
+extern unsigned long long vs_defrag_moved;
+
+/**
+ * Forgets any pass in progress
+ */
+int defrag_teardown();
+
+/**
+ * Works out the fragmentation ratio; the caller holds the store lock
+ * @param waste Receives the resident bytes beyond those in use; may be NULL
+ */
+double defrag_ratio(unsigned long long *waste);
+
+/**
+ * Runs a step of defragmentation when one is due; called by the first
+ * worker on each pass of its event loop
+ */
+void defrag_cron();
+
+/**
+ * Works out how long the first worker's event loop may sleep without
+ * holding up defragmentation
+ */
+int defrag_poll_timeout(int timeout);
+
+#endif /* __varsvr_defrag_h_ */
@@ -5,7 +5,14 @@
 #define ERR_SUCCESS     0x0000
 #define ERR_INVTYPE     0x0001
 #define ERR_INVPTR      0x0002
+#define ERR_NOMEM       0x0003
+#define ERR_NOTFOUND    0x0004
+#define ERR_FULL        0x0005
+#define ERR_CONFLICT    0x0006
 #define ERR_DMINIT      0x0010
 #define ERR_SRINIT      0x0011
+#define ERR_BADREQ      0x0020
+#define ERR_CONNIO      0x0021
+#define ERR_PENDING     0x0022
 
 #endif /* __varsvr_errors_h_ */
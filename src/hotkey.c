@@ -0,0 +1,315 @@
+#include "./hotkey.h"
+
+/* set when hot keys' replies are cached by each worker */
+int vs_hot_cache = 0;
+
+vshotkeys *vs_hotkeys = NULL;
+int vs_n_hotkeys = 0;
+
+atomic_ullong vs_hot_gen[HOTKEY_GENERATIONS];
+
+/**
+ * Creates the read counts for a number of workers
+ */
+int hotkey_init(int workers) {
+  int i;
+
+  if ((vs_hotkeys = (vshotkeys *)calloc(workers, sizeof(vshotkeys))) == NULL) {
+    return ERR_NOMEM;
+  }
+
+  for (i = 0; i < workers; i ++) {
+    pthread_mutex_init(&vs_hotkeys[i].lock, NULL);
+  }
+
+  for (i = 0; i < HOTKEY_GENERATIONS; i ++) {
+    atomic_init(&vs_hot_gen[i], 0);
+  }
+
+  vs_n_hotkeys = workers;
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Releases the read counts and every cached reply
+ */
+int hotkey_teardown() {
+  int i, j;
+
+  for (i = 0; i < vs_n_hotkeys; i ++) {
+    for (j = 0; j < HOTKEY_TOP; j ++) {
+      free(vs_hotkeys[i].top[j].key);
+
+      if (vs_hotkeys[i].top[j].reply) {
+        vsbuf_release(&vs_hotkeys[i].top[j].reply);
+      }
+    }
+
+    pthread_mutex_destroy(&vs_hotkeys[i].lock);
+  }
+
+  free(vs_hotkeys);
+  vs_hotkeys = NULL;
+  vs_n_hotkeys = 0;
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Hashes a key (64 bit FNV-1a)
+ */
+unsigned long long hotkey_hash(const char *key) {
+  unsigned long long h = 14695981039346656037ULL;
+
+  while (*key) {
+    h = (h ^ (unsigned char)*key ++) * 1099511628211ULL;
+  }
+
+  return h;
+}
+
+/**
+ * Finds the calling worker's read counts
+ */
+vshotkeys* hotkey_self() {
+  vsworker *w = worker_self();
+
+  if (vs_hotkeys == NULL) {
+    return NULL;
+  }
+
+  return &vs_hotkeys[w ? w->id : 0];
+}
+
+/**
+ * Halves every count, so that keys that have cooled drop out
+ */
+void hotkey_decay(vshotkeys *hk) {
+  int d, i;
+
+  for (d = 0; d < HOTKEY_DEPTH; d ++) {
+    for (i = 0; i < HOTKEY_WIDTH; i ++) {
+      hk->sketch[d][i] >>= 1;
+    }
+  }
+
+  for (i = 0; i < HOTKEY_TOP; i ++) {
+    atomic_store_explicit(&hk->top[i].count,
+                          atomic_load_explicit(&hk->top[i].count, memory_order_relaxed) >> 1,
+                          memory_order_relaxed);
+  }
+
+  hk->reads = 0;
+}
+
+/**
+ * Counts a read of a key by the calling worker
+ */
+vshotentry* hotkey_record(const char *key, unsigned long long hash) {
+  int d, i, coldest = 0;
+  unsigned int est = ~0u, n;
+  unsigned long long h2 = (hash >> 32) | 1;
+  vshotkeys *hk = hotkey_self();
+  vshotentry *e = NULL;
+
+  if (hk == NULL) {
+    return NULL;
+  }
+
+  /* the estimate is the least of the key's counters, one per row */
+  for (d = 0; d < HOTKEY_DEPTH; d ++) {
+    n = ++ hk->sketch[d][(hash + d * h2) % HOTKEY_WIDTH];
+    est = n < est ? n : est;
+  }
+
+  if (++ hk->reads >= HOTKEY_DECAY) {
+    hotkey_decay(hk);
+    est >>= 1;
+  }
+
+  for (i = 0; i < HOTKEY_TOP; i ++) {
+    e = &hk->top[i];
+
+    if (e->key && e->hash == hash && strcmp(e->key, key) == 0) {
+      atomic_store_explicit(&e->count, est, memory_order_relaxed);
+      return est >= HOTKEY_MIN_COUNT ? e : NULL;
+    }
+
+    if (atomic_load_explicit(&e->count, memory_order_relaxed) <
+        atomic_load_explicit(&hk->top[coldest].count, memory_order_relaxed)) {
+      coldest = i;
+    }
+  }
+
+  /* a key that outranks the coldest tracked key takes its place */
+  e = &hk->top[coldest];
+
+  if (e->key && est <= atomic_load_explicit(&e->count, memory_order_relaxed)) {
+    return NULL;
+  }
+
+  pthread_mutex_lock(&hk->lock);
+  free(e->key);
+
+  if ((e->key = strdup(key)) != NULL) {
+    e->hash = hash;
+    atomic_store_explicit(&e->count, est, memory_order_relaxed);
+  } else {
+    atomic_store_explicit(&e->count, 0, memory_order_relaxed);
+  }
+
+  pthread_mutex_unlock(&hk->lock);
+
+  if (e->reply) {
+    vsbuf_release(&e->reply);
+  }
+
+  return (e->key && est >= HOTKEY_MIN_COUNT) ? e : NULL;
+}
+
+/**
+ * Finds the calling worker's cached reply for a key while it is current
+ */
+vsbuf* hotkey_cached(vshotentry *e) {
+  vshotkeys *hk = hotkey_self();
+
+  if (e->reply &&
+      atomic_load_explicit(&vs_hot_gen[e->hash % HOTKEY_GENERATIONS], memory_order_acquire) == e->gen) {
+    atomic_store_explicit(&hk->hits, atomic_load_explicit(&hk->hits, memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+    return e->reply;
+  }
+
+  atomic_store_explicit(&hk->misses, atomic_load_explicit(&hk->misses, memory_order_relaxed) + 1,
+                        memory_order_relaxed);
+
+  return NULL;
+}
+
+/**
+ * Caches the encoded reply for a hot key
+ */
+void hotkey_fill(vshotentry *e, vsbuf *reply) {
+  if (e->reply) {
+    vsbuf_release(&e->reply);
+  }
+
+  e->gen = atomic_load_explicit(&vs_hot_gen[e->hash % HOTKEY_GENERATIONS], memory_order_acquire);
+  e->reply = vsbuf_ref(reply);
+}
+
+/**
+ * Invalidates cached replies for a key that has changed
+ */
+void hotkey_changed(const char *key) {
+  if (vs_hot_cache) {
+    atomic_fetch_add_explicit(&vs_hot_gen[hotkey_hash(key) % HOTKEY_GENERATIONS], 1,
+                              memory_order_release);
+  }
+}
+
+/**
+ * Invalidates every cached reply
+ */
+void hotkey_changed_all() {
+  int i;
+
+  for (i = 0; vs_hot_cache && i < HOTKEY_GENERATIONS; i ++) {
+    atomic_fetch_add_explicit(&vs_hot_gen[i], 1, memory_order_release);
+  }
+}
+
+/**
+ * Totals the cache hits and misses of every worker
+ */
+void hotkey_stats(unsigned long long *hits, unsigned long long *misses) {
+  int i;
+
+  *hits = *misses = 0;
+
+  for (i = 0; i < vs_n_hotkeys; i ++) {
+    *hits += atomic_load_explicit(&vs_hotkeys[i].hits, memory_order_relaxed);
+    *misses += atomic_load_explicit(&vs_hotkeys[i].misses, memory_order_relaxed);
+  }
+}
+
+/**
+ * @struct _tag_vshotsum
+ * @brief A key's reads summed across workers, for reporting
+ */
+typedef struct _tag_vshotsum {
+  char *key;
+  unsigned long long count;
+} vshotsum;
+
+/**
+ * Orders keys hottest first
+ */
+int hotkey_compare(const void *a, const void *b) {
+  const vshotsum *x = (const vshotsum *)a, *y = (const vshotsum *)b;
+
+  return x->count < y->count ? 1 : (x->count > y->count ? -1 : strcmp(x->key, y->key));
+}
+
+/**
+ * Describes the hottest keys across every worker
+ */
+char* hotkey_report(int count) {
+  int i, j, k, n = 0;
+  unsigned int c;
+  size_t len = 0, cap = 32;
+  char *text = NULL;
+  vshotsum *sums = (vshotsum *)calloc(vs_n_hotkeys * HOTKEY_TOP + 1, sizeof(vshotsum));
+
+  if (sums == NULL) {
+    return NULL;
+  }
+
+  /* a key hot on several workers is counted once, with their reads summed */
+  for (i = 0; i < vs_n_hotkeys; i ++) {
+    pthread_mutex_lock(&vs_hotkeys[i].lock);
+
+    for (j = 0; j < HOTKEY_TOP; j ++) {
+      c = atomic_load_explicit(&vs_hotkeys[i].top[j].count, memory_order_relaxed);
+
+      if (vs_hotkeys[i].top[j].key == NULL || c == 0) {
+        continue;
+      }
+
+      for (k = 0; k < n && strcmp(sums[k].key, vs_hotkeys[i].top[j].key) != 0; k ++);
+
+      if (k == n && (sums[n ++].key = strdup(vs_hotkeys[i].top[j].key)) == NULL) {
+        n --;
+        continue;
+      }
+
+      sums[k].count += c;
+    }
+
+    pthread_mutex_unlock(&vs_hotkeys[i].lock);
+  }
+
+  qsort(sums, n, sizeof(vshotsum), hotkey_compare);
+  n = (count >= 0 && count < n) ? count : n;
+
+  for (i = 0; i < n; i ++) {
+    cap += strlen(sums[i].key) + 24;
+  }
+
+  if ((text = (char *)malloc(cap)) != NULL) {
+    len = snprintf(text, cap, "HOTKEYS %d\r\n", n);
+
+    for (i = 0; i < n; i ++) {
+      len += snprintf(text + len, cap - len, "%s %llu\r\n", sums[i].key, sums[i].count);
+    }
+  }
+
+  for (i = 0; i < vs_n_hotkeys * HOTKEY_TOP; i ++) {
+    free(sums[i].key);
+  }
+
+  free(sums);
+
+  return text;
+}
@@ -0,0 +1,137 @@
+#ifndef __varsvr_hotkey_h_
+
+#define __varsvr_hotkey_h_
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "./vsbuf.h"
+#include "./worker.h"
+#include "./errors.h"
+
+/*
+ * Hot key detection and caching. Each worker counts the keys it reads in
+ * a count-min sketch and keeps the keys with the highest estimates in a
+ * small top-K table; every HOTKEY_DECAY reads all counts are halved, so
+ * the table follows what is hot now rather than what ever was.
+ *
+ * With the hot key cache enabled, a worker also keeps its own copy of the
+ * encoded GET reply for each of its hot keys, so that reads of them are
+ * answered without touching the store or its lock. Writes invalidate the
+ * copies through a table of generation counters indexed by key hash: every
+ * change to a key bumps its counter, and a copy is only served while the
+ * counter still holds the value it had when the copy was made. Counters
+ * are bumped under the store's write lock and copies are made under its
+ * read lock, so a copy can never outlive a write it didn't see.
+ *
+ *   HOTKEYS [<n>]         HOTKEYS <count>\r\n, then hottest first
+ *                         <key> <estimated reads>\r\n
+ */
+
+/* count-min sketch dimensions */
+#define HOTKEY_DEPTH        4
+#define HOTKEY_WIDTH        2048
+
+/* keys tracked per worker, and the estimate at which one counts as hot */
+#define HOTKEY_TOP          16
+#define HOTKEY_MIN_COUNT    64
+
+/* reads after which every count is halved */
+#define HOTKEY_DECAY        (1 << 16)
+
+/* largest value whose reply is cached */
+#define HOTKEY_MAX_VALUE    (64 * 1024)
+
+/* generation counters shared by every worker */
+#define HOTKEY_GENERATIONS  4096
+
+/**
+ * @struct _tag_vshotentry
+ * @brief A key in a worker's top-K table, with its cached reply
+ */
+typedef struct _tag_vshotentry {
+  unsigned long long hash;
+  char *key;              /* NULL for an unused entry */
+  atomic_uint count;      /* estimated reads; read by other threads */
+
+  vsbuf *reply;           /* encoded GET reply, or NULL */
+  unsigned long long gen; /* generation of the key when reply was made */
+} vshotentry;
+
+/**
+ * @struct _tag_vshotkeys
+ * @brief A worker's read counts and hot key cache
+ */
+typedef struct _tag_vshotkeys {
+  unsigned int sketch[HOTKEY_DEPTH][HOTKEY_WIDTH];
+  unsigned int reads;     /* reads since the counts were last halved */
+
+  pthread_mutex_t lock;   /* guards the keys of the table against readers */
+  vshotentry top[HOTKEY_TOP];
+
+  atomic_ullong hits;
+  atomic_ullong misses;
+} vshotkeys;
+
+extern int vs_hot_cache;
+
+/**
+ * Creates the read counts for a number of workers
+ */
+int hotkey_init(int workers);
+
+/**
+ * Releases the read counts and every cached reply
+ */
+int hotkey_teardown();
+
+/**
+ * Hashes a key
+ */
+unsigned long long hotkey_hash(const char *key);
+
+/**
+ * Counts a read of a key by the calling worker
+ * @returns The key's top-K entry when it is hot, otherwise NULL
+ */
+vshotentry* hotkey_record(const char *key, unsigned long long hash);
+
+/**
+ * Finds the calling worker's cached reply for a key while it is current
+ * @returns The reply, otherwise NULL
+ */
+vsbuf* hotkey_cached(vshotentry *e);
+
+/**
+ * Caches the encoded reply for a hot key, the caller holding the store
+ * lock; the entry takes a reference to the buffer
+ */
+void hotkey_fill(vshotentry *e, vsbuf *reply);
+
+/**
+ * Invalidates cached replies for a key that has changed; the caller holds
+ * the store lock exclusively
+ */
+void hotkey_changed(const char *key);
+
+/**
+ * Invalidates every cached reply, as when the store is emptied
+ */
+void hotkey_changed_all();
+
+/**
+ * Totals the cache hits and misses of every worker
+ */
+void hotkey_stats(unsigned long long *hits, unsigned long long *misses);
+
+/**
+ * Describes the hottest keys across every worker in the HOTKEYS reply
+ * format
+ * @returns The text, to be released with free, otherwise NULL
+ */
+char* hotkey_report(int count);
+
+#endif /* __varsvr_hotkey_h_ */
@@ -6,8 +6,13 @@ const char *log_identity = "varsrv";
 /**
  * Starts the logging system up
  */
-void log_init(void) {
-  openlog(log_identity, LOG_NOWAIT, LOG_USER);
+void log_init(int to_stderr) {
+  openlog(log_identity, LOG_NOWAIT | (to_stderr ? LOG_PERROR : 0), LOG_USER);
+
+  /* keep a terminal readable; the event loop logs debug on every pass */
+  if (to_stderr) {
+    setlogmask(LOG_UPTO(LOG_INFO));
+  }
 }
 
 /**
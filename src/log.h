@@ -12,8 +12,9 @@
 
 /**
  * Starts the logging system up
+ * @param to_stderr Non-zero to also copy messages to stderr
  */
-void log_init(void);
+void log_init(int to_stderr);
 
 /**
  * Closes down the logging system
@@ -0,0 +1,181 @@
+#include "./poller.h"
+
+int vs_io_engine = POLLER_POLL;
+
+/**
+ * Looks up an engine by name
+ */
+int poller_engine(const char *name) {
+  if (strcmp(name, "poll") == 0) {
+    return POLLER_POLL;
+  } else if (strcmp(name, "epoll") == 0) {
+    return POLLER_EPOLL;
+  }
+
+  return -1;
+}
+
+/**
+ * Prepares the configured engine for a table of at most size slots
+ */
+int poller_init(vspoller *p, int size) {
+  memset(p, 0, sizeof(vspoller));
+  p->epoll_fd = -1;
+
+  if (vs_io_engine != POLLER_EPOLL) {
+    return ERR_SUCCESS;
+  }
+
+  if ((p->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+    log_error("Unable to create epoll set (errno=%d)", errno);
+    return ERR_SRINIT;
+  }
+
+  if ((p->ready = (struct epoll_event *)malloc(sizeof(struct epoll_event) * size)) == NULL) {
+    return ERR_NOMEM;
+  }
+
+  p->size = size;
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Releases the engine
+ */
+int poller_teardown(vspoller *p) {
+  if (p->epoll_fd >= 0) {
+    close(p->epoll_fd);
+    p->epoll_fd = -1;
+  }
+
+  free(p->regs);
+  free(p->ready);
+  p->regs = NULL;
+  p->ready = NULL;
+  p->n_regs = p->size = 0;
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Finds the registration record for a descriptor, making room for it
+ */
+pollreg* poller_reg(vspoller *p, int fd) {
+  int n = p->n_regs ? p->n_regs : 64;
+  pollreg *grown = NULL;
+
+  if (fd < p->n_regs) {
+    return &p->regs[fd];
+  }
+
+  while (n <= fd) {
+    n *= 2;
+  }
+
+  if ((grown = (pollreg *)realloc(p->regs, sizeof(pollreg) * n)) == NULL) {
+    return NULL;
+  }
+
+  memset(grown + p->n_regs, 0, sizeof(pollreg) * (n - p->n_regs));
+  p->regs = grown;
+  p->n_regs = n;
+
+  return &p->regs[fd];
+}
+
+/**
+ * Drops a descriptor from the epoll set; called before it is closed, since
+ * its number may come straight back from the next accept
+ */
+void poller_forget(vspoller *p, int fd) {
+  if (p->epoll_fd < 0 || fd < 0 || fd >= p->n_regs || !p->regs[fd].registered) {
+    return;
+  }
+
+  epoll_ctl(p->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+  p->regs[fd].registered = 0;
+}
+
+/**
+ * Brings the epoll set in line with a descriptor table. A descriptor that
+ * can't be watched is handed back with POLLERR, so that the loop closes
+ * its connection rather than leaving it unserved
+ * @returns The number of descriptors that couldn't be watched
+ */
+int poller_sync(vspoller *p, struct pollfd *fds, int n) {
+  int i, op, failed = 0;
+  pollreg *r = NULL;
+  struct epoll_event ev;
+
+  for (i = 0; i < n; i ++) {
+    fds[i].revents = 0;
+
+    if (fds[i].fd < 0) {
+      continue;
+    }
+
+    if ((r = poller_reg(p, fds[i].fd)) == NULL) {
+      log_error("Unable to register descriptor %d; out of memory", fds[i].fd);
+      fds[i].revents = POLLERR;
+      failed ++;
+      continue;
+    }
+
+    r->slot = i;
+
+    if (r->registered && r->events == fds[i].events) {
+      continue;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = fds[i].events;
+    ev.data.fd = fds[i].fd;
+    op = r->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+
+    if (epoll_ctl(p->epoll_fd, op, fds[i].fd, &ev) < 0) {
+      /* a registration that went with a closed descriptor */
+      if (op != EPOLL_CTL_MOD || errno != ENOENT ||
+          epoll_ctl(p->epoll_fd, EPOLL_CTL_ADD, fds[i].fd, &ev) < 0) {
+        log_error("Unable to register descriptor %d (errno=%d)", fds[i].fd, errno);
+        fds[i].revents = POLLERR;
+        failed ++;
+        continue;
+      }
+    }
+
+    r->registered = 1;
+    r->events = fds[i].events;
+  }
+
+  return failed;
+}
+
+/**
+ * Waits for activity on a descriptor table, filling in its revents
+ */
+int poller_wait(vspoller *p, struct pollfd *fds, int n, int timeout) {
+  int i, rc, failed;
+  pollreg *r = NULL;
+
+  if (p->epoll_fd < 0) {
+    return poll(fds, n, timeout);
+  }
+
+  /* descriptors that couldn't be watched are ready now, with an error */
+  if ((failed = poller_sync(p, fds, n)) > 0) {
+    timeout = 0;
+  }
+
+  if ((rc = epoll_wait(p->epoll_fd, p->ready, p->size, timeout)) <= 0) {
+    return (rc < 0 && !failed) ? rc : failed;
+  }
+
+  /* the poll and epoll event bits share their values */
+  for (i = 0; i < rc; i ++) {
+    r = &p->regs[p->ready[i].data.fd];
+    fds[r->slot].revents = (short)p->ready[i].events;
+  }
+
+  return rc + failed;
+}
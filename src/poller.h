@@ -0,0 +1,81 @@
+#ifndef __varsvr_poller_h_
+
+#define __varsvr_poller_h_
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/poll.h>
+
+#include "./log.h"
+#include "./errors.h"
+
+/*
+ * Waits for activity on the event loop's descriptor table. The loop always
+ * describes what it wants in a pollfd table and gets revents back in it;
+ * the engine decides how the kernel is asked:
+ *
+ *   poll    the table is handed to poll() on every pass
+ *   epoll   the table is mirrored into an epoll set, only descriptors whose
+ *           slot or interest changed since the last pass are re-registered,
+ *           and the kernel hands back just the ready ones
+ */
+
+#define POLLER_POLL   0
+#define POLLER_EPOLL  1
+
+extern int vs_io_engine;
+
+/**
+ * @struct _tag_pollreg
+ * @brief What an epoll set holds for a descriptor
+ */
+typedef struct _tag_pollreg {
+  int registered;
+  short events;
+  int slot;               /* where the descriptor sits in this pass's table */
+} pollreg;
+
+/**
+ * @struct _tag_vspoller
+ * @brief The engine state behind one event loop
+ */
+typedef struct _tag_vspoller {
+  int epoll_fd;
+  pollreg *regs;          /* indexed by descriptor */
+  int n_regs;
+  struct epoll_event *ready;
+  int size;
+} vspoller;
+
+/**
+ * Looks up an engine by name
+ * @returns The engine, otherwise -1
+ */
+int poller_engine(const char *name);
+
+/**
+ * Prepares the configured engine for a table of at most size slots
+ */
+int poller_init(vspoller *p, int size);
+
+/**
+ * Releases the engine
+ */
+int poller_teardown(vspoller *p);
+
+/**
+ * Stops watching a descriptor; must be called before it is closed
+ */
+void poller_forget(vspoller *p, int fd);
+
+/**
+ * Waits for activity on a descriptor table, filling in its revents; a
+ * descriptor the engine can't watch comes back with POLLERR
+ * @returns The number of ready descriptors, 0 on timeout, otherwise -1
+ */
+int poller_wait(vspoller *p, struct pollfd *fds, int n, int timeout);
+
+#endif /* __varsvr_poller_h_ */
@@ -0,0 +1,953 @@
+#include "./proto.h"
+
+/**
+ * Sends a simple status line back to the client
+ */
+int proto_reply(vsconn *c, const char *s) {
+  int rc;
+  struct iovec iov;
+
+  /* a primary isn't answered, but a change of its that couldn't be
+   * applied leaves this replica behind it; the link is dropped rather
+   * than counting the change, so that the next sync sends it again */
+  if (c->upstream) {
+    if (strncmp(s, "ERR ", 4) == 0 || strncmp(s, "CONFLICT ", 9) == 0) {
+      log_error("Unable to apply a change from the primary (%.*s)", (int)strcspn(s, "\r\n"), s);
+      c->closing = 1;
+      return ERR_BADREQ;
+    }
+
+    return ERR_SUCCESS;
+  }
+
+  iov.iov_base = (void *)s;
+  iov.iov_len = strlen(s);
+
+  trace_switch(TRACE_SEND);
+  rc = conn_writev(c, &iov, 1);
+  trace_switch(TRACE_EXEC);
+
+  return rc;
+}
+
+/**
+ * Sends a value back to the client. The header and trailer are gathered
+ * around the value's own storage, so large values go to the socket without
+ * being copied
+ */
+int proto_reply_value(vsconn *c, vsval *v) {
+  int n, rc;
+  char header[64], scratch[64];
+  const void *data = NULL;
+  unsigned int length = 0;
+  struct iovec iov[3];
+  type_desc *desc = lookup_type(v->type_id);
+
+  if (c->upstream) {
+    return ERR_SUCCESS;
+  }
+
+  trace_switch(TRACE_ENCODE);
+
+  if (desc == NULL ||
+      vsval_payload(v, scratch, sizeof(scratch), &data, &length) != ERR_SUCCESS) {
+    return proto_reply(c, "ERR corrupt value\r\n");
+  }
+
+  n = snprintf(header, sizeof(header), "VALUE %s %u\r\n", desc->name, length);
+
+  iov[0].iov_base = header;
+  iov[0].iov_len = n;
+  iov[1].iov_base = (void *)data;
+  iov[1].iov_len = length;
+  iov[2].iov_base = "\r\n";
+  iov[2].iov_len = 2;
+
+  trace_switch(TRACE_SEND);
+  rc = conn_writev(c, iov, 3);
+  trace_switch(TRACE_EXEC);
+
+  return rc;
+}
+
+/**
+ * Sends a reply that was encoded earlier
+ */
+int proto_reply_buf(vsconn *c, vsbuf *b) {
+  int rc;
+  struct iovec iov;
+
+  if (c->upstream) {
+    return ERR_SUCCESS;
+  }
+
+  iov.iov_base = b->data;
+  iov.iov_len = b->len;
+
+  trace_switch(TRACE_SEND);
+  rc = conn_writev(c, &iov, 1);
+  trace_switch(TRACE_EXEC);
+
+  return rc;
+}
+
+/**
+ * Encodes the VALUE reply for a value into a buffer of its own
+ * @returns The buffer, otherwise NULL
+ */
+vsbuf* proto_encode_value(vsval *v) {
+  char scratch[64];
+  const void *data = NULL;
+  unsigned int length = 0, header;
+  vsbuf *b = NULL;
+  type_desc *desc = lookup_type(v->type_id);
+
+  trace_switch(TRACE_ENCODE);
+
+  if (desc == NULL ||
+      vsval_payload(v, scratch, sizeof(scratch), &data, &length) != ERR_SUCCESS ||
+      (b = vsbuf_alloc(length + 64)) == NULL) {
+    return NULL;
+  }
+
+  header = snprintf(b->data, 64, "VALUE %s %u\r\n", desc->name, length);
+  memcpy(b->data + header, data, length);
+  memcpy(b->data + header + length, "\r\n", 2);
+  b->len = header + length + 2;
+
+  return b;
+}
+
+/**
+ * Hands a change to a key on to watchers and replicas
+ * @param v The new value, or NULL when the key was deleted
+ */
+void proto_changed(const char *key, vsval *v) {
+  pubsub_publish(key, v);
+  repl_log_change(key, v);
+  worker_wake_replicas();
+}
+
+/**
+ * Determines if a connection may change the store; a replica only takes
+ * changes from its primary
+ */
+int proto_writable(vsconn *c) {
+  return c->upstream || !repl_is_replica();
+}
+
+/**
+ * GET <key>
+ */
+int proto_cmd_get(vsconn *c, char **argv) {
+  int rc;
+  vsval *v = NULL;
+  vsbuf *b = NULL;
+  vshotentry *hot = hotkey_record(argv[1], hotkey_hash(argv[1]));
+
+  /* a hot key may be answered from this worker's own copy */
+  if (hot && vs_hot_cache && (b = hotkey_cached(hot)) != NULL) {
+    return proto_reply_buf(c, b);
+  }
+
+  /* the value is sent from the store, so it is held until it's queued */
+  trace_switch(TRACE_LOOKUP);
+  store_read_lock();
+  v = store_get(argv[1]);
+  trace_switch(TRACE_EXEC);
+
+  if (v == NULL) {
+    rc = proto_reply(c, "NOTFOUND\r\n");
+  } else if (hot && vs_hot_cache && v->length <= HOTKEY_MAX_VALUE &&
+             (b = proto_encode_value(v)) != NULL) {
+    hotkey_fill(hot, b);
+    rc = proto_reply_buf(c, b);
+    vsbuf_release(&b);
+  } else {
+    rc = proto_reply_value(c, v);
+  }
+
+  store_unlock();
+
+  return rc;
+}
+
+/**
+ * Stages an operation in the connection's transaction
+ */
+int proto_stage(vsconn *c, int op, const char *key, vsval *v, long long delta,
+                unsigned long long version) {
+  int rc = txn_stage(c->txn, op, key, v, delta, version);
+
+  if (rc != ERR_SUCCESS) {
+    if (v) {
+      vsval_destroy(&v);
+    }
+
+    c->txn->aborted = 1;
+
+    if (rc == ERR_FULL) {
+      return proto_reply(c, "ERR transaction too large\r\n");
+    }
+
+    return proto_reply(c, "ERR unable to queue operation\r\n");
+  }
+
+  return proto_reply(c, "QUEUED\r\n");
+}
+
+/**
+ * Stages a SET in the connection's transaction; the value is parsed now,
+ * so that a bad one spoils the transaction rather than failing it later
+ */
+int proto_stage_set(vsconn *c, char **argv, const char *data, unsigned int length) {
+  vsval *v = NULL;
+  type_desc *desc = lookup_type_by_name(argv[2]);
+
+  if (desc == NULL || desc->id == 0 || vsval_create(argv[2], &v) != ERR_SUCCESS) {
+    c->txn->aborted = 1;
+    return proto_reply(c, "ERR invalid type or value\r\n");
+  }
+
+  if (vsval_parse(v, desc->id, data, length) != ERR_SUCCESS) {
+    vsval_destroy(&v);
+    c->txn->aborted = 1;
+    return proto_reply(c, "ERR invalid type or value\r\n");
+  }
+
+  return proto_stage(c, TXN_SET, argv[1], v, 0, 0);
+}
+
+/**
+ * SET <key> <type> <bytes>, with the value following the request line
+ */
+int proto_cmd_set(vsconn *c, char **argv, const char *data, unsigned int length) {
+  int rc;
+
+  if (!proto_writable(c)) {
+    return proto_reply(c, "ERR read only replica\r\n");
+  }
+
+  if (c->txn) {
+    return proto_stage_set(c, argv, data, length);
+  }
+
+  trace_switch(TRACE_LOOKUP);
+  store_write_lock();
+  rc = store_set(argv[1], argv[2], data, length);
+  trace_switch(TRACE_EXEC);
+
+  if (rc == ERR_SUCCESS) {
+    proto_changed(argv[1], store_get(argv[1]));
+  }
+
+  store_unlock();
+
+  if (rc == ERR_INVTYPE) {
+    return proto_reply(c, "ERR invalid type or value\r\n");
+  } else if (rc == ERR_FULL) {
+    return proto_reply(c, "ERR memory limit reached\r\n");
+  } else if (rc != ERR_SUCCESS) {
+    return proto_reply(c, "ERR unable to store value\r\n");
+  }
+
+  return proto_reply(c, "OK\r\n");
+}
+
+/**
+ * DEL <key>
+ */
+int proto_cmd_del(vsconn *c, char **argv) {
+  int rc;
+
+  if (!proto_writable(c)) {
+    return proto_reply(c, "ERR read only replica\r\n");
+  }
+
+  if (c->txn) {
+    return proto_stage(c, TXN_DEL, argv[1], NULL, 0, 0);
+  }
+
+  trace_switch(TRACE_LOOKUP);
+  store_write_lock();
+  rc = store_del(argv[1]);
+  trace_switch(TRACE_EXEC);
+
+  if (rc == ERR_SUCCESS) {
+    proto_changed(argv[1], NULL);
+  }
+
+  store_unlock();
+
+  return proto_reply(c, rc == ERR_SUCCESS ? "OK\r\n" : "NOTFOUND\r\n");
+}
+
+/**
+ * INCR <key> [<delta>]
+ */
+int proto_cmd_incr(vsconn *c, int argc, char **argv) {
+  int rc, sent = ERR_SUCCESS;
+  long long delta = 1;
+  char *end = NULL;
+  vsval *v = NULL;
+
+  if (!proto_writable(c)) {
+    return proto_reply(c, "ERR read only replica\r\n");
+  }
+
+  if (argc == 3) {
+    errno = 0;
+    delta = strtoll(argv[2], &end, 10);
+
+    if (errno || *end != 0) {
+      if (c->txn) {
+        c->txn->aborted = 1;
+      }
+
+      return proto_reply(c, "ERR invalid delta\r\n");
+    }
+  }
+
+  if (c->txn) {
+    return proto_stage(c, TXN_INCR, argv[1], NULL, delta, 0);
+  }
+
+  trace_switch(TRACE_LOOKUP);
+  store_write_lock();
+  rc = store_incr(argv[1], delta, &v);
+  trace_switch(TRACE_EXEC);
+
+  if (rc == ERR_SUCCESS) {
+    proto_changed(argv[1], v);
+    sent = proto_reply_value(c, v);
+  }
+
+  store_unlock();
+
+  /* once stored, only the reply can have failed, and that isn't the
+   * client's to be told about */
+  if (rc == ERR_SUCCESS) {
+    return sent;
+  } else if (rc == ERR_INVTYPE) {
+    return proto_reply(c, "ERR value is not a number\r\n");
+  } else if (rc == ERR_FULL) {
+    return proto_reply(c, "ERR memory limit reached\r\n");
+  } else if (rc == ERR_NOMEM) {
+    return proto_reply(c, "ERR unable to store value\r\n");
+  }
+
+  return rc;
+}
+
+/**
+ * VERSION <key>
+ */
+int proto_cmd_version(vsconn *c, char **argv) {
+  char line[64];
+
+  trace_switch(TRACE_LOOKUP);
+  store_read_lock();
+  snprintf(line, sizeof(line), "VERSION %llu\r\n", store_version(argv[1]));
+  store_unlock();
+  trace_switch(TRACE_EXEC);
+
+  return proto_reply(c, line);
+}
+
+/**
+ * MULTI
+ */
+int proto_cmd_multi(vsconn *c) {
+  if (!proto_writable(c)) {
+    return proto_reply(c, "ERR read only replica\r\n");
+  }
+
+  if (c->txn) {
+    c->txn->aborted = 1;
+    return proto_reply(c, "ERR transaction already open\r\n");
+  }
+
+  if ((c->txn = txn_create()) == NULL) {
+    return proto_reply(c, "ERR unable to start transaction\r\n");
+  }
+
+  return proto_reply(c, "OK\r\n");
+}
+
+/**
+ * CHECK <key> <version>
+ */
+int proto_cmd_check(vsconn *c, char **argv) {
+  unsigned long long version;
+  char *end = NULL;
+
+  if (c->txn == NULL) {
+    return proto_reply(c, "ERR no transaction open\r\n");
+  }
+
+  errno = 0;
+  version = strtoull(argv[2], &end, 10);
+
+  if (errno || *end != 0 || argv[2][0] == '-') {
+    c->txn->aborted = 1;
+    return proto_reply(c, "ERR invalid version\r\n");
+  }
+
+  return proto_stage(c, TXN_CHECK, argv[1], NULL, 0, version);
+}
+
+/**
+ * Sends the outcome of every operation in an executed transaction
+ */
+int proto_reply_exec(vsconn *c, vstxn *t) {
+  int rc;
+  char line[32];
+  vstxnop *o = NULL;
+
+  snprintf(line, sizeof(line), "EXEC %u\r\n", t->n_ops);
+
+  if ((rc = proto_reply(c, line)) != ERR_SUCCESS) {
+    return rc;
+  }
+
+  for (o = t->head; o && rc == ERR_SUCCESS; o = o->next) {
+    if (o->op == TXN_INCR) {
+      rc = proto_reply_value(c, o->v);
+    } else {
+      rc = proto_reply(c, o->rc == ERR_SUCCESS ? "OK\r\n" : "NOTFOUND\r\n");
+    }
+  }
+
+  return rc;
+}
+
+/**
+ * EXEC
+ */
+int proto_cmd_exec(vsconn *c) {
+  int rc;
+  char line[PROTO_MAX_KEY + 16];
+  const char *conflict = NULL;
+
+  if (c->txn == NULL) {
+    return proto_reply(c, "ERR no transaction open\r\n");
+  }
+
+  if (c->txn->aborted) {
+    txn_destroy(&c->txn);
+    return proto_reply(c, "ERR transaction aborted\r\n");
+  }
+
+  trace_switch(TRACE_LOOKUP);
+  store_write_lock();
+
+  if ((rc = txn_exec(c->txn, &conflict)) == ERR_SUCCESS) {
+    worker_wake_replicas();
+  }
+
+  store_unlock();
+  trace_switch(TRACE_EXEC);
+
+  if (rc == ERR_SUCCESS) {
+    rc = proto_reply_exec(c, c->txn);
+  } else if (rc == ERR_CONFLICT) {
+    snprintf(line, sizeof(line), "CONFLICT %s\r\n", conflict);
+    rc = proto_reply(c, line);
+  } else if (rc == ERR_INVTYPE) {
+    rc = proto_reply(c, "ERR value is not a number\r\n");
+  } else if (rc == ERR_FULL) {
+    rc = proto_reply(c, "ERR memory limit reached\r\n");
+  } else {
+    rc = proto_reply(c, "ERR unable to store value\r\n");
+  }
+
+  txn_destroy(&c->txn);
+
+  return rc;
+}
+
+/**
+ * DISCARD
+ */
+int proto_cmd_discard(vsconn *c) {
+  if (c->txn == NULL) {
+    return proto_reply(c, "ERR no transaction open\r\n");
+  }
+
+  txn_destroy(&c->txn);
+
+  return proto_reply(c, "OK\r\n");
+}
+
+/**
+ * Sends a report, or a failure when it couldn't be made
+ */
+int proto_reply_report(vsconn *c, char *text) {
+  int rc;
+
+  if (text == NULL) {
+    return proto_reply(c, "ERR unable to build report\r\n");
+  }
+
+  rc = proto_reply(c, text);
+  free(text);
+
+  return rc;
+}
+
+/**
+ * LATENCY [RESET]
+ */
+int proto_cmd_latency(vsconn *c, int argc, char **argv) {
+  if (argc == 2) {
+    if (strcasecmp(argv[1], "RESET") != 0) {
+      return proto_reply(c, "ERR unknown latency option\r\n");
+    }
+
+    trace_reset();
+    return proto_reply(c, "OK\r\n");
+  }
+
+  return proto_reply_report(c, trace_latency_report());
+}
+
+/**
+ * SLOWLOG [<n>|RESET]
+ */
+int proto_cmd_slowlog(vsconn *c, int argc, char **argv) {
+  int count = -1;
+  char *end = NULL;
+
+  if (argc == 2 && strcasecmp(argv[1], "RESET") == 0) {
+    trace_slowlog_reset();
+    return proto_reply(c, "OK\r\n");
+  }
+
+  if (argc == 2) {
+    count = (int)strtol(argv[1], &end, 10);
+
+    if (*end != 0 || count < 0) {
+      return proto_reply(c, "ERR invalid count\r\n");
+    }
+  }
+
+  return proto_reply_report(c, trace_slowlog_report(count));
+}
+
+/**
+ * HOTKEYS [<n>]
+ */
+int proto_cmd_hotkeys(vsconn *c, int argc, char **argv) {
+  int count = -1;
+  char *end = NULL;
+
+  if (argc == 2) {
+    count = (int)strtol(argv[1], &end, 10);
+
+    if (*end != 0 || count < 0) {
+      return proto_reply(c, "ERR invalid count\r\n");
+    }
+  }
+
+  return proto_reply_report(c, hotkey_report(count));
+}
+
+/**
+ * STATS
+ */
+int proto_cmd_stats(vsconn *c) {
+  char text[1024];
+  double ratio;
+  unsigned long long bytes, version, hits, misses, moved;
+
+  store_read_lock();
+  bytes = vs_store_bytes;
+  version = vs_store_version;
+  ratio = defrag_ratio(NULL);
+  moved = vs_defrag_moved;
+  store_unlock();
+
+  hotkey_stats(&hits, &misses);
+
+  snprintf(text, sizeof(text),
+           "STATS 9\r\n"
+           "workers %d\r\n"
+           "connections %d\r\n"
+           "store_bytes %llu\r\n"
+           "memory_limit %llu\r\n"
+           "store_version %llu\r\n"
+           "hot_cache_hits %llu\r\n"
+           "hot_cache_misses %llu\r\n"
+           "fragmentation_ratio %.2f\r\n"
+           "defrag_moved %llu\r\n",
+           vs_n_worker_set, admit_count(), bytes, vs_memory_limit, version, hits, misses,
+           ratio, moved);
+
+  return proto_reply(c, text);
+}
+
+/**
+ * Determines if a command may be staged in, or ends, a transaction; MULTI
+ * goes through too, to be told a transaction is already open
+ */
+int proto_txn_allowed(const char *cmd) {
+  return strcasecmp(cmd, "SET") == 0 || strcasecmp(cmd, "DEL") == 0 ||
+         strcasecmp(cmd, "INCR") == 0 || strcasecmp(cmd, "CHECK") == 0 ||
+         strcasecmp(cmd, "EXEC") == 0 || strcasecmp(cmd, "DISCARD") == 0 ||
+         strcasecmp(cmd, "MULTI") == 0;
+}
+
+/**
+ * WATCH <key>|<prefix>* [VALUES]
+ */
+int proto_cmd_watch(vsconn *c, int argc, char **argv) {
+  int rc, values = 0;
+
+  if (argc == 3) {
+    if (strcasecmp(argv[2], "VALUES") != 0) {
+      return proto_reply(c, "ERR unknown watch option\r\n");
+    }
+
+    values = 1;
+  }
+
+  store_write_lock();
+  rc = pubsub_watch(c, argv[1], values);
+  store_unlock();
+
+  if (rc != ERR_SUCCESS) {
+    return proto_reply(c, "ERR unable to watch\r\n");
+  }
+
+  return proto_reply(c, "OK\r\n");
+}
+
+/**
+ * UNWATCH <key>|<prefix>*
+ */
+int proto_cmd_unwatch(vsconn *c, char **argv) {
+  int rc;
+
+  store_write_lock();
+  rc = pubsub_unwatch(c, argv[1]);
+  store_unlock();
+
+  if (rc != ERR_SUCCESS) {
+    return proto_reply(c, "NOTFOUND\r\n");
+  }
+
+  return proto_reply(c, "OK\r\n");
+}
+
+/**
+ * SYNC <replid>|- <offset>
+ */
+int proto_cmd_sync(vsconn *c, char **argv) {
+  int rc;
+
+  store_write_lock();
+  rc = repl_sync(c, argv[1], argv[2]);
+  store_unlock();
+
+  if (rc == ERR_BADREQ) {
+    return proto_reply(c, "ERR invalid offset\r\n");
+  } else if (rc == ERR_NOMEM) {
+    return proto_reply(c, "ERR unable to replicate\r\n");
+  }
+
+  return rc;
+}
+
+/**
+ * SHM
+ */
+int proto_cmd_shm(vsconn *c) {
+  int rc = shm_attach(c);
+
+  if (rc == ERR_BADREQ) {
+    return proto_reply(c, "ERR shared memory needs a unix domain socket\r\n");
+  } else if (rc == ERR_PENDING) {
+    return proto_reply(c, "ERR earlier replies not yet read\r\n");
+  } else if (rc == ERR_NOMEM) {
+    return proto_reply(c, "ERR unable to create shared memory\r\n");
+  }
+
+  return rc;
+}
+
+/**
+ * Splits a request line into its space separated arguments
+ * @returns The number of arguments found
+ */
+int proto_split(char *line, char **argv) {
+  int argc = 0;
+  char *save = NULL, *tok = strtok_r(line, " \t", &save);
+
+  while (tok && argc < PROTO_MAX_ARGS) {
+    argv[argc ++] = tok;
+    tok = strtok_r(NULL, " \t", &save);
+  }
+
+  return tok ? -1 : argc;
+}
+
+/**
+ * Processes the request at the front of a buffer
+ * @param used Receives the number of bytes the request occupied, or 0 when
+ *             the request hasn't been completely received yet
+ */
+int proto_request(vsconn *c, const char *buf, unsigned int len, unsigned int *used) {
+  int argc, rc;
+  char line[PROTO_MAX_LINE + 1], *argv[PROTO_MAX_ARGS], *end = NULL;
+  unsigned int line_len, head_len;
+  unsigned long length;
+  const char *nl = memchr(buf, '\n', len < PROTO_MAX_LINE ? len : PROTO_MAX_LINE);
+
+  *used = 0;
+
+  /* wait for the rest of the line, unless it's grown too long */
+  if (nl == NULL) {
+    if (len >= PROTO_MAX_LINE) {
+      proto_reply(c, "ERR request too long\r\n");
+      return ERR_BADREQ;
+    }
+
+    return ERR_SUCCESS;
+  }
+
+  head_len = (nl - buf) + 1;
+  line_len = head_len - 1;
+
+  if (line_len > 0 && buf[line_len - 1] == '\r') {
+    line_len --;
+  }
+
+  memcpy(line, buf, line_len);
+  line[line_len] = 0;
+
+  if ((argc = proto_split(line, argv)) == 0) {
+    *used = head_len;
+    return ERR_SUCCESS;
+  }
+
+  if (argc < 0) {
+    *used = head_len;
+    return proto_reply(c, "ERR too many arguments\r\n");
+  }
+
+  if (argc > 1 && strlen(argv[1]) > PROTO_MAX_KEY) {
+    proto_reply(c, "ERR key too long\r\n");
+    return ERR_BADREQ;
+  }
+
+  /* a transaction only holds writes; anything else spoils it */
+  if (c->txn && !proto_txn_allowed(argv[0])) {
+    *used = head_len;
+    c->txn->aborted = 1;
+    return proto_reply(c, "ERR command not allowed in a transaction\r\n");
+  }
+
+  trace_switch(TRACE_EXEC);
+
+  if (strcasecmp(argv[0], "GET") == 0 && argc == 2) {
+    *used = head_len;
+    return proto_cmd_get(c, argv);
+  }
+
+  if (strcasecmp(argv[0], "DEL") == 0 && argc == 2) {
+    *used = head_len;
+    return proto_cmd_del(c, argv);
+  }
+
+  if (strcasecmp(argv[0], "INCR") == 0 && (argc == 2 || argc == 3)) {
+    *used = head_len;
+    return proto_cmd_incr(c, argc, argv);
+  }
+
+  if (strcasecmp(argv[0], "VERSION") == 0 && argc == 2) {
+    *used = head_len;
+    return proto_cmd_version(c, argv);
+  }
+
+  if (strcasecmp(argv[0], "MULTI") == 0 && argc == 1) {
+    *used = head_len;
+    return proto_cmd_multi(c);
+  }
+
+  if (strcasecmp(argv[0], "CHECK") == 0 && argc == 3) {
+    *used = head_len;
+    return proto_cmd_check(c, argv);
+  }
+
+  if (strcasecmp(argv[0], "EXEC") == 0 && argc == 1) {
+    *used = head_len;
+    return proto_cmd_exec(c);
+  }
+
+  if (strcasecmp(argv[0], "DISCARD") == 0 && argc == 1) {
+    *used = head_len;
+    return proto_cmd_discard(c);
+  }
+
+  if (strcasecmp(argv[0], "WATCH") == 0 && (argc == 2 || argc == 3)) {
+    *used = head_len;
+    return proto_cmd_watch(c, argc, argv);
+  }
+
+  if (strcasecmp(argv[0], "UNWATCH") == 0 && argc == 2) {
+    *used = head_len;
+    return proto_cmd_unwatch(c, argv);
+  }
+
+  if (strcasecmp(argv[0], "SYNC") == 0 && argc == 3) {
+    *used = head_len;
+    return proto_cmd_sync(c, argv);
+  }
+
+  if (strcasecmp(argv[0], "LATENCY") == 0 && (argc == 1 || argc == 2)) {
+    *used = head_len;
+    return proto_cmd_latency(c, argc, argv);
+  }
+
+  if (strcasecmp(argv[0], "SLOWLOG") == 0 && (argc == 1 || argc == 2)) {
+    *used = head_len;
+    return proto_cmd_slowlog(c, argc, argv);
+  }
+
+  if (strcasecmp(argv[0], "HOTKEYS") == 0 && (argc == 1 || argc == 2)) {
+    *used = head_len;
+    return proto_cmd_hotkeys(c, argc, argv);
+  }
+
+  if (strcasecmp(argv[0], "STATS") == 0 && argc == 1) {
+    *used = head_len;
+    return proto_cmd_stats(c);
+  }
+
+  if (strcasecmp(argv[0], "SHM") == 0 && argc == 1) {
+    *used = head_len;
+    return proto_cmd_shm(c);
+  }
+
+  /* only ever sent by a primary to its replica */
+  if (strcasecmp(argv[0], "FULLSYNC") == 0 && argc == 2) {
+    *used = head_len;
+    store_write_lock();
+    rc = repl_fullsync(c, argv[1]);
+    store_unlock();
+    return rc;
+  }
+
+  if (strcasecmp(argv[0], "STREAM") == 0 && argc == 2) {
+    *used = head_len;
+    store_write_lock();
+    rc = repl_stream(c, argv[1]);
+    store_unlock();
+    return rc;
+  }
+
+  if (strcasecmp(argv[0], "SET") == 0 && argc == 4) {
+    length = strtoul(argv[3], &end, 10);
+
+    /* without a usable size the value can't be stepped over */
+    if (*end != 0 || length > PROTO_MAX_VALUE) {
+      proto_reply(c, "ERR invalid value size\r\n");
+      return ERR_BADREQ;
+    }
+
+    /* wait until the value and its terminator have arrived */
+    if (len - head_len < length + 1) {
+      return ERR_SUCCESS;
+    }
+
+    if (buf[head_len + length] == '\r') {
+      if (len - head_len < length + 2) {
+        return ERR_SUCCESS;
+      }
+
+      *used = head_len + length + 2;
+
+      if (buf[head_len + length + 1] != '\n') {
+        proto_reply(c, "ERR value not terminated\r\n");
+        return ERR_BADREQ;
+      }
+    } else if (buf[head_len + length] == '\n') {
+      *used = head_len + length + 1;
+    } else {
+      proto_reply(c, "ERR value not terminated\r\n");
+      return ERR_BADREQ;
+    }
+
+    return proto_cmd_set(c, argv, buf + head_len, length);
+  }
+
+  *used = head_len;
+
+  if (c->txn) {
+    c->txn->aborted = 1;
+  }
+
+  return proto_reply(c, "ERR unknown command\r\n");
+}
+
+/**
+ * Processes the complete requests buffered on a connection, up to its
+ * budget for a pass of the event loop
+ */
+int proto_process(vsconn *c) {
+  int rc = ERR_SUCCESS, streaming, served = 0;
+  unsigned int pos = 0, used = 0;
+
+  c->backlog = 0;
+
+  /* a client that isn't reading its replies gets no more served until
+   * it catches up */
+  while (c->in && pos < c->in->len && !c->paused) {
+    /* the rest of a burst waits for the worker's other clients */
+    if (served == vs_request_budget) {
+      c->backlog = 1;
+      break;
+    }
+
+    /* as does the rest of one over its rate */
+    if (admit_take(c) != ERR_SUCCESS) {
+      break;
+    }
+
+    /* a replica tracks how far into its primary's log it has applied */
+    streaming = repl_streaming(c);
+    trace_begin();
+    rc = proto_request(c, c->in->data + pos, c->in->len - pos, &used);
+
+    /* watchers it changed anything for are sent their notifications now
+     * the store lock is released */
+    pubsub_flush();
+
+    if (used) {
+      trace_end(c->in->data + pos, used);
+    } else {
+      trace_cancel();
+      admit_refund(c);
+    }
+
+    /* nor does one from the primary that wasn't applied */
+    if (rc != ERR_SUCCESS || used == 0 || c->closing) {
+      break;
+    }
+
+    /* a transaction from the primary only counts once it's executed */
+    if (streaming && c->txn) {
+      c->repl_held += used;
+    } else if (streaming) {
+      repl_applied(c->repl_held + used);
+      c->repl_held = 0;
+    }
+
+    pos += used;
+    served ++;
+  }
+
+  conn_consume(c, pos);
+
+  return rc;
+}
@@ -0,0 +1,70 @@
+#ifndef __varsvr_proto_h_
+
+#define __varsvr_proto_h_
+
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/uio.h>
+
+#include "./admit.h"
+#include "./conn.h"
+#include "./defrag.h"
+#include "./pubsub.h"
+#include "./repl.h"
+#include "./shm.h"
+#include "./store.h"
+#include "./trace.h"
+#include "./txn.h"
+#include "./typesys.h"
+#include "./worker.h"
+#include "./errors.h"
+
+/*
+ * Requests are single text lines; SET carries its value in a sized block
+ * following the line so that values are binary safe:
+ *
+ *   GET <key>                        VALUE <type> <bytes>\r\n<data>\r\n
+ *                                    NOTFOUND\r\n
+ *   SET <key> <type> <bytes>\r\n
+ *   <data>\r\n                       OK\r\n
+ *   DEL <key>                        OK\r\n | NOTFOUND\r\n
+ *   INCR <key> [<delta>]             VALUE <type> <bytes>\r\n<data>\r\n
+ *   VERSION <key>                    VERSION <n>\r\n (0 when there's no key)
+ *   MULTI                            OK\r\n, then SET, DEL, INCR and
+ *                                    CHECK <key> <version> each answer
+ *                                    QUEUED\r\n until
+ *   EXEC                             EXEC <n>\r\n and a reply per operation
+ *                                    (CHECK answers OK)
+ *                                    CONFLICT <key>\r\n
+ *   DISCARD                          OK\r\n
+ *   LATENCY [RESET]                  phase histograms (see trace.h)
+ *   SLOWLOG [<n>|RESET]              slow requests (see trace.h)
+ *   HOTKEYS [<n>]                    most read keys (see hotkey.h)
+ *   STATS                            STATS <n>\r\n, then <n> lines of
+ *                                    <name> <value>\r\n
+ *   WATCH <key>|<prefix>* [VALUES]   OK\r\n, then NOTIFY pushes (see pubsub.h)
+ *   UNWATCH <key>|<prefix>*          OK\r\n | NOTFOUND\r\n
+ *   SYNC <replid>|- <offset>         replication stream (see repl.h)
+ *   SHM                              shared memory channel (see shm.h)
+ *
+ * Failures are reported as ERR <reason>\r\n; one inside a transaction
+ * aborts it, and its EXEC then fails (see txn.h). Requests arriving from a
+ * replica's primary are applied without being answered.
+ */
+
+#define PROTO_MAX_LINE    1024
+#define PROTO_MAX_KEY     250
+#define PROTO_MAX_ARGS    8
+#define PROTO_MAX_VALUE   (64 * 1024 * 1024)
+
+/**
+ * Processes every complete request buffered on a connection, leaving any
+ * partial request in place for the next read
+ * @returns ERR_SUCCESS, otherwise an error after which the connection is closed
+ */
+int proto_process(vsconn *c);
+
+#endif /* __varsvr_proto_h_ */
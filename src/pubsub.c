@@ -0,0 +1,386 @@
+#include "./pubsub.h"
+
+bintree *vs_watch_index = NULL;
+vswatch *vs_key_watches = NULL;
+vswatch *vs_prefix_watches = NULL;
+
+/* number of prefix watches on prefixes of each length */
+unsigned int vs_prefix_lens[PUBSUB_MAX_PREFIX + 1];
+
+/* the calling worker's watchers with notifications waiting to be sent */
+_Thread_local vsconn *pubsub_unflushed = NULL;
+
+/**
+ * Creates the watch registry
+ */
+int pubsub_init() {
+  if ((vs_watch_index = bintree_create()) == NULL) {
+    return ERR_NOMEM;
+  }
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Releases a watch
+ */
+void pubsub_watch_destroy(vswatch **w) {
+  free((*w)->subs);
+  free((*w)->pattern);
+  free(*w);
+  *w = NULL;
+}
+
+/**
+ * Destroys the watch registry
+ */
+int pubsub_teardown() {
+  vswatch *w = NULL;
+
+  while ((w = vs_key_watches) != NULL) {
+    vs_key_watches = w->next;
+    pubsub_watch_destroy(&w);
+  }
+
+  while ((w = vs_prefix_watches) != NULL) {
+    vs_prefix_watches = w->next;
+    pubsub_watch_destroy(&w);
+  }
+
+  bintree_destroy(&vs_watch_index);
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Unlinks a watch from the list holding it
+ */
+void pubsub_unlink(vswatch **list, vswatch *w) {
+  while (*list && *list != w) {
+    list = &(*list)->next;
+  }
+
+  if (*list) {
+    *list = w->next;
+  }
+}
+
+/**
+ * Removes a watch nobody is watching from the index and its list, and
+ * destroys it
+ */
+void pubsub_forget(vswatch *w) {
+  bintree_delete(vs_watch_index, w->pattern, NULL);
+
+  if (w->prefix) {
+    vs_prefix_lens[w->prefix_len] --;
+  }
+
+  pubsub_unlink(w->prefix ? &vs_prefix_watches : &vs_key_watches, w);
+  pubsub_watch_destroy(&w);
+}
+
+/**
+ * Registers a connection's interest in a key or key prefix
+ */
+int pubsub_watch(vsconn *c, const char *pattern, int values) {
+  unsigned int i, len = strlen(pattern);
+  vssub *subs = NULL;
+  vswatch *w = (vswatch *)bintree_find(vs_watch_index, pattern);
+
+  if (w == NULL) {
+    /* prefixes are looked up one length at a time, up to a limit */
+    if (len > PUBSUB_MAX_PREFIX && pattern[len - 1] == '*') {
+      return ERR_BADREQ;
+    }
+
+    if ((w = (vswatch *)calloc(1, sizeof(vswatch))) == NULL ||
+        (w->pattern = strdup(pattern)) == NULL) {
+      free(w);
+      return ERR_NOMEM;
+    }
+
+    w->prefix = (len > 0 && pattern[len - 1] == '*');
+    w->prefix_len = w->prefix ? len - 1 : len;
+
+    if (bintree_insert(vs_watch_index, w->pattern, w) != 0) {
+      pubsub_watch_destroy(&w);
+      return ERR_NOMEM;
+    }
+
+    if (w->prefix) {
+      w->next = vs_prefix_watches;
+      vs_prefix_watches = w;
+      vs_prefix_lens[w->prefix_len] ++;
+    } else {
+      w->next = vs_key_watches;
+      vs_key_watches = w;
+    }
+  }
+
+  /* watching the same pattern again just updates the options */
+  for (i = 0; i < w->n_subs; i ++) {
+    if (w->subs[i].conn == c) {
+      w->subs[i].values = values;
+      return ERR_SUCCESS;
+    }
+  }
+
+  if (w->n_subs == w->cap_subs) {
+    i = w->cap_subs ? w->cap_subs * 2 : 4;
+
+    if ((subs = (vssub *)realloc(w->subs, i * sizeof(vssub))) == NULL) {
+      /* a watch created just now has nobody else watching it */
+      if (w->n_subs == 0) {
+        pubsub_forget(w);
+      }
+
+      return ERR_NOMEM;
+    }
+
+    w->subs = subs;
+    w->cap_subs = i;
+  }
+
+  w->subs[w->n_subs].conn = c;
+  w->subs[w->n_subs].values = values;
+  w->n_subs ++;
+  c->watches ++;
+
+  return ERR_SUCCESS;
+}
+
+
+/**
+ * Removes a connection from a watch, destroying the watch once nobody is
+ * left watching it
+ * @returns ERR_SUCCESS, otherwise ERR_NOTFOUND when it wasn't watching
+ */
+int pubsub_drop(vswatch *w, vsconn *c) {
+  unsigned int i;
+
+  for (i = 0; i < w->n_subs && w->subs[i].conn != c; i ++);
+
+  if (i == w->n_subs) {
+    return ERR_NOTFOUND;
+  }
+
+  w->subs[i] = w->subs[-- w->n_subs];
+  c->watches --;
+
+  if (w->n_subs == 0) {
+    pubsub_forget(w);
+  }
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Removes a connection's interest in a key or key prefix
+ */
+int pubsub_unwatch(vsconn *c, const char *pattern) {
+  vswatch *w = (vswatch *)bintree_find(vs_watch_index, pattern);
+
+  if (w == NULL) {
+    return ERR_NOTFOUND;
+  }
+
+  return pubsub_drop(w, c);
+}
+
+/**
+ * Removes a connection from every watch in a list
+ */
+void pubsub_drop_list(vswatch *w, vsconn *c) {
+  vswatch *next = NULL;
+
+  for (; w && c->watches > 0; w = next) {
+    next = w->next;
+    pubsub_drop(w, c);
+  }
+}
+
+/**
+ * Removes every watch held by a connection
+ */
+void pubsub_unwatch_all(vsconn *c) {
+  pubsub_drop_list(vs_key_watches, c);
+  pubsub_drop_list(vs_prefix_watches, c);
+}
+
+/**
+ * Encodes a notification
+ * @returns A buffer holding the notification, otherwise NULL
+ */
+vsbuf* pubsub_encode(const char *key, vsval *v, int values) {
+  int n;
+  char scratch[64];
+  const void *data = NULL;
+  unsigned int length = 0;
+  type_desc *desc = NULL;
+  vsbuf *b = NULL;
+
+  if (v == NULL) {
+    if ((b = vsbuf_alloc(strlen(key) + 16)) != NULL) {
+      b->len = sprintf(b->data, "NOTIFY DEL %s\r\n", key);
+    }
+
+    return b;
+  }
+
+  if (!values) {
+    if ((b = vsbuf_alloc(strlen(key) + 16)) != NULL) {
+      b->len = sprintf(b->data, "NOTIFY SET %s\r\n", key);
+    }
+
+    return b;
+  }
+
+  if ((desc = lookup_type(v->type_id)) == NULL ||
+      vsval_payload(v, scratch, sizeof(scratch), &data, &length) != ERR_SUCCESS) {
+    return NULL;
+  }
+
+  if ((b = vsbuf_alloc(strlen(key) + strlen(desc->name) + length + 48)) == NULL) {
+    return NULL;
+  }
+
+  n = sprintf(b->data, "NOTIFY SET %s %s %u\r\n", key, desc->name, length);
+  memcpy(b->data + n, data, length);
+  memcpy(b->data + n + length, "\r\n", 2);
+  b->len = n + length + 2;
+
+  return b;
+}
+
+/**
+ * Drops a watcher that missed a notification, so that it reconnects and
+ * watches again; another worker's connection is flagged for its owner to
+ * drop on its next pass
+ */
+void pubsub_miss(vsconn *c) {
+  if (c->worker && c->worker != worker_self()) {
+    atomic_store(&c->missed, 1);
+    worker_wake(c->worker);
+  } else {
+    c->closing = 1;
+  }
+}
+
+/**
+ * Hands a notification to a watching connection
+ */
+void pubsub_deliver(vsconn *c, vsbuf *b) {
+  /* another event loop's connection is only touched by that loop */
+  if (c->worker && c->worker != worker_self()) {
+    if (worker_post(c->worker, c, b) != ERR_SUCCESS) {
+      log_error("Unable to pass notification to worker %d", c->worker->id);
+      pubsub_miss(c);
+    }
+
+    return ;
+  }
+
+  if (c->closing) {
+    return ;
+  }
+
+  if (c->out_bytes >= PUBSUB_MAX_BACKLOG) {
+    log_warn("Disconnecting watcher on fd %d; it isn't keeping up", c->fd);
+    c->closing = 1;
+    return ;
+  }
+
+  if (conn_queue(c, b) != ERR_SUCCESS) {
+    c->closing = 1;
+    return ;
+  }
+
+  /* sending waits until the store lock is released */
+  if (!c->flush_pending) {
+    c->flush_pending = 1;
+    c->unflushed = pubsub_unflushed;
+    pubsub_unflushed = c;
+  }
+}
+
+/**
+ * Sends the notifications queued on the calling worker's watchers
+ */
+void pubsub_flush() {
+  vsconn *c = NULL;
+
+  while ((c = pubsub_unflushed) != NULL) {
+    pubsub_unflushed = c->unflushed;
+    c->unflushed = NULL;
+    c->flush_pending = 0;
+
+    if (!c->closing && conn_flush(c) != ERR_SUCCESS) {
+      c->closing = 1;
+    }
+  }
+}
+
+/**
+ * Notifies the watchers of a pattern
+ */
+void pubsub_notify(vswatch *w, const char *key, vsval *v, vsbuf **plain, vsbuf **full) {
+  unsigned int i;
+  int logged = 0;
+  vsbuf **b = NULL;
+
+  for (i = 0; i < w->n_subs; i ++) {
+    /* deletions look the same whether or not values were asked for */
+    b = (w->subs[i].values && v) ? full : plain;
+
+    if (*b == NULL && (*b = pubsub_encode(key, v, b == full)) == NULL) {
+      if (!logged) {
+        log_error("Unable to encode notification for %s", key);
+        logged = 1;
+      }
+
+      pubsub_miss(w->subs[i].conn);
+      continue;
+    }
+
+    pubsub_deliver(w->subs[i].conn, *b);
+  }
+}
+
+/**
+ * Notifies watchers of a change to a key
+ */
+int pubsub_publish(const char *key, vsval *v) {
+  unsigned int i, len = strlen(key);
+  char probe[PUBSUB_MAX_PREFIX + 2];
+  vswatch *w = NULL;
+  vsbuf *plain = NULL, *full = NULL;
+
+  w = (vswatch *)bintree_find(vs_watch_index, key);
+
+  /* a key that happens to end in '*' is left to the prefix lookups */
+  if (w != NULL && !w->prefix) {
+    pubsub_notify(w, key, v, &plain, &full);
+  }
+
+  /* each prefix of the key that anything watches is looked up in the
+   * index, as the pattern a prefix watch on it would have been made with */
+  for (i = 0; i <= len && i <= PUBSUB_MAX_PREFIX; i ++) {
+    if (vs_prefix_lens[i] == 0) {
+      continue;
+    }
+
+    memcpy(probe, key, i);
+    probe[i] = '*';
+    probe[i + 1] = 0;
+
+    if ((w = (vswatch *)bintree_find(vs_watch_index, probe)) != NULL && w->prefix) {
+      pubsub_notify(w, key, v, &plain, &full);
+    }
+  }
+
+  vsbuf_release(&plain);
+  vsbuf_release(&full);
+
+  return ERR_SUCCESS;
+}
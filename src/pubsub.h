@@ -0,0 +1,108 @@
+#ifndef __varsvr_pubsub_h_
+
+#define __varsvr_pubsub_h_
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "./bintree.h"
+#include "./conn.h"
+#include "./typesys.h"
+#include "./vsbuf.h"
+#include "./worker.h"
+#include "./errors.h"
+
+/*
+ * Change notifications. A watch is either an exact key, or a prefix when
+ * the pattern ends in '*'. Watchers are pushed one of:
+ *
+ *   NOTIFY SET <key>\r\n
+ *   NOTIFY SET <key> <type> <bytes>\r\n<data>\r\n   (watches made with VALUES)
+ *   NOTIFY DEL <key>\r\n
+ *
+ * Each notification is encoded once and the same buffer is queued on every
+ * watching connection. Queued notifications are sent by pubsub_flush once
+ * the store lock is released. A watcher that can't be given a notification
+ * is disconnected, so that it reconnects and watches again rather than
+ * silently missing a change.
+ */
+
+/* queued output at which a watcher is judged too slow and disconnected */
+#define PUBSUB_MAX_BACKLOG (16 * CONN_HIGH_WATERMARK)
+
+/* longest prefix a prefix watch can be made on */
+#define PUBSUB_MAX_PREFIX  256
+
+/**
+ * @struct _tag_vssub
+ * @brief A connection watching a pattern
+ */
+typedef struct _tag_vssub {
+  vsconn *conn;
+  int values;             /* set when notifications carry the new value */
+} vssub;
+
+/**
+ * @struct _tag_vswatch
+ * @brief A watched pattern and the connections watching it
+ */
+typedef struct _tag_vswatch {
+  struct _tag_vswatch *next;
+
+  char *pattern;          /* the pattern as given, including any '*' */
+  unsigned int prefix_len; /* length to match on for prefix watches */
+  int prefix;             /* set for prefix watches */
+
+  vssub *subs;
+  unsigned int n_subs;
+  unsigned int cap_subs;
+} vswatch;
+
+/**
+ * Creates the watch registry
+ */
+int pubsub_init();
+
+/**
+ * Destroys the watch registry
+ */
+int pubsub_teardown();
+
+/**
+ * Registers a connection's interest in a key or key prefix
+ */
+int pubsub_watch(vsconn *c, const char *pattern, int values);
+
+/**
+ * Removes a connection's interest in a key or key prefix
+ * @returns ERR_SUCCESS, otherwise ERR_NOTFOUND when it wasn't watching
+ */
+int pubsub_unwatch(vsconn *c, const char *pattern);
+
+/**
+ * Removes every watch held by a connection
+ */
+void pubsub_unwatch_all(vsconn *c);
+
+/**
+ * Notifies watchers of a change to a key. Called with the store write lock
+ * held; the calling worker's own watchers are sent theirs by pubsub_flush
+ * @param v The new value, or NULL when the key was deleted
+ */
+int pubsub_publish(const char *key, vsval *v);
+
+/**
+ * Hands a notification to a watching connection. A connection owned by
+ * another worker has it passed through that worker's mailbox, and the
+ * owner delivers it when it drains the mailbox
+ */
+void pubsub_deliver(vsconn *c, vsbuf *b);
+
+/**
+ * Sends the notifications queued on the calling worker's watchers; called
+ * once the store lock has been released
+ */
+void pubsub_flush();
+
+#endif /* __varsvr_pubsub_h_ */
@@ -0,0 +1,516 @@
+#include "./repl.h"
+
+char *vs_repl_host = NULL;
+int vs_repl_port = 0;
+
+/* this server's mutation log, held from the first replica onwards */
+char vs_repl_id[REPL_ID_LEN + 1];
+char *vs_repl_log = NULL;
+unsigned long long vs_repl_start = 0;
+unsigned long long vs_repl_end = 0;
+unsigned int vs_repl_generation = 0;
+
+/* what a replica has applied from its primary's mutation log */
+char vs_repl_primary_id[REPL_ID_LEN + 1] = "-";
+char vs_repl_sync_id[REPL_ID_LEN + 1] = "";
+unsigned long long vs_repl_applied = 0;
+int vs_repl_in_stream = 0;
+int vs_repl_linked = 0;
+time_t vs_repl_last_attempt = 0;
+
+/**
+ * Picks a new identity for this server's mutation log
+ */
+void repl_new_id() {
+  int fd, i;
+  unsigned char raw[REPL_ID_LEN / 2];
+
+  if ((fd = open("/dev/urandom", O_RDONLY)) < 0 || read(fd, raw, sizeof(raw)) != sizeof(raw)) {
+    srandom(time(NULL) ^ getpid());
+
+    for (i = 0; i < sizeof(raw); i ++) {
+      raw[i] = random() & 0xff;
+    }
+  }
+
+  if (fd >= 0) {
+    close(fd);
+  }
+
+  for (i = 0; i < sizeof(raw); i ++) {
+    sprintf(vs_repl_id + (i * 2), "%02x", raw[i]);
+  }
+}
+
+/**
+ * Starts the replication state
+ */
+int repl_init() {
+  repl_new_id();
+
+  if (vs_repl_host) {
+    log_info("Replicating from %s:%d", vs_repl_host, vs_repl_port);
+  }
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Releases the replication state
+ */
+int repl_teardown() {
+  free(vs_repl_log);
+  vs_repl_log = NULL;
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Determines if this server is replicating from a primary
+ */
+int repl_is_replica() {
+  return vs_repl_host != NULL;
+}
+
+/**
+ * Appends raw bytes to the mutation log, overwriting the oldest
+ */
+void repl_log_write(const char *data, unsigned int len) {
+  unsigned int pos, n;
+
+  while (len > 0) {
+    pos = vs_repl_end % REPL_LOG_SIZE;
+    n = REPL_LOG_SIZE - pos;
+    n = n < len ? n : len;
+
+    memcpy(vs_repl_log + pos, data, n);
+    vs_repl_end += n;
+    data += n;
+    len -= n;
+  }
+
+  if (vs_repl_end - vs_repl_start > REPL_LOG_SIZE) {
+    vs_repl_start = vs_repl_end - REPL_LOG_SIZE;
+  }
+}
+
+/**
+ * Appends a change to a key to the mutation log
+ */
+int repl_log_change(const char *key, vsval *v) {
+  int n;
+  char header[REPL_HEADER_SIZE], scratch[64];
+  const void *data = NULL;
+  unsigned int length = 0;
+  type_desc *desc = NULL;
+
+  /* nothing is logged until a replica has asked for it */
+  if (vs_repl_log == NULL) {
+    return ERR_SUCCESS;
+  }
+
+  if (v == NULL) {
+    n = snprintf(header, sizeof(header), "DEL %s\r\n", key);
+    repl_log_write(header, n);
+    return ERR_SUCCESS;
+  }
+
+  if ((desc = lookup_type(v->type_id)) == NULL ||
+      vsval_payload(v, scratch, sizeof(scratch), &data, &length) != ERR_SUCCESS) {
+    return ERR_INVTYPE;
+  }
+
+  n = snprintf(header, sizeof(header), "SET %s %s %u\r\n", key, desc->name, length);
+  repl_log_write(header, n);
+  repl_log_write(data, length);
+  repl_log_write("\r\n", 2);
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Appends a request line that carries no change of its own
+ */
+int repl_log_line(const char *line) {
+  if (vs_repl_log != NULL) {
+    repl_log_write(line, strlen(line));
+  }
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Sends a single key of the store to a replica as a SET request, until
+ * enough is queued for the step
+ */
+int repl_snapshot_item(bintree_node **link, void *arg) {
+  int n;
+  char header[REPL_HEADER_SIZE], scratch[64];
+  const void *payload = NULL;
+  unsigned int length = 0;
+  vssnapshotstep *st = (vssnapshotstep *)arg;
+  vsval *v = (vsval *)(*link)->data;
+  type_desc *desc = lookup_type(v->type_id);
+  struct iovec iov[3];
+
+  st->last = (*link)->key;
+
+  if (desc == NULL || desc->id == 0 ||
+      vsval_payload(v, scratch, sizeof(scratch), &payload, &length) != ERR_SUCCESS) {
+    return 0;
+  }
+
+  n = snprintf(header, sizeof(header), "SET %s %s %u\r\n", (*link)->key, desc->name, length);
+
+  iov[0].iov_base = header;
+  iov[0].iov_len = n;
+  iov[1].iov_base = (void *)payload;
+  iov[1].iov_len = length;
+  iov[2].iov_base = "\r\n";
+  iov[2].iov_len = 2;
+
+  if ((st->rc = conn_writev(st->c, iov, 3)) != ERR_SUCCESS) {
+    return 1;
+  }
+
+  return ++ st->sent == REPL_SNAPSHOT_BATCH || st->c->out_bytes >= CONN_LOW_WATERMARK;
+}
+
+/**
+ * Sends a status line to a replica
+ */
+int repl_send_line(vsconn *c, const char *line) {
+  struct iovec iov;
+
+  iov.iov_base = (void *)line;
+  iov.iov_len = strlen(line);
+
+  return conn_writev(c, &iov, 1);
+}
+
+/**
+ * Starts sending a replica the whole store, followed by the log from the
+ * offset it was at when the store started going out
+ */
+int repl_send_store(vsconn *c) {
+  char line[64];
+
+  log_info("Replica on fd %d needs a full sync at offset %llu", c->fd, vs_repl_end);
+
+  c->repl_offset = vs_repl_end;
+  c->repl_generation = vs_repl_generation;
+  c->repl_snapshot = 1;
+  free(c->repl_cursor);
+  c->repl_cursor = NULL;
+
+  snprintf(line, sizeof(line), "FULLSYNC %s\r\n", vs_repl_id);
+
+  return repl_send_line(c, line);
+}
+
+/**
+ * Sends a replica the next part of the store. Keys changed meanwhile are
+ * sent again from the log, so the replica ends up with the store as it
+ * is by the time it streams
+ */
+int repl_send_store_step(vsconn *c) {
+  char line[64], *cursor = NULL;
+  vssnapshotstep st;
+
+  memset(&st, 0, sizeof(st));
+  st.c = c;
+
+  if (store_walk_links(c->repl_cursor, repl_snapshot_item, &st) == 0) {
+    free(c->repl_cursor);
+    c->repl_cursor = NULL;
+    c->repl_snapshot = 0;
+
+    snprintf(line, sizeof(line), "STREAM %llu\r\n", c->repl_offset);
+
+    return repl_send_line(c, line);
+  }
+
+  if (st.rc != ERR_SUCCESS) {
+    return st.rc;
+  }
+
+  if ((cursor = strdup(st.last)) == NULL) {
+    return ERR_NOMEM;
+  }
+
+  free(c->repl_cursor);
+  c->repl_cursor = cursor;
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * SYNC <replid>|- <offset>; attaches a client as a replica
+ */
+int repl_sync(vsconn *c, const char *replid, const char *offset) {
+  char line[64];
+  char *end = NULL;
+  unsigned long long off = strtoull(offset, &end, 10);
+
+  if (*end != 0) {
+    return ERR_BADREQ;
+  }
+
+  /* start logging mutations now that somebody wants them */
+  if (vs_repl_log == NULL) {
+    if ((vs_repl_log = (char *)malloc(REPL_LOG_SIZE)) == NULL) {
+      log_error("Unable to allocate the mutation log");
+      return ERR_NOMEM;
+    }
+
+    vs_repl_start = vs_repl_end;
+  }
+
+  c->downstream = 1;
+
+  if (strcmp(replid, vs_repl_id) == 0 && off >= vs_repl_start && off <= vs_repl_end) {
+    log_info("Replica on fd %d resuming from offset %llu", c->fd, off);
+
+    c->repl_offset = off;
+    c->repl_generation = vs_repl_generation;
+    snprintf(line, sizeof(line), "STREAM %llu\r\n", off);
+
+    return repl_send_line(c, line);
+  }
+
+  /* the store itself goes out over the next passes of the event loop */
+  return repl_send_store(c);
+}
+
+/**
+ * Sends logged mutations a replica hasn't been sent yet
+ */
+int repl_pump(vsconn *c) {
+  int n = 0;
+  unsigned int pos, len;
+  unsigned long long pending;
+  struct iovec iov[2];
+
+  /* let earlier output drain first, so a slow replica batches up more */
+  if (c->out_head || c->connecting) {
+    return ERR_SUCCESS;
+  }
+
+  /* the log it was following has been started over, so it needs the
+   * store again */
+  if (c->repl_generation != vs_repl_generation && repl_send_store(c) != ERR_SUCCESS) {
+    c->closing = 1;
+    return ERR_CONNIO;
+  }
+
+  if (c->repl_offset < vs_repl_start) {
+    log_warn("Replica on fd %d fell behind the mutation log", c->fd);
+    c->closing = 1;
+    return ERR_CONNIO;
+  }
+
+  /* the store goes out a step at a time, only as fast as it's taken */
+  if (c->repl_snapshot) {
+    if (c->out_head == NULL && repl_send_store_step(c) != ERR_SUCCESS) {
+      c->closing = 1;
+      return ERR_CONNIO;
+    }
+
+    return ERR_SUCCESS;
+  }
+
+  if (c->repl_offset == vs_repl_end) {
+    return ERR_SUCCESS;
+  }
+
+  /* the pending range may wrap around the end of the ring */
+  pending = vs_repl_end - c->repl_offset;
+  pos = c->repl_offset % REPL_LOG_SIZE;
+  len = REPL_LOG_SIZE - pos;
+  len = len < pending ? len : pending;
+
+  iov[n].iov_base = vs_repl_log + pos;
+  iov[n ++].iov_len = len;
+
+  if (len < pending) {
+    iov[n].iov_base = vs_repl_log;
+    iov[n ++].iov_len = pending - len;
+  }
+
+  c->repl_offset = vs_repl_end;
+
+  if (conn_writev(c, iov, n) != ERR_SUCCESS) {
+    c->closing = 1;
+    return ERR_CONNIO;
+  }
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * FULLSYNC <replid>; the primary is about to send its whole store
+ */
+int repl_fullsync(vsconn *c, const char *replid) {
+  if (!c->upstream || strlen(replid) > REPL_ID_LEN) {
+    return ERR_BADREQ;
+  }
+
+  log_info("Full sync from primary %s", replid);
+
+  /* the primary's identity is only taken on once the whole store has
+   * arrived; should the link go before then, the next sync starts over */
+  strcpy(vs_repl_sync_id, replid);
+  strcpy(vs_repl_primary_id, "-");
+  vs_repl_in_stream = 0;
+
+  if (store_clear() != ERR_SUCCESS) {
+    return ERR_NOMEM;
+  }
+
+  /* this server's own log no longer describes its store. It starts over
+   * under a new identity, and replicas following it are sent the store
+   * again */
+  repl_new_id();
+  vs_repl_start = vs_repl_end;
+  vs_repl_generation ++;
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * STREAM <offset>; the primary's mutation log follows from this offset
+ */
+int repl_stream(vsconn *c, const char *offset) {
+  char *end = NULL;
+  unsigned long long off = strtoull(offset, &end, 10);
+
+  if (!c->upstream || *end != 0) {
+    return ERR_BADREQ;
+  }
+
+  if (vs_repl_sync_id[0]) {
+    strcpy(vs_repl_primary_id, vs_repl_sync_id);
+    vs_repl_sync_id[0] = 0;
+  }
+
+  log_info("Streaming from primary %s at offset %llu", vs_repl_primary_id, off);
+
+  vs_repl_applied = off;
+  vs_repl_in_stream = 1;
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Determines if bytes arriving on a connection are part of the primary's
+ * mutation log
+ */
+int repl_streaming(vsconn *c) {
+  return c->upstream && vs_repl_in_stream;
+}
+
+/**
+ * Accounts for mutation log bytes that have been applied
+ */
+void repl_applied(unsigned int n) {
+  vs_repl_applied += n;
+}
+
+/**
+ * Starts a connection to the primary when one is due
+ */
+vsconn* repl_connect() {
+  int fd = -1, rc, on = 1;
+  char port[16], line[64];
+  time_t now = time(NULL);
+  struct addrinfo hints, *res = NULL;
+  struct iovec iov;
+  vsconn *c = NULL;
+
+  if (!repl_is_replica() || vs_repl_linked || now - vs_repl_last_attempt < REPL_RETRY_INTERVAL) {
+    return NULL;
+  }
+
+  vs_repl_last_attempt = now;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  snprintf(port, sizeof(port), "%d", vs_repl_port);
+
+  if ((rc = getaddrinfo(vs_repl_host, port, &hints, &res)) != 0) {
+    log_error("Unable to resolve primary %s (%s)", vs_repl_host, gai_strerror(rc));
+    return NULL;
+  }
+
+  if ((fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol)) < 0 ||
+      ioctl(fd, FIONBIO, (char *)&on) < 0 ||
+      ((rc = connect(fd, res->ai_addr, res->ai_addrlen)) < 0 && errno != EINPROGRESS) ||
+      (c = conn_create(fd)) == NULL) {
+    log_error("Unable to connect to primary (errno=%d)", errno);
+    freeaddrinfo(res);
+
+    if (fd >= 0) {
+      close(fd);
+    }
+
+    return NULL;
+  }
+
+  freeaddrinfo(res);
+
+  c->upstream = 1;
+  c->connecting = (rc < 0);
+
+  /* the request is queued until the connect completes */
+  snprintf(line, sizeof(line), "SYNC %s %llu\r\n", vs_repl_primary_id, vs_repl_applied);
+  iov.iov_base = line;
+  iov.iov_len = strlen(line);
+
+  if (conn_writev(c, &iov, 1) != ERR_SUCCESS) {
+    conn_destroy(&c);
+    return NULL;
+  }
+
+  vs_repl_linked = 1;
+
+  return c;
+}
+
+/**
+ * Notes that the link to the primary has gone
+ */
+void repl_upstream_lost() {
+  log_warn("Lost the link to primary %s:%d at offset %llu",
+           vs_repl_host, vs_repl_port, vs_repl_applied);
+
+  vs_repl_linked = 0;
+  vs_repl_in_stream = 0;
+  vs_repl_sync_id[0] = 0;
+}
+
+/**
+ * Works out how long the event loop may sleep for
+ */
+int repl_poll_timeout(int timeout) {
+  int retry = REPL_RETRY_INTERVAL * 1000;
+
+  if (repl_is_replica() && !vs_repl_linked && timeout > retry) {
+    return retry;
+  }
+
+  return timeout;
+}
+
+/**
+ * Works out how long the event loop may sleep for, given a replica that
+ * may be part way through being sent the store
+ */
+int repl_conn_poll_timeout(vsconn *c, int timeout) {
+  /* with nothing queued, no write will wake the loop for the next step */
+  if (c->downstream && c->repl_snapshot && !c->out_head && !c->closing) {
+    return 0;
+  }
+
+  return timeout;
+}
@@ -0,0 +1,154 @@
+#ifndef __varsvr_repl_h_
+
+#define __varsvr_repl_h_
+
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "./conn.h"
+#include "./store.h"
+#include "./typesys.h"
+#include "./log.h"
+#include "./errors.h"
+
+/*
+ * Primary/replica replication. Every mutation a server applies is encoded
+ * as the request that makes it and appended to a ring buffered mutation
+ * log, addressed by byte offset. A replica connects to its primary and
+ * asks to carry on from the last offset it applied:
+ *
+ *   SYNC <replid>|- <offset>
+ *
+ * When the primary still holds the log from that offset it answers with
+ *
+ *   STREAM <offset>\r\n<mutations...>
+ *
+ * otherwise it sends its whole store first:
+ *
+ *   FULLSYNC <replid>\r\n<SET requests...>STREAM <offset>\r\n<mutations...>
+ *
+ * The store goes out a step at a time, each step only once the replica
+ * has taken the last, and the log streams from the offset at which the
+ * store started going out. A replica that is itself followed by others
+ * starts its own log over on a full sync, and sends them the store again.
+ *
+ * Mutations are batched: whatever was logged during a pass of the event
+ * loop goes to each replica in a single write, and replicas never answer
+ * them, so the stream is fully pipelined.
+ */
+
+#define REPL_LOG_SIZE       (16 * 1024 * 1024)
+#define REPL_ID_LEN         16
+#define REPL_RETRY_INTERVAL 1
+
+/* room for a request line carrying the longest key */
+#define REPL_HEADER_SIZE    320
+
+/* most keys of the store sent to a replica in a step */
+#define REPL_SNAPSHOT_BATCH 1024
+
+/**
+ * @struct _tag_vssnapshotstep
+ * @brief Progress through a step of sending a replica the store
+ */
+typedef struct _tag_vssnapshotstep {
+  vsconn *c;
+  const char *last;       /* key visited last */
+  unsigned int sent;      /* keys sent */
+  int rc;                 /* set when the replica couldn't be written to */
+} vssnapshotstep;
+
+extern char *vs_repl_host;
+extern int vs_repl_port;
+
+/**
+ * Starts the replication state; the server is a replica when a primary
+ * has been configured
+ */
+int repl_init();
+
+/**
+ * Releases the replication state
+ */
+int repl_teardown();
+
+/**
+ * Determines if this server is replicating from a primary
+ */
+int repl_is_replica();
+
+/**
+ * Appends a change to a key to the mutation log
+ * @param v The new value, or NULL when the key was deleted
+ */
+int repl_log_change(const char *key, vsval *v);
+
+/**
+ * Appends a request line that carries no change of its own, such as the
+ * MULTI and EXEC around a transaction
+ */
+int repl_log_line(const char *line);
+
+/**
+ * SYNC <replid>|- <offset>; attaches a client as a replica
+ */
+int repl_sync(vsconn *c, const char *replid, const char *offset);
+
+/**
+ * Sends logged mutations a replica hasn't been sent yet
+ */
+int repl_pump(vsconn *c);
+
+/**
+ * FULLSYNC <replid>; the primary is about to send its whole store
+ */
+int repl_fullsync(vsconn *c, const char *replid);
+
+/**
+ * STREAM <offset>; the primary's mutation log follows from this offset
+ */
+int repl_stream(vsconn *c, const char *offset);
+
+/**
+ * Determines if bytes arriving on a connection are part of the primary's
+ * mutation log
+ */
+int repl_streaming(vsconn *c);
+
+/**
+ * Accounts for mutation log bytes that have been applied
+ */
+void repl_applied(unsigned int n);
+
+/**
+ * Starts a connection to the primary when one is due
+ * @returns The connection, otherwise NULL
+ */
+vsconn* repl_connect();
+
+/**
+ * Notes that the link to the primary has gone
+ */
+void repl_upstream_lost();
+
+/**
+ * Works out how long the event loop may sleep for
+ */
+int repl_poll_timeout(int timeout);
+
+/**
+ * Works out how long the event loop may sleep for, given a replica that
+ * may be part way through being sent the store
+ */
+int repl_conn_poll_timeout(vsconn *c, int timeout);
+
+#endif /* __varsvr_repl_h_ */
@@ -0,0 +1,96 @@
+#include "./shm.h"
+
+/**
+ * Creates a shared memory channel for a unix domain socket client
+ */
+int shm_attach(vsconn *c) {
+  int memfd = -1, srv_fd = -1, cli_fd = -1, fds[3], rc = ERR_NOMEM;
+  char line[64];
+  size_t size = shmring_segment_size(SHMRING_SIZE);
+  shmseg *seg = MAP_FAILED;
+  vsconn *sc = NULL;
+
+  if (!c->local || c->shm || c->link) {
+    return ERR_BADREQ;
+  }
+
+  /* the answer can't overtake replies to pipelined requests, so those
+   * go first, and if the socket won't take them nothing is created */
+  if (c->out_head && conn_flush(c) != ERR_SUCCESS) {
+    return ERR_CONNIO;
+  } else if (c->out_head) {
+    return ERR_PENDING;
+  }
+
+  if ((memfd = memfd_create("var-server", MFD_CLOEXEC)) < 0 ||
+      ftruncate(memfd, size) < 0 ||
+      (seg = (shmseg *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0)) == MAP_FAILED ||
+      (srv_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0 ||
+      (cli_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0 ||
+      (sc = conn_create(srv_fd)) == NULL ||
+      (sc->shm = (shmlink *)malloc(sizeof(shmlink))) == NULL) {
+    log_error("Unable to create shared memory channel (errno=%d)", errno);
+    goto fail;
+  }
+
+  /* the link takes the layout as formatted, before the client can see it */
+  shmring_format(seg, SHMRING_SIZE);
+  shmlink_init(sc->shm, seg, size, 1, srv_fd, cli_fd);
+
+  fds[0] = memfd;
+  fds[1] = cli_fd;
+  fds[2] = srv_fd;
+  snprintf(line, sizeof(line), "SHM %zu\r\n", size);
+
+  if ((rc = conn_send_fds(c, line, strlen(line), fds, 3)) != ERR_SUCCESS) {
+    goto fail;
+  }
+
+  /* the mapping keeps the segment alive from here */
+  close(memfd);
+
+  sc->local = 1;
+  sc->link = c;
+  c->link = sc;
+
+  /* the socket's owner picks the channel up on its next pass */
+  if (worker_adopt(c->worker, sc) != ERR_SUCCESS) {
+    log_error("Unable to hand over shared memory channel for fd %d", c->fd);
+    c->link = NULL;
+    c->closing = 1;
+    conn_destroy(&sc);
+    return ERR_SUCCESS;
+  }
+
+  log_info("Shared memory channel opened for fd %d", c->fd);
+
+  return ERR_SUCCESS;
+
+fail:
+  if (sc && sc->shm) {
+    /* the link owns the mapping and both doorbells now */
+    conn_destroy(&sc);
+    seg = MAP_FAILED;
+    srv_fd = cli_fd = -1;
+  } else if (sc) {
+    free(sc);
+  }
+
+  if (seg != MAP_FAILED) {
+    munmap(seg, size);
+  }
+
+  if (memfd >= 0) {
+    close(memfd);
+  }
+
+  if (srv_fd >= 0) {
+    close(srv_fd);
+  }
+
+  if (cli_fd >= 0) {
+    close(cli_fd);
+  }
+
+  return rc;
+}
@@ -0,0 +1,46 @@
+#ifndef __varsvr_shm_h_
+
+#define __varsvr_shm_h_
+
+/* memfd_create */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+
+#include "./conn.h"
+#include "./shmring.h"
+#include "./worker.h"
+#include "./log.h"
+#include "./errors.h"
+
+/*
+ * Server side of the shared memory transport. A client on the unix domain
+ * socket sends SHM and is answered with
+ *
+ *   SHM <segment-bytes>\r\n
+ *
+ * carrying three descriptors: the segment (a memfd), the client's doorbell
+ * and the server's doorbell. From then on the client talks the ordinary
+ * protocol through the segment's rings (see shmring.h); closing the socket
+ * closes the channel.
+ */
+
+/**
+ * Creates a shared memory channel for a unix domain socket client; the
+ * channel joins the event loop that owns the socket
+ * @returns ERR_SUCCESS, ERR_PENDING when replies the client hasn't read
+ *          yet are still queued, otherwise ERR_BADREQ when the client
+ *          can't have a channel
+ */
+int shm_attach(vsconn *c);
+
+#endif /* __varsvr_shm_h_ */
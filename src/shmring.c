@@ -0,0 +1,273 @@
+#include "./shmring.h"
+
+/**
+ * Rounds a length up to a whole cache line
+ */
+size_t shmring_align(size_t n) {
+  return (n + SHMRING_LINE - 1) & ~((size_t)SHMRING_LINE - 1);
+}
+
+/**
+ * Works out the length of a segment with rings of the given size
+ */
+size_t shmring_segment_size(uint32_t ring_size) {
+  return shmring_align(sizeof(shmseg)) + 2 * (size_t)ring_size;
+}
+
+/**
+ * Lays out a freshly mapped segment
+ */
+void shmring_format(shmseg *seg, uint32_t ring_size) {
+  size_t base = shmring_align(sizeof(shmseg));
+
+  memset(seg, 0, sizeof(shmseg));
+
+  seg->magic = SHMRING_MAGIC;
+  seg->version = SHMRING_VERSION;
+
+  seg->req.size = ring_size;
+  seg->req.data_off = base;
+  seg->resp.size = ring_size;
+  seg->resp.data_off = base + ring_size;
+
+  /* the server sleeps in its event loop, so clients always ring it */
+  atomic_store(&seg->req.consumer_waiting, 1);
+}
+
+/**
+ * Reads a field the peer may be changing, exactly once
+ */
+uint32_t shmring_read(const uint32_t *field) {
+  return *(const volatile uint32_t *)field;
+}
+
+/**
+ * Checks that a ring's layout fits within the segment
+ */
+int shmring_validate_layout(uint32_t ring_size, uint32_t data_off, size_t size) {
+  if (ring_size == 0 || (ring_size & (ring_size - 1)) != 0) {
+    return -1;
+  }
+
+  if (data_off < sizeof(shmseg) || data_off > size || size - data_off < ring_size) {
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * Checks that a ring control block fits within the segment
+ */
+int shmring_validate_ring(shmring *r, size_t size) {
+  return shmring_validate_layout(shmring_read(&r->size), shmring_read(&r->data_off), size);
+}
+
+/**
+ * Checks that a mapped segment has a layout this code understands
+ */
+int shmring_validate(shmseg *seg, size_t size) {
+  if (size < sizeof(shmseg) || seg->magic != SHMRING_MAGIC || seg->version != SHMRING_VERSION) {
+    return -1;
+  }
+
+  if (shmring_validate_ring(&seg->req, size) != 0 || shmring_validate_ring(&seg->resp, size) != 0) {
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * Sets up one side's view of a mapped segment
+ */
+int shmlink_init(shmlink *l, shmseg *seg, size_t size, int server, int wait_fd, int wake_fd) {
+  shmring *tx = server ? &seg->resp : &seg->req;
+  shmring *rx = server ? &seg->req : &seg->resp;
+  uint32_t tx_size = shmring_read(&tx->size), tx_off = shmring_read(&tx->data_off);
+  uint32_t rx_size = shmring_read(&rx->size), rx_off = shmring_read(&rx->data_off);
+
+  /* what's checked is what's kept, whatever the segment says later */
+  if (shmring_validate_layout(tx_size, tx_off, size) != 0 ||
+      shmring_validate_layout(rx_size, rx_off, size) != 0) {
+    return -1;
+  }
+
+  l->seg = seg;
+  l->size = size;
+  l->tx = tx;
+  l->rx = rx;
+  l->tx_data = (char *)seg + tx_off;
+  l->rx_data = (char *)seg + rx_off;
+  l->tx_size = tx_size;
+  l->rx_size = rx_size;
+  l->wait_fd = wait_fd;
+  l->wake_fd = wake_fd;
+
+  return 0;
+}
+
+/**
+ * Copies bytes into the ring this side produces into, at a free running
+ * position
+ */
+void shmring_copy_in(shmlink *l, uint32_t pos, const char *data, size_t len) {
+  char *base = l->tx_data;
+  uint32_t off = pos & (l->tx_size - 1);
+  size_t n = l->tx_size - off;
+
+  n = n < len ? n : len;
+
+  memcpy(base + off, data, n);
+  memcpy(base, data + n, len - n);
+}
+
+/**
+ * Works out the room left in the ring this side produces into; a consumer
+ * that claims to have read more than was produced leaves none
+ */
+size_t shmlink_room(shmlink *l, uint32_t head, uint32_t tail) {
+  uint32_t used = head - tail;
+
+  return used <= l->tx_size ? l->tx_size - used : 0;
+}
+
+/**
+ * Produces as much of a set of buffers as the ring has room for
+ */
+size_t shmlink_send(shmlink *l, const struct iovec *iov, int iovcnt) {
+  shmring *r = l->tx;
+  uint32_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+  uint32_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+  size_t n, room, off = 0, total = 0;
+
+  while (iovcnt > 0) {
+    room = shmlink_room(l, head, tail);
+
+    /* out of room; say so, then look again in case the consumer freed
+     * some in the meantime and won't know to ring */
+    if (room == 0) {
+      atomic_store(&r->producer_waiting, 1);
+      tail = atomic_load(&r->tail);
+
+      if (shmlink_room(l, head, tail) == 0) {
+        break;
+      }
+
+      atomic_store(&r->producer_waiting, 0);
+      continue;
+    }
+
+    n = iov->iov_len - off;
+    n = n < room ? n : room;
+
+    shmring_copy_in(l, head, (const char *)iov->iov_base + off, n);
+    head += n;
+    total += n;
+    off += n;
+
+    if (off == iov->iov_len) {
+      iov ++;
+      iovcnt --;
+      off = 0;
+    }
+  }
+
+  if (total > 0) {
+    atomic_store(&r->head, head);
+
+    if (atomic_load(&r->consumer_waiting)) {
+      shmlink_ring(l);
+    }
+  }
+
+  return total;
+}
+
+/**
+ * Consumes up to len bytes
+ */
+size_t shmlink_recv(shmlink *l, void *buf, size_t len) {
+  shmring *r = l->rx;
+  char *base = l->rx_data;
+  uint32_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+  uint32_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+  uint32_t off = tail & (l->rx_size - 1);
+  size_t n, avail = head - tail;
+
+  /* a corrupt or hostile peer mustn't walk us out of the ring */
+  if (avail > l->rx_size) {
+    return 0;
+  }
+
+  len = len < avail ? len : avail;
+
+  if (len == 0) {
+    return 0;
+  }
+
+  n = l->rx_size - off;
+  n = n < len ? n : len;
+
+  memcpy(buf, base + off, n);
+  memcpy((char *)buf + n, base, len - n);
+
+  atomic_store(&r->tail, tail + len);
+
+  if (atomic_load(&r->producer_waiting)) {
+    atomic_store(&r->producer_waiting, 0);
+    shmlink_ring(l);
+  }
+
+  return len;
+}
+
+/**
+ * Determines the number of bytes waiting to be consumed
+ */
+uint32_t shmlink_pending(shmlink *l) {
+  uint32_t pending = atomic_load_explicit(&l->rx->head, memory_order_acquire) -
+                     atomic_load_explicit(&l->rx->tail, memory_order_relaxed);
+
+  return pending < l->rx_size ? pending : l->rx_size;
+}
+
+/**
+ * Clears this side's doorbell
+ */
+void shmlink_clear(shmlink *l) {
+  uint64_t count;
+
+  while (read(l->wait_fd, &count, sizeof(count)) < 0 && errno == EINTR);
+}
+
+/**
+ * Rings the peer's doorbell
+ */
+void shmlink_ring(shmlink *l) {
+  uint64_t one = 1;
+
+  while (write(l->wake_fd, &one, sizeof(one)) < 0 && errno == EINTR);
+}
+
+/**
+ * Marks the segment closed, wakes the peer and releases this side's view
+ */
+void shmlink_close(shmlink *l) {
+  if (l->seg) {
+    atomic_store(&l->seg->closed, 1);
+    shmlink_ring(l);
+    munmap(l->seg, l->size);
+    l->seg = NULL;
+  }
+
+  if (l->wait_fd >= 0) {
+    close(l->wait_fd);
+    l->wait_fd = -1;
+  }
+
+  if (l->wake_fd >= 0) {
+    close(l->wake_fd);
+    l->wake_fd = -1;
+  }
+}
@@ -0,0 +1,147 @@
+#ifndef __varsvr_shmring_h_
+
+#define __varsvr_shmring_h_
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+/*
+ * Shared memory transport for clients on the same host. A segment holds
+ * two single producer/single consumer byte rings carrying the ordinary
+ * request/reply protocol: requests flow client to server, replies and
+ * notifications flow back. Each side has an eventfd doorbell. A producer
+ * only rings its peer when the peer has said it is going to sleep, and a
+ * consumer only rings a producer that has said it is waiting for room.
+ *
+ * Layout: shmseg header, then the request ring's bytes at req.data_off and
+ * the reply ring's bytes at resp.data_off, all offsets from the segment.
+ *
+ * The peer can write to the whole segment at any time, so a ring's size and
+ * offset are read from it once, checked, and kept in the link; only the
+ * peer's counter is read from the segment after that, and never trusted to
+ * be more than a ring's worth ahead.
+ */
+
+#define SHMRING_MAGIC       0x7673686d
+#define SHMRING_VERSION     1
+#define SHMRING_SIZE        (1024 * 1024)
+#define SHMRING_LINE        64
+
+/**
+ * @struct _tag_shmring
+ * @brief Control block of a single ring. Head and tail are free running
+ *        byte counters; each is written by one side only
+ */
+typedef struct _tag_shmring {
+  _Atomic uint32_t head;                /* written by the producer */
+  char pad0[SHMRING_LINE - sizeof(uint32_t)];
+
+  _Atomic uint32_t tail;                /* written by the consumer */
+  char pad1[SHMRING_LINE - sizeof(uint32_t)];
+
+  _Atomic uint32_t consumer_waiting;    /* consumer wants a ring on new data */
+  _Atomic uint32_t producer_waiting;    /* producer wants a ring on free room */
+  uint32_t size;                        /* ring capacity; a power of two */
+  uint32_t data_off;                    /* offset of the ring's bytes */
+  char pad2[SHMRING_LINE - 4 * sizeof(uint32_t)];
+} shmring;
+
+/**
+ * @struct _tag_shmseg
+ * @brief Header at the start of a shared segment
+ */
+typedef struct _tag_shmseg {
+  uint32_t magic;
+  uint32_t version;
+  _Atomic uint32_t closed;              /* set by whichever side leaves first */
+  char pad0[SHMRING_LINE - 3 * sizeof(uint32_t)];
+
+  shmring req;                          /* client to server */
+  shmring resp;                         /* server to client */
+} shmseg;
+
+/**
+ * @struct _tag_shmlink
+ * @brief One side's view of a mapped segment
+ */
+typedef struct _tag_shmlink {
+  shmseg *seg;
+  size_t size;                          /* mapped length */
+
+  shmring *tx;                          /* ring this side produces into */
+  shmring *rx;                          /* ring this side consumes from */
+
+  char *tx_data;                        /* the rings' bytes and sizes, as */
+  char *rx_data;                        /* checked when the link was set up */
+  uint32_t tx_size;
+  uint32_t rx_size;
+
+  int wait_fd;                          /* this side's doorbell */
+  int wake_fd;                          /* the peer's doorbell */
+} shmlink;
+
+/**
+ * Works out the length of a segment with rings of the given size
+ */
+size_t shmring_segment_size(uint32_t ring_size);
+
+/**
+ * Lays out a freshly mapped segment
+ */
+void shmring_format(shmseg *seg, uint32_t ring_size);
+
+/**
+ * Checks that a mapped segment has a layout this code understands
+ * @returns 0 when the segment is usable, otherwise -1
+ */
+int shmring_validate(shmseg *seg, size_t size);
+
+/**
+ * Sets up one side's view of a mapped segment, taking its rings' layout
+ * from the segment once and checking it
+ * @param server Non-zero for the server's side, which consumes requests
+ * @returns 0 when the layout is usable, otherwise -1
+ */
+int shmlink_init(shmlink *l, shmseg *seg, size_t size, int server, int wait_fd, int wake_fd);
+
+/**
+ * Produces as much of a set of buffers as the ring has room for, ringing
+ * the peer if it's asleep
+ * @returns The number of bytes written
+ */
+size_t shmlink_send(shmlink *l, const struct iovec *iov, int iovcnt);
+
+/**
+ * Consumes up to len bytes, ringing the peer if it's waiting for room
+ * @returns The number of bytes read
+ */
+size_t shmlink_recv(shmlink *l, void *buf, size_t len);
+
+/**
+ * Determines the number of bytes waiting to be consumed, which is never
+ * more than the ring holds
+ */
+uint32_t shmlink_pending(shmlink *l);
+
+/**
+ * Clears this side's doorbell
+ */
+void shmlink_clear(shmlink *l);
+
+/**
+ * Rings the peer's doorbell
+ */
+void shmlink_ring(shmlink *l);
+
+/**
+ * Marks the segment closed, wakes the peer and releases this side's view
+ */
+void shmlink_close(shmlink *l);
+
+#endif /* __varsvr_shmring_h_ */
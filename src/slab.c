@@ -0,0 +1,306 @@
+#include "./slab.h"
+
+vsslabclass vs_slab_classes[SLAB_CLASSES];
+
+/* every slab, found by its address; open addressed, with linear probing */
+vsslab **vs_slab_table = NULL;
+unsigned int vs_slab_table_size = 0;
+unsigned int vs_n_slabs = 0;
+
+/**
+ * Finds the table position for a slab's address
+ */
+unsigned int slab_hash(const void *base) {
+  return (unsigned int)((((uintptr_t)base >> SLAB_SHIFT) * 0x9e3779b97f4a7c15ULL) >> 32) &
+         (vs_slab_table_size - 1);
+}
+
+/**
+ * Adds a slab to the table, growing it to keep it no more than half full
+ */
+int slab_register(vsslab *s) {
+  unsigned int i, size = vs_slab_table_size, n;
+  vsslab **old = vs_slab_table;
+
+  if ((vs_n_slabs + 1) * 2 > size) {
+    n = size ? size * 2 : 64;
+
+    if ((vs_slab_table = (vsslab **)calloc(n, sizeof(vsslab *))) == NULL) {
+      vs_slab_table = old;
+      return ERR_NOMEM;
+    }
+
+    vs_slab_table_size = n;
+
+    for (i = 0; i < size; i ++) {
+      if (old[i]) {
+        for (n = slab_hash(old[i]); vs_slab_table[n]; n = (n + 1) & (vs_slab_table_size - 1));
+        vs_slab_table[n] = old[i];
+      }
+    }
+
+    free(old);
+  }
+
+  for (i = slab_hash(s); vs_slab_table[i]; i = (i + 1) & (vs_slab_table_size - 1));
+  vs_slab_table[i] = s;
+  vs_n_slabs ++;
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Finds the slab an object was allocated from
+ * @returns The slab, otherwise NULL for an object on the heap
+ */
+vsslab* slab_lookup(const void *p) {
+  unsigned int i;
+  vsslab *base = (vsslab *)((uintptr_t)p & ~((uintptr_t)SLAB_SIZE - 1));
+
+  if (vs_slab_table == NULL) {
+    return NULL;
+  }
+
+  for (i = slab_hash(base); vs_slab_table[i]; i = (i + 1) & (vs_slab_table_size - 1)) {
+    if (vs_slab_table[i] == base) {
+      return base;
+    }
+  }
+
+  return NULL;
+}
+
+/**
+ * Removes a slab from the table, moving back any entries that probed past
+ * its position so that they can still be found
+ */
+void slab_unregister(vsslab *s) {
+  unsigned int i, j, h, mask = vs_slab_table_size - 1;
+
+  for (i = slab_hash(s); vs_slab_table[i] != s; i = (i + 1) & mask);
+
+  vs_slab_table[i] = NULL;
+  vs_n_slabs --;
+
+  for (j = (i + 1) & mask; vs_slab_table[j]; j = (j + 1) & mask) {
+    h = slab_hash(vs_slab_table[j]);
+
+    /* an entry stays unless the hole lies between its home and itself */
+    if (((j - h) & mask) >= ((j - i) & mask)) {
+      vs_slab_table[i] = vs_slab_table[j];
+      vs_slab_table[j] = NULL;
+      i = j;
+    }
+  }
+}
+
+/**
+ * Maps a block for a slab, aligned to its size
+ */
+void* slab_map() {
+  char *p = NULL, *base = NULL;
+
+  /* twice the size is mapped so that an aligned block lies within it, and
+   * whatever lies either side of the block is unmapped again */
+  p = (char *)mmap(NULL, 2 * SLAB_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  if (p == MAP_FAILED) {
+    return NULL;
+  }
+
+  base = (char *)(((uintptr_t)p + SLAB_SIZE - 1) & ~((uintptr_t)SLAB_SIZE - 1));
+
+  if (base > p) {
+    munmap(p, base - p);
+  }
+
+  munmap(base + SLAB_SIZE, p + SLAB_SIZE - base);
+
+  return base;
+}
+
+/**
+ * Releases every slab
+ */
+int slab_teardown() {
+  unsigned int i;
+
+  for (i = 0; i < vs_slab_table_size; i ++) {
+    if (vs_slab_table[i]) {
+      munmap(vs_slab_table[i], SLAB_SIZE);
+    }
+  }
+
+  free(vs_slab_table);
+  vs_slab_table = NULL;
+  vs_slab_table_size = vs_n_slabs = 0;
+  memset(vs_slab_classes, 0, sizeof(vs_slab_classes));
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Creates an empty slab for a size class
+ */
+vsslab* slab_create(vsslabclass *cls, unsigned int size) {
+  vsslab *s = (vsslab *)slab_map();
+
+  if (s == NULL) {
+    return NULL;
+  }
+
+  s->size = size;
+  s->capacity = (SLAB_SIZE - SLAB_HEADER) / size;
+
+  if (slab_register(s) != ERR_SUCCESS) {
+    munmap(s, SLAB_SIZE);
+    return NULL;
+  }
+
+  if ((s->next = cls->slabs) != NULL) {
+    s->next->prev = s;
+  }
+
+  cls->slabs = s;
+  cls->n_slabs ++;
+  cls->free_objects += s->capacity;
+
+  return s;
+}
+
+/**
+ * Picks the slab a class allocates from next: the fullest with room, so
+ * that emptier slabs are left to drain
+ */
+vsslab* slab_pick(vsslabclass *cls) {
+  vsslab *s = NULL, *best = NULL;
+
+  for (s = cls->slabs; s; s = s->next) {
+    if (s->used < s->capacity && (best == NULL || s->used > best->used)) {
+      best = s;
+    }
+  }
+
+  return best;
+}
+
+/**
+ * Allocates an object
+ */
+void* slab_alloc(size_t size) {
+  unsigned int c;
+  void *p = NULL;
+  vsslab *s = NULL;
+  vsslabclass *cls = NULL;
+
+  if (size > SLAB_MAX_OBJECT) {
+    return malloc(size);
+  }
+
+  c = size ? (unsigned int)(size - 1) / SLAB_ALIGN : 0;
+  cls = &vs_slab_classes[c];
+
+  if ((s = cls->current) == NULL || s->used == s->capacity) {
+    if ((s = slab_pick(cls)) == NULL && (s = slab_create(cls, (c + 1) * SLAB_ALIGN)) == NULL) {
+      return NULL;
+    }
+
+    cls->current = s;
+  }
+
+  if (s->free) {
+    p = s->free;
+    s->free = *(void **)p;
+  } else {
+    p = (char *)s + SLAB_HEADER + (size_t)s->carved ++ * s->size;
+  }
+
+  s->used ++;
+  cls->free_objects --;
+
+  return p;
+}
+
+/**
+ * Frees an object allocated by slab_alloc or by malloc
+ */
+void slab_free(void *p) {
+  vsslab *s = NULL;
+  vsslabclass *cls = NULL;
+
+  if (p == NULL) {
+    return;
+  }
+
+  if ((s = slab_lookup(p)) == NULL) {
+    free(p);
+    return;
+  }
+
+  cls = &vs_slab_classes[s->size / SLAB_ALIGN - 1];
+  *(void **)p = s->free;
+  s->free = p;
+  s->used --;
+  cls->free_objects ++;
+
+  if (s->used > 0) {
+    return;
+  }
+
+  /* an empty slab goes back to the system straight away */
+  if (s->prev) {
+    s->prev->next = s->next;
+  } else {
+    cls->slabs = s->next;
+  }
+
+  if (s->next) {
+    s->next->prev = s->prev;
+  }
+
+  if (cls->current == s) {
+    cls->current = NULL;
+  }
+
+  cls->n_slabs --;
+  cls->free_objects -= s->capacity;
+  slab_unregister(s);
+  munmap(s, SLAB_SIZE);
+}
+
+/**
+ * Determines if an object would sit more densely elsewhere
+ */
+int slab_movable(void *p, size_t size) {
+  vsslab *s = NULL;
+  vsslabclass *cls = NULL;
+
+  if (p == NULL || size > SLAB_MAX_OBJECT) {
+    return 0;
+  }
+
+  if ((s = slab_lookup(p)) == NULL) {
+    return 1;
+  }
+
+  cls = &vs_slab_classes[s->size / SLAB_ALIGN - 1];
+
+  /* the slab being filled stays put; others move when they have more free
+   * objects than the class' slabs have on average */
+  return s != cls->current &&
+         (unsigned long long)(s->capacity - s->used) * cls->n_slabs > cls->free_objects;
+}
+
+/**
+ * Reports the bytes held in slabs, and how many of them are free
+ */
+void slab_stats(unsigned long long *reserved, unsigned long long *unused) {
+  int c;
+
+  *reserved = (unsigned long long)vs_n_slabs * SLAB_SIZE;
+  *unused = 0;
+
+  for (c = 0; c < SLAB_CLASSES; c ++) {
+    *unused += vs_slab_classes[c].free_objects * (c + 1) * SLAB_ALIGN;
+  }
+}
@@ -0,0 +1,91 @@
+#ifndef __varsvr_slab_h_
+
+#define __varsvr_slab_h_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "./errors.h"
+
+/*
+ * Slabs for the small objects the store holds: index nodes, value
+ * containers and short values. Objects are grouped by size class into
+ * SLAB_SIZE blocks mapped from the system apart from the heap, each
+ * aligned to its size so that the block holding an object is found from
+ * its address alone. Allocation fills the class' current slab, moving on
+ * to its fullest slab with room, and a slab is unmapped as soon as its
+ * last object is freed.
+ *
+ * Whether an object is worth moving is what drives defragmentation (see
+ * defrag.h): objects still on the heap, and objects in slabs emptier than
+ * their class' average, are moved so that the sparse slabs drain away.
+ *
+ * Nothing here locks; the store's write lock guards every slab.
+ */
+
+#define SLAB_SHIFT        16
+#define SLAB_SIZE         (1 << SLAB_SHIFT)
+#define SLAB_ALIGN        16
+#define SLAB_CLASSES      32
+#define SLAB_MAX_OBJECT   (SLAB_CLASSES * SLAB_ALIGN)
+
+/* space at the start of each slab for its header */
+#define SLAB_HEADER       64
+
+/**
+ * @struct _tag_vsslab
+ * @brief A block of objects of one size class
+ */
+typedef struct _tag_vsslab {
+  struct _tag_vsslab *next;
+  struct _tag_vsslab *prev;
+
+  void *free;             /* freed objects, chained through their first word */
+  unsigned int size;      /* object size */
+  unsigned int capacity;  /* objects the slab holds */
+  unsigned int used;      /* objects allocated */
+  unsigned int carved;    /* objects ever taken from the unused tail */
+} vsslab;
+
+/**
+ * @struct _tag_vsslabclass
+ * @brief Every slab of one object size
+ */
+typedef struct _tag_vsslabclass {
+  vsslab *slabs;
+  vsslab *current;        /* slab allocations are made from */
+  unsigned int n_slabs;
+  unsigned long long free_objects;
+} vsslabclass;
+
+/**
+ * Releases every slab
+ */
+int slab_teardown();
+
+/**
+ * Allocates an object, from a slab when it is small enough and from the
+ * heap otherwise
+ * @returns The object, otherwise NULL
+ */
+void* slab_alloc(size_t size);
+
+/**
+ * Frees an object allocated by slab_alloc or by malloc
+ */
+void slab_free(void *p);
+
+/**
+ * Determines if an object of some size would sit more densely elsewhere:
+ * it is small and on the heap, or its slab is emptier than average
+ */
+int slab_movable(void *p, size_t size);
+
+/**
+ * Reports the bytes mapped for slabs, and how many of them are free
+ */
+void slab_stats(unsigned long long *reserved, unsigned long long *unused);
+
+#endif /* __varsvr_slab_h_ */
@@ -0,0 +1,352 @@
+#include "./store.h"
+
+bintree *vs_store = NULL;
+pthread_rwlock_t vs_store_lock;
+
+/* bytes held by keys and values, and the most they may hold (0 is no limit) */
+unsigned long long vs_store_bytes = 0;
+unsigned long long vs_memory_limit = 0;
+
+/* last version handed to a changed value */
+unsigned long long vs_store_version = 0;
+
+/**
+ * Estimates the memory an item occupies, counting the value container and
+ * the tree node as a fixed overhead
+ */
+unsigned long long store_item_size(const char *key, unsigned int length) {
+  return strlen(key) + 1 + length + STORE_ITEM_OVERHEAD;
+}
+
+/**
+ * Checks that growing the store by some bytes stays within its limit
+ */
+int store_fits(unsigned long long grow) {
+  return vs_memory_limit == 0 || vs_store_bytes + grow <= vs_memory_limit;
+}
+
+/**
+ * Marks a value as changed by giving it the next version
+ */
+void store_stamp(vsval *v) {
+  v->version = ++ vs_store_version;
+}
+
+/**
+ * Marks the value under a key as changed, invalidating copies of it that
+ * workers have cached
+ */
+void store_changed(const char *key, vsval *v) {
+  store_stamp(v);
+  hotkey_changed(key);
+}
+
+/**
+ * Creates the index behind the store
+ */
+int store_create() {
+  if ((vs_store = bintree_create()) == NULL) {
+    return ERR_NOMEM;
+  }
+
+  bintree_set_allocator(vs_store, slab_alloc, slab_free);
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Creates the variable store
+ */
+int store_init() {
+  pthread_rwlockattr_t attr;
+
+  /* a steady stream of readers mustn't hold writers off indefinitely */
+  pthread_rwlockattr_init(&attr);
+  pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+  pthread_rwlock_init(&vs_store_lock, &attr);
+  pthread_rwlockattr_destroy(&attr);
+
+  return store_create();
+}
+
+/**
+ * Releases a value held by the store, which may sit in slabs
+ */
+void store_release_value(vsval *v) {
+  slab_free(v->data);
+  slab_free(v);
+}
+
+/**
+ * Releases the value held at a node of the store; its key goes with the node
+ */
+int store_release_item(void *key, void *data, void *arg) {
+  store_release_value((vsval *)data);
+
+  return 0;
+}
+
+/**
+ * Destroys the variable store and every value held in it
+ */
+int store_teardown() {
+  if (!vs_store) {
+    return ERR_SUCCESS;
+  }
+
+  bintree_walk(vs_store, store_release_item, NULL);
+  bintree_destroy(&vs_store);
+  slab_teardown();
+  vs_store_bytes = 0;
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Finds the value held under a key
+ */
+vsval* store_get(const char *key) {
+  return (vsval *)bintree_find(vs_store, key);
+}
+
+/**
+ * Holds a value under a key, taking ownership of it
+ * @param limited Set when the memory limit applies
+ */
+int store_put_item(const char *key, vsval *nv, int limited) {
+  vsval *v = NULL, old;
+
+  /* existing keys keep their container and take over the new contents */
+  if ((v = store_get(key)) != NULL) {
+    if (limited && nv->length > v->length && !store_fits(nv->length - v->length)) {
+      return ERR_FULL;
+    }
+
+    vs_store_bytes += nv->length;
+    vs_store_bytes -= v->length;
+
+    old = *v;
+    v->type_id = nv->type_id;
+    v->data = nv->data;
+    v->length = nv->length;
+    *nv = old;
+    store_release_value(nv);
+    store_changed(key, v);
+
+    return ERR_SUCCESS;
+  }
+
+  if (limited && !store_fits(store_item_size(key, nv->length))) {
+    return ERR_FULL;
+  }
+
+  if (bintree_insert(vs_store, key, nv) != 0) {
+    return ERR_NOMEM;
+  }
+
+  vs_store_bytes += store_item_size(key, nv->length);
+  store_changed(key, nv);
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Holds a value under a key, taking ownership of it
+ */
+int store_put(const char *key, vsval *nv) {
+  return store_put_item(key, nv, 1);
+}
+
+/**
+ * Sets the value held under a key from its wire representation
+ */
+int store_set(const char *key, char *type_name, const char *data, unsigned int length) {
+  int rc;
+  vsval *v = NULL;
+  unsigned int new_length;
+  type_desc *desc = lookup_type_by_name(type_name);
+
+  if (desc == NULL || desc->id == 0) {
+    return ERR_INVTYPE;
+  }
+
+  new_length = vst_is_varlen(desc) ? length : desc->length;
+
+  if ((v = store_get(key)) != NULL) {
+    if (new_length > v->length && !store_fits(new_length - v->length)) {
+      return ERR_FULL;
+    }
+  } else if (!store_fits(store_item_size(key, new_length))) {
+    return ERR_FULL;
+  }
+
+  /* the value is parsed apart from the store, whose values may sit in
+   * slabs that the type system can't resize, and then takes their place */
+  if ((rc = vsval_create(type_name, &v)) != ERR_SUCCESS) {
+    return rc;
+  }
+
+  if ((rc = vsval_parse(v, desc->id, data, length)) != ERR_SUCCESS ||
+      (rc = store_put_item(key, v, 1)) != ERR_SUCCESS) {
+    vsval_destroy(&v);
+  }
+
+  return rc;
+}
+
+/**
+ * Adds to the numeric value held under a key
+ */
+int store_incr(const char *key, long long delta, vsval **out) {
+  int rc;
+  vsval *v = store_get(key);
+
+  if (v == NULL) {
+    if ((rc = vsval_create("int64", &v)) != ERR_SUCCESS) {
+      return rc;
+    }
+
+    vsval_add(v, delta);
+
+    if ((rc = store_put(key, v)) != ERR_SUCCESS) {
+      vsval_destroy(&v);
+      return rc;
+    }
+  } else if ((rc = vsval_add(v, delta)) != ERR_SUCCESS) {
+    return rc;
+  } else {
+    store_changed(key, v);
+  }
+
+  if (out) {
+    *out = v;
+  }
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Finds the version of the value held under a key
+ */
+unsigned long long store_version(const char *key) {
+  vsval *v = store_get(key);
+
+  return v ? v->version : 0;
+}
+
+/**
+ * Puts back a value exactly as it was before a change, version included;
+ * a NULL value removes the key again. The memory limit doesn't apply, since
+ * this only ever returns the store to an earlier state
+ */
+int store_restore(const char *key, vsval *was) {
+  unsigned long long version;
+
+  if (was == NULL) {
+    store_del(key);
+    return ERR_SUCCESS;
+  }
+
+  /* only an existing key is returned to, which takes over the contents */
+  if (store_get(key) == NULL) {
+    return ERR_NOTFOUND;
+  }
+
+  version = was->version;
+  store_put_item(key, was, 0);
+  store_get(key)->version = version;
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Takes a key out of the store along with its value, without releasing
+ * either
+ */
+bintree_node* store_detach(const char *key) {
+  bintree_node *n = bintree_detach(vs_store, key);
+
+  if (n) {
+    hotkey_changed(key);
+    vs_store_bytes -= store_item_size(key, ((vsval *)n->data)->length);
+  }
+
+  return n;
+}
+
+/**
+ * Puts back a key taken out with store_detach
+ */
+int store_attach(bintree_node *n) {
+  if (bintree_attach(vs_store, n) != 0) {
+    return ERR_CONFLICT;
+  }
+
+  hotkey_changed(n->key);
+  vs_store_bytes += store_item_size(n->key, ((vsval *)n->data)->length);
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Releases a key taken out with store_detach, and its value
+ */
+void store_release_node(bintree_node *n) {
+  store_release_value((vsval *)n->data);
+  vs_store->release(n);
+}
+
+/**
+ * Removes a key and its value from the store
+ */
+int store_del(const char *key) {
+  void *data = NULL;
+  vsval *v = NULL;
+
+  if (bintree_delete(vs_store, key, &data) != 0) {
+    return ERR_NOTFOUND;
+  }
+
+  v = (vsval *)data;
+  hotkey_changed(key);
+  vs_store_bytes -= store_item_size(key, v->length);
+  store_release_value(v);
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Visits every key and value in the store, in key order
+ */
+int store_walk(bintree_visitor fn, void *arg) {
+  return bintree_walk(vs_store, fn, arg);
+}
+
+/**
+ * Visits the link to every node of the store's index after a key, in key
+ * order, so that nodes and their values can be moved
+ */
+int store_walk_links(const char *after, bintree_link_visitor fn, void *arg) {
+  return bintree_walk_links(vs_store, after, fn, arg);
+}
+
+/**
+ * Removes every key and value from the store
+ */
+int store_clear() {
+  hotkey_changed_all();
+  store_teardown();
+  return store_create();
+}
+
+void store_read_lock() {
+  pthread_rwlock_rdlock(&vs_store_lock);
+}
+
+void store_write_lock() {
+  pthread_rwlock_wrlock(&vs_store_lock);
+}
+
+void store_unlock() {
+  pthread_rwlock_unlock(&vs_store_lock);
+}
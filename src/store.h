@@ -0,0 +1,137 @@
+#ifndef __varsvr_store_h_
+
+#define __varsvr_store_h_
+
+/* writer preferring rwlocks */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "./bintree.h"
+#include "./hotkey.h"
+#include "./slab.h"
+#include "./typesys.h"
+#include "./errors.h"
+
+/* per item memory beyond the key and value bytes: the value container and
+ * the tree node, which holds the key inline, with the node's allocator header */
+#define STORE_ITEM_OVERHEAD (sizeof(vsval) + sizeof(bintree_node) + 16)
+
+extern unsigned long long vs_store_bytes;
+extern unsigned long long vs_memory_limit;
+extern unsigned long long vs_store_version;
+
+/**
+ * Creates the variable store
+ */
+int store_init();
+
+/**
+ * Destroys the variable store and every value held in it
+ */
+int store_teardown();
+
+/**
+ * Finds the value held under a key
+ * @returns The value if the key is found, otherwise NULL
+ */
+vsval* store_get(const char *key);
+
+/**
+ * Sets the value held under a key from its wire representation, creating
+ * the key if it doesn't exist yet
+ * @returns ERR_SUCCESS, ERR_FULL when the memory limit would be passed,
+ *          otherwise an error
+ */
+int store_set(const char *key, char *type_name, const char *data, unsigned int length);
+
+/**
+ * Holds a value under a key, taking ownership of the value
+ * @returns ERR_SUCCESS, ERR_FULL when the memory limit would be passed,
+ *          otherwise an error (the value then still belongs to the caller)
+ */
+int store_put(const char *key, vsval *v);
+
+/**
+ * Adds to the numeric value held under a key, keeping its type; a missing
+ * key is created as an int64 holding the delta
+ * @param out Receives the updated value
+ * @returns ERR_SUCCESS, ERR_INVTYPE when the value isn't a number,
+ *          otherwise an error
+ */
+int store_incr(const char *key, long long delta, vsval **out);
+
+/**
+ * Finds the version of the value held under a key. Versions come from a
+ * single counter that moves on every change, so a key's version differs
+ * after any change to it, even one that deletes and recreates it
+ * @returns The version, otherwise 0 when the key doesn't exist
+ */
+unsigned long long store_version(const char *key);
+
+/**
+ * Returns a key to a value copied before it changed, version included; a
+ * NULL value removes the key. The key keeps the container it has, so
+ * nothing is allocated and ownership of the value passes to the store
+ * @returns ERR_SUCCESS, otherwise ERR_NOTFOUND when there's a value to
+ *          return to but the key no longer exists
+ */
+int store_restore(const char *key, vsval *was);
+
+/**
+ * Takes a key out of the store along with its value, without releasing
+ * either, so that it can be put back exactly as it was
+ * @returns The node holding both, otherwise NULL when the key doesn't exist
+ */
+bintree_node* store_detach(const char *key);
+
+/**
+ * Puts back a key taken out with store_detach; nothing is allocated
+ * @returns ERR_SUCCESS, otherwise ERR_CONFLICT when the key exists again
+ */
+int store_attach(bintree_node *n);
+
+/**
+ * Releases a key taken out with store_detach, and its value
+ */
+void store_release_node(bintree_node *n);
+
+/**
+ * Removes a key and its value from the store
+ * @returns ERR_SUCCESS, otherwise ERR_NOTFOUND when the key doesn't exist
+ */
+int store_del(const char *key);
+
+/**
+ * Visits every key and value in the store, in key order
+ */
+int store_walk(bintree_visitor fn, void *arg);
+
+/**
+ * Visits the link to every node of the store's index whose key orders
+ * after a given one (or every node, given NULL), in key order. The visitor
+ * may move a node, or the value it holds, to memory from slab_alloc; the
+ * caller then holds the store lock exclusively, otherwise shared will do
+ */
+int store_walk_links(const char *after, bintree_link_visitor fn, void *arg);
+
+/**
+ * Removes every key and value from the store
+ */
+int store_clear();
+
+/*
+ * Event loops on several threads share the store. Readers hold the store
+ * lock shared and writers hold it exclusively; the watch registry and the
+ * mutation log change along with the store, so they're covered by it too
+ */
+
+void store_read_lock();
+void store_write_lock();
+void store_unlock();
+
+#endif /* __varsvr_store_h_ */
@@ -0,0 +1,400 @@
+#include "./trace.h"
+
+/* tracing switch, and the request time past which requests are logged */
+int vs_trace = 0;
+unsigned long long vs_slowlog_threshold = 10000000ULL;
+
+/* histogram counts per worker, phase and bucket; each worker only adds to
+ * its own, so relaxed loads and stores are enough */
+atomic_ullong *vs_trace_hist = NULL;
+int vs_trace_workers = 0;
+
+vsslow vs_slowlog[TRACE_SLOWLOG_SIZE];
+unsigned long long vs_slowlog_next = 0;
+pthread_mutex_t vs_slowlog_lock = PTHREAD_MUTEX_INITIALIZER;
+
+const char *vs_trace_names[TRACE_PHASES] = {
+  "accept", "read", "parse", "exec", "lookup", "encode", "send", "total"
+};
+
+/**
+ * @struct _tag_vstracereq
+ * @brief The request a thread is timing
+ */
+typedef struct _tag_vstracereq {
+  int active;
+  int phase;
+  unsigned long long start;
+  unsigned long long last;
+  unsigned long long ns[TRACE_PHASES];
+} vstracereq;
+
+_Thread_local vstracereq vs_trace_req;
+
+/**
+ * Creates the histograms for a number of workers
+ */
+int trace_init(int workers) {
+  int i, n = workers * TRACE_PHASES * TRACE_BUCKETS;
+
+  if ((vs_trace_hist = (atomic_ullong *)malloc(sizeof(atomic_ullong) * n)) == NULL) {
+    return ERR_NOMEM;
+  }
+
+  for (i = 0; i < n; i ++) {
+    atomic_init(&vs_trace_hist[i], 0);
+  }
+
+  vs_trace_workers = workers;
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Releases the histograms and the slow log
+ */
+int trace_teardown() {
+  free(vs_trace_hist);
+  vs_trace_hist = NULL;
+  vs_trace_workers = 0;
+  trace_slowlog_reset();
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Reads the clock for timing a phase
+ */
+unsigned long long trace_now() {
+  struct timespec ts;
+
+  if (!vs_trace) {
+    return 0;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Finds the histogram bucket for a duration: below TRACE_SUB_BUCKETS each
+ * value has its own, then each power of two is split TRACE_SUB_BUCKETS ways
+ */
+unsigned int trace_bucket(unsigned long long ns) {
+  int msb;
+  unsigned int b;
+
+  if (ns < TRACE_SUB_BUCKETS) {
+    return (unsigned int)ns;
+  }
+
+  msb = 63 - __builtin_clzll(ns);
+  b = (msb - TRACE_SUB_BITS + 1) * TRACE_SUB_BUCKETS +
+      ((ns >> (msb - TRACE_SUB_BITS)) & (TRACE_SUB_BUCKETS - 1));
+
+  return b < TRACE_BUCKETS ? b : TRACE_BUCKETS - 1;
+}
+
+/**
+ * Finds the largest duration that falls in a histogram bucket
+ */
+unsigned long long trace_bucket_top(unsigned int b) {
+  unsigned int shift;
+
+  if (b < TRACE_SUB_BUCKETS) {
+    return b;
+  }
+
+  shift = b / TRACE_SUB_BUCKETS - 1;
+
+  return (((unsigned long long)TRACE_SUB_BUCKETS + b % TRACE_SUB_BUCKETS + 1) << shift) - 1;
+}
+
+/**
+ * Counts a duration in the calling worker's histogram for a phase
+ */
+void trace_record(int phase, unsigned long long ns) {
+  vsworker *w = worker_self();
+  atomic_ullong *h = NULL;
+
+  if (vs_trace_hist == NULL) {
+    return;
+  }
+
+  h = vs_trace_hist + ((w ? w->id : 0) * TRACE_PHASES + phase) * TRACE_BUCKETS + trace_bucket(ns);
+  atomic_store_explicit(h, atomic_load_explicit(h, memory_order_relaxed) + 1, memory_order_relaxed);
+}
+
+/**
+ * Records the time a phase took, given when it started
+ */
+void trace_since(int phase, unsigned long long start) {
+  unsigned long long now = trace_now();
+
+  if (start && now) {
+    trace_record(phase, now - start);
+  }
+}
+
+/**
+ * Starts timing a request on the calling thread
+ */
+void trace_begin() {
+  vstracereq *r = &vs_trace_req;
+
+  if ((r->start = trace_now()) == 0) {
+    r->active = 0;
+    return;
+  }
+
+  memset(r->ns, 0, sizeof(r->ns));
+  r->last = r->start;
+  r->phase = TRACE_PARSE;
+  r->active = 1;
+}
+
+/**
+ * Moves the calling thread's request on to another phase
+ */
+void trace_switch_to(int phase) {
+  vstracereq *r = &vs_trace_req;
+  unsigned long long now;
+
+  if (!r->active || r->phase == phase) {
+    return;
+  }
+
+  now = trace_now();
+  r->ns[r->phase] += now - r->last;
+  r->last = now;
+  r->phase = phase;
+}
+
+/**
+ * Copies a request line into a slow log entry, made printable
+ */
+void trace_copy_request(vsslow *e, const char *request, unsigned int len) {
+  unsigned int i;
+
+  for (i = 0; i < len && i < TRACE_REQUEST_LEN - 1; i ++) {
+    if (request[i] == '\r' || request[i] == '\n') {
+      break;
+    }
+
+    e->request[i] = (request[i] >= 0x20 && request[i] < 0x7f) ? request[i] : '?';
+  }
+
+  e->request[i] = 0;
+}
+
+/**
+ * Finishes timing the calling thread's request and records it
+ */
+void trace_end(const char *request, unsigned int len) {
+  int i;
+  vstracereq *r = &vs_trace_req;
+  vsworker *w = worker_self();
+  vsslow *e = NULL;
+  struct timespec ts;
+
+  if (!r->active) {
+    return;
+  }
+
+  trace_switch_to(TRACE_TOTAL);
+  r->ns[TRACE_TOTAL] = r->last - r->start;
+  r->active = 0;
+
+  for (i = TRACE_PARSE; i < TRACE_PHASES; i ++) {
+    if (r->ns[i] || i == TRACE_TOTAL) {
+      trace_record(i, r->ns[i]);
+    }
+  }
+
+  if (r->ns[TRACE_TOTAL] < vs_slowlog_threshold) {
+    return;
+  }
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  pthread_mutex_lock(&vs_slowlog_lock);
+
+  e = &vs_slowlog[vs_slowlog_next % TRACE_SLOWLOG_SIZE];
+  e->id = vs_slowlog_next ++;
+  e->when = (unsigned long long)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+  e->worker = w ? w->id : 0;
+  memcpy(e->ns, r->ns, sizeof(e->ns));
+  trace_copy_request(e, request, len);
+
+  pthread_mutex_unlock(&vs_slowlog_lock);
+}
+
+/**
+ * Drops the calling thread's request without recording it
+ */
+void trace_cancel() {
+  vs_trace_req.active = 0;
+}
+
+/**
+ * Appends formatted text to a growing report
+ */
+int trace_append(char **text, size_t *len, size_t *cap, const char *format, ...) {
+  int n;
+  char *grown = NULL;
+  va_list args;
+
+  for (;;) {
+    va_start(args, format);
+    n = vsnprintf(*text + *len, *cap - *len, format, args);
+    va_end(args);
+
+    if (n < 0) {
+      return ERR_INVPTR;
+    }
+
+    if (*len + n < *cap) {
+      *len += n;
+      return ERR_SUCCESS;
+    }
+
+    if ((grown = (char *)realloc(*text, *cap * 2 + n)) == NULL) {
+      return ERR_NOMEM;
+    }
+
+    *text = grown;
+    *cap = *cap * 2 + n;
+  }
+}
+
+/**
+ * Finds the smallest duration at or below which a fraction of the counts
+ * fall
+ */
+unsigned long long trace_percentile(unsigned long long *h, unsigned long long count, double q) {
+  unsigned int b;
+  unsigned long long seen = 0, want = (unsigned long long)(q * count + 0.5);
+
+  want = want ? want : 1;
+
+  for (b = 0; b < TRACE_BUCKETS; b ++) {
+    if ((seen += h[b]) >= want) {
+      return trace_bucket_top(b);
+    }
+  }
+
+  return trace_bucket_top(TRACE_BUCKETS - 1);
+}
+
+/**
+ * Describes every phase's histogram
+ */
+char* trace_latency_report() {
+  int w, phase;
+  unsigned int b;
+  unsigned long long h[TRACE_BUCKETS], count, max;
+  size_t len = 0, cap = 1024;
+  char *text = (char *)malloc(cap);
+
+  if (text == NULL ||
+      trace_append(&text, &len, &cap, "LATENCY %d\r\n", TRACE_PHASES) != ERR_SUCCESS) {
+    free(text);
+    return NULL;
+  }
+
+  for (phase = 0; phase < TRACE_PHASES; phase ++) {
+    memset(h, 0, sizeof(h));
+    count = max = 0;
+
+    /* the workers' histograms are merged for reporting */
+    for (w = 0; w < vs_trace_workers; w ++) {
+      for (b = 0; b < TRACE_BUCKETS; b ++) {
+        h[b] += atomic_load_explicit(&vs_trace_hist[(w * TRACE_PHASES + phase) * TRACE_BUCKETS + b],
+                                     memory_order_relaxed);
+      }
+    }
+
+    for (b = 0; b < TRACE_BUCKETS; b ++) {
+      if (h[b]) {
+        count += h[b];
+        max = trace_bucket_top(b);
+      }
+    }
+
+    if (trace_append(&text, &len, &cap, "%s %llu p50=%llu p90=%llu p99=%llu p999=%llu max=%llu\r\n",
+                     vs_trace_names[phase], count,
+                     count ? trace_percentile(h, count, 0.5) : 0,
+                     count ? trace_percentile(h, count, 0.9) : 0,
+                     count ? trace_percentile(h, count, 0.99) : 0,
+                     count ? trace_percentile(h, count, 0.999) : 0, max) != ERR_SUCCESS) {
+      free(text);
+      return NULL;
+    }
+  }
+
+  return text;
+}
+
+/**
+ * Describes the newest slow log entries
+ */
+char* trace_slowlog_report(int count) {
+  int i, phase, rc = ERR_SUCCESS;
+  unsigned long long n;
+  size_t len = 0, cap = 4096;
+  char *text = (char *)malloc(cap);
+  vsslow *e = NULL;
+
+  if (text == NULL) {
+    return NULL;
+  }
+
+  pthread_mutex_lock(&vs_slowlog_lock);
+
+  n = vs_slowlog_next < TRACE_SLOWLOG_SIZE ? vs_slowlog_next : TRACE_SLOWLOG_SIZE;
+  n = (count >= 0 && (unsigned long long)count < n) ? (unsigned long long)count : n;
+  rc = trace_append(&text, &len, &cap, "SLOWLOG %llu\r\n", n);
+
+  for (i = 0; rc == ERR_SUCCESS && (unsigned long long)i < n; i ++) {
+    e = &vs_slowlog[(vs_slowlog_next - 1 - i) % TRACE_SLOWLOG_SIZE];
+    rc = trace_append(&text, &len, &cap, "%llu %llu %d %llu", e->id, e->when, e->worker,
+                      e->ns[TRACE_TOTAL]);
+
+    for (phase = TRACE_PARSE; rc == ERR_SUCCESS && phase < TRACE_TOTAL; phase ++) {
+      rc = trace_append(&text, &len, &cap, " %s=%llu", vs_trace_names[phase], e->ns[phase]);
+    }
+
+    if (rc == ERR_SUCCESS) {
+      rc = trace_append(&text, &len, &cap, " %s\r\n", e->request);
+    }
+  }
+
+  pthread_mutex_unlock(&vs_slowlog_lock);
+
+  if (rc != ERR_SUCCESS) {
+    free(text);
+    return NULL;
+  }
+
+  return text;
+}
+
+/**
+ * Empties every histogram
+ */
+void trace_reset() {
+  int i, n = vs_trace_workers * TRACE_PHASES * TRACE_BUCKETS;
+
+  for (i = 0; i < n; i ++) {
+    atomic_store_explicit(&vs_trace_hist[i], 0, memory_order_relaxed);
+  }
+}
+
+/**
+ * Empties the slow log
+ */
+void trace_slowlog_reset() {
+  pthread_mutex_lock(&vs_slowlog_lock);
+  vs_slowlog_next = 0;
+  pthread_mutex_unlock(&vs_slowlog_lock);
+}
@@ -0,0 +1,139 @@
+#ifndef __varsvr_trace_h_
+
+#define __varsvr_trace_h_
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "./worker.h"
+#include "./errors.h"
+
+/*
+ * Latency tracing. While enabled, each request's time is split between the
+ * phases of the request path: the clock is read whenever the request moves
+ * from one phase to the next, and the time since the last reading goes to
+ * the phase being left. Connection accepts and socket reads aren't part of
+ * any one request, so they are timed on their own.
+ *
+ * Every phase feeds a log-linear (HDR style) histogram kept per worker, so
+ * recording never contends: values are bucketed by their top bits, giving
+ * a relative error of at most 1/TRACE_SUB_BUCKETS at any magnitude.
+ * Requests taking longer than the slow log threshold are also captured,
+ * with their breakdown, in a small ring:
+ *
+ *   LATENCY [RESET]       LATENCY <phases>\r\n, then for each phase
+ *                         <phase> <count> p50=<ns> p90=<ns> p99=<ns>
+ *                         p999=<ns> max=<ns>\r\n
+ *   SLOWLOG [<n>|RESET]   SLOWLOG <entries>\r\n, then newest first
+ *                         <id> <unix usec> <worker> <total ns>
+ *                         <phase>=<ns>... <request line>\r\n
+ */
+
+#define TRACE_ACCEPT    0   /* accepting and setting up a connection */
+#define TRACE_READ      1   /* receiving from a socket */
+#define TRACE_PARSE     2   /* finding and splitting the request line */
+#define TRACE_EXEC      3   /* running the command, outside the phases below */
+#define TRACE_LOOKUP    4   /* waiting for the store lock and using the index */
+#define TRACE_ENCODE    5   /* encoding a value for the reply */
+#define TRACE_SEND      6   /* handing the reply to the socket */
+#define TRACE_TOTAL     7   /* the whole request */
+#define TRACE_PHASES    8
+
+/* histogram resolution: 2^TRACE_SUB_BITS buckets per power of two */
+#define TRACE_SUB_BITS      3
+#define TRACE_SUB_BUCKETS   (1 << TRACE_SUB_BITS)
+#define TRACE_BUCKETS       (42 * TRACE_SUB_BUCKETS)
+
+#define TRACE_SLOWLOG_SIZE  128
+#define TRACE_REQUEST_LEN   96
+
+/* moves the calling thread's request on to another phase */
+#define trace_switch(p) do { if (vs_trace) trace_switch_to(p); } while (0)
+
+/**
+ * @struct _tag_vsslow
+ * @brief A request captured by the slow log
+ */
+typedef struct _tag_vsslow {
+  unsigned long long id;
+  unsigned long long when;  /* wall clock microseconds when it finished */
+  int worker;
+  unsigned long long ns[TRACE_PHASES];
+  char request[TRACE_REQUEST_LEN]; /* the request line, made printable */
+} vsslow;
+
+extern int vs_trace;
+extern unsigned long long vs_slowlog_threshold;
+
+/**
+ * Creates the histograms for a number of workers
+ */
+int trace_init(int workers);
+
+/**
+ * Releases the histograms and the slow log
+ */
+int trace_teardown();
+
+/**
+ * Reads the clock for timing a phase
+ * @returns The time in nanoseconds, or 0 while tracing is disabled
+ */
+unsigned long long trace_now();
+
+/**
+ * Records the time a phase took, given when it started
+ */
+void trace_since(int phase, unsigned long long start);
+
+/**
+ * Starts timing a request on the calling thread; it begins in TRACE_PARSE
+ */
+void trace_begin();
+
+/**
+ * Moves the calling thread's request on to another phase
+ */
+void trace_switch_to(int phase);
+
+/**
+ * Finishes timing the calling thread's request and records it
+ * @param request The request as received, of which the first line is kept
+ *                when it is slow
+ */
+void trace_end(const char *request, unsigned int len);
+
+/**
+ * Drops the calling thread's request without recording it, as when it
+ * hasn't all arrived yet
+ */
+void trace_cancel();
+
+/**
+ * Describes every phase's histogram in the LATENCY reply format
+ * @returns The text, to be released with free, otherwise NULL
+ */
+char* trace_latency_report();
+
+/**
+ * Describes the newest slow log entries in the SLOWLOG reply format
+ * @returns The text, to be released with free, otherwise NULL
+ */
+char* trace_slowlog_report(int count);
+
+/**
+ * Empties every histogram
+ */
+void trace_reset();
+
+/**
+ * Empties the slow log
+ */
+void trace_slowlog_reset();
+
+#endif /* __varsvr_trace_h_ */
@@ -0,0 +1,207 @@
+#include "./txn.h"
+
+/**
+ * Starts an empty transaction
+ */
+vstxn* txn_create() {
+  return (vstxn *)calloc(1, sizeof(vstxn));
+}
+
+/**
+ * Discards a transaction and everything staged in it
+ */
+void txn_destroy(vstxn **t) {
+  vstxnop *op = NULL, *next = NULL;
+
+  if (!t || !(*t)) {
+    return;
+  }
+
+  for (op = (*t)->head; op; op = next) {
+    next = op->next;
+
+    if (op->v) {
+      vsval_destroy(&op->v);
+    }
+
+    if (op->undo) {
+      vsval_destroy(&op->undo);
+    }
+
+    free(op->key);
+    free(op);
+  }
+
+  free(*t);
+  *t = NULL;
+}
+
+/**
+ * Stages an operation
+ */
+int txn_stage(vstxn *t, int op, const char *key, vsval *v, long long delta,
+              unsigned long long version) {
+  unsigned int length = v ? v->length : 0;
+  vstxnop *o = NULL;
+
+  if (t->n_ops >= TXN_MAX_OPS || t->bytes + length > TXN_MAX_BYTES) {
+    return ERR_FULL;
+  }
+
+  if ((o = (vstxnop *)calloc(1, sizeof(vstxnop))) == NULL) {
+    return ERR_NOMEM;
+  }
+
+  if ((o->key = strdup(key)) == NULL) {
+    free(o);
+    return ERR_NOMEM;
+  }
+
+  o->op = op;
+  o->v = v;
+  o->delta = delta;
+  o->version = version;
+  o->prev = t->tail;
+
+  if (t->tail) {
+    t->tail->next = o;
+  } else {
+    t->head = o;
+  }
+
+  t->tail = o;
+  t->n_ops ++;
+  t->bytes += length;
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Applies a single operation, remembering what the key held beforehand
+ */
+int txn_apply(vstxnop *o) {
+  int rc;
+  vsval *was = store_get(o->key), *result = NULL;
+
+  /* a key that's changed in place keeps its container, so only its
+   * contents need copying */
+  if (was && (o->op == TXN_SET || o->op == TXN_INCR) &&
+      vsval_copy(was, &o->undo) != ERR_SUCCESS) {
+    return ERR_NOMEM;
+  }
+
+  switch (o->op) {
+    case TXN_SET:
+      if ((rc = store_put(o->key, o->v)) == ERR_SUCCESS) {
+        o->v = NULL;
+        o->applied = 1;
+      }
+      break;
+
+    case TXN_DEL:
+      /* a key that's already gone is an outcome, not a failure */
+      o->deleted = store_detach(o->key);
+      o->applied = (o->deleted != NULL);
+      o->rc = o->applied ? ERR_SUCCESS : ERR_NOTFOUND;
+      rc = ERR_SUCCESS;
+      break;
+
+    case TXN_INCR:
+      if ((rc = store_incr(o->key, o->delta, &result)) == ERR_SUCCESS) {
+        o->applied = 1;
+        rc = vsval_copy(result, &o->v);
+      }
+      break;
+
+    default:
+      rc = ERR_SUCCESS;
+  }
+
+  if (!o->applied && o->undo) {
+    vsval_destroy(&o->undo);
+  }
+
+  if (o->op != TXN_DEL) {
+    o->rc = rc;
+  }
+
+  return rc;
+}
+
+/**
+ * Undoes the operations applied up to one that failed, newest first, so
+ * that a key changed several times ends up as it started. Each key is back
+ * as the operation found it: one that was deleted is absent, so its node
+ * goes back in, and one that was changed is present, so its container
+ * takes back the old contents
+ */
+void txn_rollback(vstxnop *o) {
+  for (; o; o = o->prev) {
+    if (!o->applied) {
+      continue;
+    }
+
+    if (o->deleted) {
+      store_attach(o->deleted);
+      o->deleted = NULL;
+    } else {
+      store_restore(o->key, o->undo);
+      o->undo = NULL;
+    }
+
+    o->applied = 0;
+  }
+}
+
+/**
+ * Applies a transaction
+ */
+int txn_exec(vstxn *t, const char **conflict) {
+  int rc, changed = 0;
+  vstxnop *o = NULL;
+
+  /* every condition is settled before anything changes */
+  for (o = t->head; o; o = o->next) {
+    if (o->op == TXN_CHECK && store_version(o->key) != o->version) {
+      *conflict = o->key;
+      return ERR_CONFLICT;
+    }
+  }
+
+  for (o = t->head; o; o = o->next) {
+    if ((rc = txn_apply(o)) != ERR_SUCCESS) {
+      txn_rollback(o);
+      return rc;
+    }
+
+    changed |= o->applied;
+  }
+
+  /* the unit is complete, so it can be seen: watchers and replicas are
+   * handed each key's final value */
+  if (changed) {
+    repl_log_line("MULTI\r\n");
+  }
+
+  for (o = t->head; o; o = o->next) {
+    if (o->applied) {
+      pubsub_publish(o->key, store_get(o->key));
+      repl_log_change(o->key, store_get(o->key));
+    }
+
+    if (o->undo) {
+      vsval_destroy(&o->undo);
+    }
+
+    if (o->deleted) {
+      store_release_node(o->deleted);
+      o->deleted = NULL;
+    }
+  }
+
+  if (changed) {
+    repl_log_line("EXEC\r\n");
+  }
+
+  return ERR_SUCCESS;
+}
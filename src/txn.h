@@ -0,0 +1,105 @@
+#ifndef __varsvr_txn_h_
+
+#define __varsvr_txn_h_
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "./pubsub.h"
+#include "./repl.h"
+#include "./store.h"
+#include "./typesys.h"
+#include "./log.h"
+#include "./errors.h"
+
+/*
+ * Transactions. Between MULTI and EXEC a connection's writes are staged
+ * rather than applied; EXEC then applies the whole unit under a single
+ * acquisition of the store lock, so no reader or watcher ever sees part of
+ * it. CHECK stages an optimistic condition on a key's version (see
+ * store_version); when any condition no longer holds at EXEC, nothing is
+ * applied. Should an operation fail part way through (a value that isn't a
+ * number, the memory limit) the operations before it are rolled back.
+ * Rolling back allocates nothing, so it can't fail: a changed key takes
+ * back a copy of its old contents made before the change, and a deleted
+ * key's own node is held on to and put back.
+ *
+ * Watchers are notified once the unit has been applied, and replicas are
+ * sent it wrapped in MULTI and EXEC so that they apply it as one unit too.
+ */
+
+/* most operations and staged value bytes a transaction may hold */
+#define TXN_MAX_OPS     4096
+#define TXN_MAX_BYTES   (64 * 1024 * 1024)
+
+#define TXN_SET     1
+#define TXN_DEL     2
+#define TXN_INCR    3
+#define TXN_CHECK   4
+
+/**
+ * @struct _tag_vstxnop
+ * @brief An operation staged in a transaction
+ */
+typedef struct _tag_vstxnop {
+  struct _tag_vstxnop *next;
+  struct _tag_vstxnop *prev;
+
+  int op;
+  char *key;
+  vsval *v;               /* value to set; after an INCR, a copy of its result */
+  long long delta;        /* amount to INCR by */
+  unsigned long long version; /* version a CHECK expects; 0 for no key */
+
+  int rc;                 /* outcome, once executed */
+  int applied;            /* set once it has changed the store */
+  vsval *undo;            /* the key's value beforehand; NULL if it had none */
+  bintree_node *deleted;  /* after a DEL, the key as it was, until the unit completes */
+} vstxnop;
+
+/**
+ * @struct _tag_vstxn
+ * @brief Operations staged by a connection between MULTI and EXEC
+ */
+typedef struct _tag_vstxn {
+  vstxnop *head;
+  vstxnop *tail;
+  unsigned int n_ops;
+  unsigned long long bytes; /* staged value bytes */
+
+  int aborted;            /* set after a request the transaction can't hold */
+} vstxn;
+
+/**
+ * Starts an empty transaction
+ * @returns The transaction, otherwise NULL
+ */
+vstxn* txn_create();
+
+/**
+ * Discards a transaction and everything staged in it
+ */
+void txn_destroy(vstxn **t);
+
+/**
+ * Stages an operation
+ * @param v For TXN_SET, the value; ownership passes to the transaction
+ *          once staged
+ * @returns ERR_SUCCESS, ERR_FULL when the transaction can't hold any
+ *          more, otherwise an error
+ */
+int txn_stage(vstxn *t, int op, const char *key, vsval *v, long long delta,
+              unsigned long long version);
+
+/**
+ * Applies a transaction, the caller holding the store lock exclusively.
+ * Each operation's outcome is left in its rc; a successful INCR leaves a
+ * copy of the value it produced
+ * @param conflict Receives the key whose CHECK failed
+ * @returns ERR_SUCCESS, ERR_CONFLICT when a CHECK failed, otherwise the
+ *          error that stopped an operation; unless successful, the store
+ *          is left as it was
+ */
+int txn_exec(vstxn *t, const char **conflict);
+
+#endif /* __varsvr_txn_h_ */
@@ -111,6 +111,7 @@ int vsval_create(char *name, vsval **v) {
 
   newval = (vsval *)malloc(sizeof(vsval));
   newval->type_id = desc->id;
+  newval->version = 0;
 
   if (vst_is_varlen(desc)) {
     newval->data = malloc(VSVAL_DEFAULT_LENGTH);
@@ -159,9 +160,15 @@ int vsval_set(vsval *v, unsigned int type_id, void *data, unsigned int length) {
   }
 
   int actual_len = desc->length ? desc->length : length;
+  void *p = NULL;
 
+  /* an empty value still holds a byte, so that its data is never NULL */
   if (v->length != actual_len) {
-    v->data = realloc(v->data, actual_len);
+    if ((p = realloc(v->data, actual_len ? actual_len : 1)) == NULL) {
+      return ERR_NOMEM;
+    }
+
+    v->data = p;
     v->length = actual_len;
   }
 
@@ -171,6 +178,72 @@ int vsval_set(vsval *v, unsigned int type_id, void *data, unsigned int length) {
   return ERR_SUCCESS;
 }
 
+/**
+ * Creates a copy of a value container, version included
+ */
+int vsval_copy(vsval *src, vsval **v) {
+  vsval *newval = NULL;
+
+  if (!src || !v) {
+    return ERR_INVPTR;
+  }
+
+  if ((newval = (vsval *)malloc(sizeof(vsval))) == NULL) {
+    return ERR_NOMEM;
+  }
+
+  *newval = *src;
+
+  if ((newval->data = malloc(src->length ? src->length : 1)) == NULL) {
+    free(newval);
+    return ERR_NOMEM;
+  }
+
+  memcpy(newval->data, src->data, src->length);
+  *v = newval;
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Adds to a numeric or floating point value in place, keeping its type.
+ * Integers wrap at the width of their type
+ */
+int vsval_add(vsval *v, long long delta) {
+  if (!v) {
+    return ERR_INVPTR;
+  }
+
+  type_desc *desc = lookup_type(v->type_id);
+
+  if (desc == NULL || v->type_id == 0) {
+    return ERR_INVTYPE;
+  }
+
+  if (vst_is_numeric(desc)) {
+    switch (desc->length) {
+      case 1: *(unsigned char *)v->data += (unsigned char)delta; break;
+      case 2: *(unsigned short *)v->data += (unsigned short)delta; break;
+      case 4: *(unsigned int *)v->data += (unsigned int)delta; break;
+      case 8: *(unsigned long long *)v->data += (unsigned long long)delta; break;
+      default:
+        return ERR_INVTYPE;
+    }
+
+    return ERR_SUCCESS;
+  } else if (vst_is_floating(desc)) {
+    if (desc->length == 4) {
+      *(float *)v->data += (float)delta;
+    } else {
+      *(double *)v->data += (double)delta;
+    }
+
+    return ERR_SUCCESS;
+  }
+
+  return ERR_INVTYPE;
+}
+
 /**
  * Sets the internal value of a value container to symbolic NULL
  */
@@ -253,10 +326,161 @@ int vsval_set_text(vsval *v, const char *s) {
 
   if (v->length != strlen(s)) {
     v->length = strlen(s);
-    v->data = realloc(v->data, v->length);
+    v->data = realloc(v->data, v->length ? v->length : 1);
   }
 
   memcpy(v->data, s, v->length);
 
   return ERR_SUCCESS;
 }
+
+/**
+ * Sets a value container from its wire (text) representation. Fixed width
+ * types are given in decimal; variable length types are taken verbatim
+ */
+int vsval_parse(vsval *v, unsigned int type_id, const char *s, unsigned int length) {
+  char text[32], *end = NULL;
+  long long i;
+  double d;
+  float f;
+
+  if (!v || (!s && length)) {
+    return ERR_INVPTR;
+  }
+
+  type_desc *desc = lookup_type(type_id);
+
+  if (desc == NULL || type_id == 0) {
+    return ERR_INVTYPE;
+  }
+
+  if (vst_is_varlen(desc)) {
+    return vsval_set(v, type_id, (void *)s, length);
+  }
+
+  /* fixed width types need a terminated copy for the conversion */
+  if (length == 0 || length >= sizeof(text)) {
+    return ERR_INVTYPE;
+  }
+
+  memcpy(text, s, length);
+  text[length] = 0;
+  errno = 0;
+
+  if (vst_is_numeric(desc)) {
+    i = strtoll(text, &end, 10);
+
+    if (*end != 0 || errno == ERANGE) {
+      return ERR_INVTYPE;
+    }
+
+    /* a number that doesn't fit its type is refused, not truncated */
+    if (desc->id == 0x0001 ? (i < 0 || i > 1) :
+        desc->length < 8 && (i < -(1LL << (desc->length * 8 - 1)) ||
+                             i >= (1LL << (desc->length * 8 - 1)))) {
+      return ERR_INVTYPE;
+    }
+
+    switch (desc->length) {
+      case 1: { char c = (char)i; return vsval_set(v, type_id, &c, 1); }
+      case 2: { short h = (short)i; return vsval_set(v, type_id, &h, 2); }
+      case 4: { int n = (int)i; return vsval_set(v, type_id, &n, 4); }
+      case 8: { long l = (long)i; return vsval_set(v, type_id, &l, 8); }
+      default:
+        return ERR_INVTYPE;
+    }
+  } else if (vst_is_floating(desc)) {
+    d = strtod(text, &end);
+
+    /* overflow is refused; underflow leaves a denormal or zero, which is
+     * still the closest value there is */
+    if (*end != 0 || (errno == ERANGE && isinf(d))) {
+      return ERR_INVTYPE;
+    }
+
+    if (desc->length == 4) {
+      f = (float)d;
+
+      /* nor may a finite number round to infinity as a float */
+      if (isinf(f) && !isinf(d)) {
+        return ERR_INVTYPE;
+      }
+
+      return vsval_set(v, type_id, &f, 4);
+    } else if (desc->length == 8) {
+      return vsval_set(v, type_id, &d, 8);
+    }
+  }
+
+  return ERR_INVTYPE;
+}
+
+/**
+ * Resolves the wire (text) representation of a value. Variable length
+ * values are handed back in place so they can be sent without a copy;
+ * fixed width values are formatted into the caller's scratch space
+ */
+int vsval_payload(vsval *v, char *scratch, unsigned int size,
+                  const void **data, unsigned int *length) {
+  int n = 0;
+
+  if (!v || !data || !length) {
+    return ERR_INVPTR;
+  }
+
+  type_desc *desc = lookup_type(v->type_id);
+
+  if (desc == NULL) {
+    return ERR_INVTYPE;
+  }
+
+  if (desc->id == 0x0000) {
+    *data = scratch;
+    *length = 0;
+    return ERR_SUCCESS;
+  }
+
+  if (vst_is_varlen(desc)) {
+    *data = v->data;
+    *length = v->length;
+    return ERR_SUCCESS;
+  }
+
+  if (vst_is_numeric(desc)) {
+    switch (desc->length) {
+      case 1:
+        n = snprintf(scratch, size, "%i", *(char *)v->data);
+        break;
+      case 2:
+        n = snprintf(scratch, size, "%i", *(short *)v->data);
+        break;
+      case 4:
+        n = snprintf(scratch, size, "%i", *(int *)v->data);
+        break;
+      case 8:
+        n = snprintf(scratch, size, "%li", *(long *)v->data);
+        break;
+      default:
+        return ERR_INVTYPE;
+    }
+  } else if (vst_is_floating(desc)) {
+    if (desc->length == 4) {
+      n = snprintf(scratch, size, "%.9g", *(float *)v->data);
+    } else if (desc->length == 8) {
+      n = snprintf(scratch, size, "%.17g", *(double *)v->data);
+    } else {
+      return ERR_INVTYPE;
+    }
+  } else {
+    return ERR_INVTYPE;
+  }
+
+  if (n < 0 || n >= size) {
+    return ERR_INVTYPE;
+  }
+
+  *data = scratch;
+  *length = n;
+
+  return ERR_SUCCESS;
+}
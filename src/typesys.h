@@ -2,6 +2,8 @@
 
 #define __varsrv_typesys_h_
 
+#include <errno.h>
+#include <math.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -35,11 +37,17 @@ typedef struct _tag_vsval {
   unsigned int type_id;
   void *data;
   unsigned int length;
+
+  unsigned long long version; /* changes whenever a stored value does */
 } vsval;
 
+type_desc* lookup_type(unsigned int type_id);
+type_desc* lookup_type_by_name(char *name);
+
 int vsval_create(char *name, vsval **v);
 
 int vsval_destroy(vsval **v);
+int vsval_copy(vsval *src, vsval **v);
 
 int vsval_set(vsval *v, unsigned int type_id, void *data, unsigned int length);
 
@@ -48,6 +56,11 @@ int vsval_set_numeric(vsval *v, int i);
 int vsval_set_float(vsval *v, float f);
 int vsval_set_double(vsval *v, double f);
 int vsval_set_text(vsval *v, const char *s);
+int vsval_add(vsval *v, long long delta);
+
+int vsval_parse(vsval *v, unsigned int type_id, const char *s, unsigned int length);
+int vsval_payload(vsval *v, char *scratch, unsigned int size,
+                  const void **data, unsigned int *length);
 
 int vsval_print(vsval *v);
 #endif /*__varsrv_typesys_h_*/
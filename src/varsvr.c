@@ -1,12 +1,68 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "./log.h"
 #include "./daemon.h"
+#include "./repl.h"
+#include "./config.h"
+
+/**
+ * Prints the command line usage
+ */
+void usage(const char *prog) {
+  fprintf(stderr,
+          "usage: %s [-f] [-c config-file] [-p port] [-s unix-socket] [-r primary-host:port]\n"
+          "       [-b backlog] [-w workers] [-a cpu-list] [-m memory-limit] [-e poll|epoll]\n",
+          prog);
+}
+
+/**
+ * Maps a command line option onto the setting it overrides
+ */
+const char* option_setting(int opt) {
+  switch (opt) {
+    case 'p': return "port";
+    case 's': return "unix-socket";
+    case 'r': return "replica-of";
+    case 'b': return "backlog";
+    case 'w': return "workers";
+    case 'a': return "cpus";
+    case 'm': return "memory-limit";
+    case 'e': return "io-engine";
+  }
+
+  return NULL;
+}
 
 /** Program entry point */
 int main(int argc, char *argv[]) {
+  int opt;
+  const char *options = "c:fp:r:s:b:w:a:m:e:", *name = NULL;
+
+  /* a config file is applied first so that the command line overrides it */
+  while ((opt = getopt(argc, argv, options)) != -1) {
+    if (opt == 'c' && config_load(optarg) != ERR_SUCCESS) {
+      _exit(1);
+    } else if (opt == '?') {
+      usage(argv[0]);
+      _exit(1);
+    }
+  }
+
+  optind = 1;
+
+  while ((opt = getopt(argc, argv, options)) != -1) {
+    if (opt == 'f') {
+      vs_foreground = 1;
+    } else if ((name = option_setting(opt)) != NULL && config_set(name, optarg) != ERR_SUCCESS) {
+      fprintf(stderr, "%s: invalid value '%s' for %s\n", argv[0], optarg, name);
+      _exit(1);
+    }
+  }
 
-  log_init();
+  log_init(vs_foreground);
  
   if (daemon_init() != ERR_SUCCESS) {
     _exit(1);
@@ -0,0 +1,184 @@
+#include "./vsbuf.h"
+
+/* one free list per power of two size class */
+#define VSBUF_CLASSES 9
+
+_Thread_local vsbuf *vsbuf_pool[VSBUF_CLASSES];
+_Thread_local unsigned int vsbuf_pool_len[VSBUF_CLASSES];
+_Thread_local int vsbuf_node = -1;
+
+/**
+ * Finds the size class that serves a request for size bytes
+ * @returns The class index, otherwise -1 for sizes that aren't pooled
+ */
+int vsbuf_class(unsigned int size) {
+  int cls = 0;
+  unsigned int cap = VSBUF_MIN_SIZE;
+
+  if (size > VSBUF_MAX_POOLED) {
+    return -1;
+  }
+
+  while (cap < size) {
+    cap <<= 1;
+    cls ++;
+  }
+
+  return cls;
+}
+
+/**
+ * Allocates a new buffer, placing it on a NUMA node when one is given
+ */
+vsbuf* vsbuf_create(unsigned int cap, int node) {
+  vsbuf *b = NULL;
+  void *p = NULL;
+
+  if (node < 0) {
+    if ((b = (vsbuf *)malloc(sizeof(vsbuf) + cap)) != NULL) {
+      b->data = (char *)(b + 1);
+      b->node = -1;
+    }
+
+    return b;
+  }
+
+  if ((b = (vsbuf *)malloc(sizeof(vsbuf))) == NULL) {
+    return NULL;
+  }
+
+  /* the data is mapped on its own, so that placing its pages places nothing
+   * else; the pooled sizes are whole pages, and the pool keeps the buffer
+   * for reuse, so the mapping is paid for once */
+  if ((p = mmap(NULL, cap, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) {
+    free(b);
+    return NULL;
+  }
+
+  b->data = (char *)p;
+  b->node = (affinity_bind(p, cap, node) == ERR_SUCCESS) ? node : -1;
+
+  return b;
+}
+
+/**
+ * Frees a buffer, unmapping its data when that was placed on a node
+ */
+void vsbuf_destroy(vsbuf *b) {
+  if (b->data != (char *)(b + 1)) {
+    munmap(b->data, b->cap);
+  }
+
+  free(b);
+}
+
+/**
+ * Takes a buffer able to hold at least size bytes
+ */
+vsbuf* vsbuf_alloc(unsigned int size) {
+  int cls = vsbuf_class(size);
+  unsigned int cap = size;
+  vsbuf *b = NULL;
+
+  if (cls >= 0) {
+    cap = VSBUF_MIN_SIZE << cls;
+
+    /* reuse a buffer from the pool where one is available */
+    if ((b = vsbuf_pool[cls]) != NULL) {
+      vsbuf_pool[cls] = b->next;
+      vsbuf_pool_len[cls] --;
+    }
+  }
+
+  if (b == NULL) {
+    if ((b = vsbuf_create(cap, cls >= 0 ? vsbuf_node : -1)) == NULL) {
+      return NULL;
+    }
+  }
+
+  b->next = NULL;
+  atomic_init(&b->refs, 1);
+  b->len = 0;
+  b->cap = cap;
+
+  return b;
+}
+
+/**
+ * Moves the contents of a buffer into one able to hold at least size bytes
+ */
+vsbuf* vsbuf_grow(vsbuf *b, unsigned int size) {
+  vsbuf *grown = NULL;
+
+  if (b->cap >= size) {
+    return b;
+  }
+
+  if ((grown = vsbuf_alloc(size)) == NULL) {
+    return NULL;
+  }
+
+  memcpy(grown->data, b->data, b->len);
+  grown->len = b->len;
+  vsbuf_release(&b);
+
+  return grown;
+}
+
+/**
+ * Adds a reference to a buffer
+ */
+vsbuf* vsbuf_ref(vsbuf *b) {
+  atomic_fetch_add(&b->refs, 1);
+  return b;
+}
+
+/**
+ * Drops a reference to a buffer, handing it back to the pool when unused
+ */
+void vsbuf_release(vsbuf **b) {
+  int cls;
+
+  if (!b || !(*b)) {
+    return ;
+  }
+
+  if (atomic_fetch_sub(&(*b)->refs, 1) == 1) {
+    cls = vsbuf_class((*b)->cap);
+
+    /* a buffer placed for another thread's node isn't kept here */
+    if (cls >= 0 && vsbuf_pool_len[cls] < VSBUF_POOL_DEPTH && (*b)->node == vsbuf_node) {
+      (*b)->next = vsbuf_pool[cls];
+      vsbuf_pool[cls] = *b;
+      vsbuf_pool_len[cls] ++;
+    } else {
+      vsbuf_destroy(*b);
+    }
+  }
+
+  *b = NULL;
+}
+
+/**
+ * Places the calling thread's pooled buffers on a NUMA node from now on
+ */
+void vsbuf_pool_node(int node) {
+  vsbuf_node = node;
+}
+
+/**
+ * Frees every buffer held by the calling thread's pool
+ */
+void vsbuf_pool_teardown() {
+  int cls;
+  vsbuf *b = NULL;
+
+  for (cls = 0; cls < VSBUF_CLASSES; cls ++) {
+    while ((b = vsbuf_pool[cls]) != NULL) {
+      vsbuf_pool[cls] = b->next;
+      vsbuf_destroy(b);
+    }
+
+    vsbuf_pool_len[cls] = 0;
+  }
+}
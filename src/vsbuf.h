@@ -0,0 +1,72 @@
+#ifndef __varsvr_vsbuf_h_
+
+#define __varsvr_vsbuf_h_
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+
+#include "./affinity.h"
+#include "./errors.h"
+
+/* pooled buffers come in power of two sizes between these bounds */
+#define VSBUF_MIN_SIZE     4096
+#define VSBUF_MAX_POOLED   (1024 * 1024)
+
+/* number of released buffers each size class holds on to for reuse */
+#define VSBUF_POOL_DEPTH   64
+
+/**
+ * @struct _tag_vsbuf
+ * @brief A reference counted byte buffer. Buffers are drawn from and
+ *        returned to a pool of size classes so that connections can grow
+ *        and shrink their buffers without going back to the allocator.
+ *        Each thread keeps its own pool; a buffer may be shared between
+ *        threads, and goes back to the pool of whichever drops it last
+ */
+typedef struct _tag_vsbuf {
+  struct _tag_vsbuf *next;   /* link while the buffer sits in the pool */
+
+  atomic_uint refs;          /* number of holders of this buffer */
+  int node;                  /* NUMA node the memory was placed on, or -1 */
+  unsigned int len;          /* number of bytes in use */
+  unsigned int cap;          /* usable size of data */
+
+  char *data;                /* follows the header, unless placed on a node */
+} vsbuf;
+
+/**
+ * Takes a buffer able to hold at least size bytes
+ * @returns The buffer with a single reference, otherwise NULL
+ */
+vsbuf* vsbuf_alloc(unsigned int size);
+
+/**
+ * Moves the contents of a buffer into one able to hold at least size bytes.
+ * The original is released; only the sole holder of a buffer may grow it
+ * @returns The grown buffer, otherwise NULL with the original left intact
+ */
+vsbuf* vsbuf_grow(vsbuf *b, unsigned int size);
+
+/**
+ * Adds a reference to a buffer
+ */
+vsbuf* vsbuf_ref(vsbuf *b);
+
+/**
+ * Drops a reference to a buffer, handing it back to the pool when unused
+ */
+void vsbuf_release(vsbuf **b);
+
+/**
+ * Places the calling thread's pooled buffers on a NUMA node from now on
+ */
+void vsbuf_pool_node(int node);
+
+/**
+ * Frees every buffer held by the calling thread's pool
+ */
+void vsbuf_pool_teardown();
+
+#endif /* __varsvr_vsbuf_h_ */
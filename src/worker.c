@@ -0,0 +1,235 @@
+#include "./worker.h"
+
+vsworker *vs_worker_set = NULL;
+int vs_n_worker_set = 0;
+
+_Thread_local vsworker *vs_worker_self = NULL;
+
+/**
+ * Creates the workers
+ */
+int worker_init(int n) {
+  int i;
+
+  if ((vs_worker_set = (vsworker *)calloc(n, sizeof(vsworker))) == NULL) {
+    return ERR_NOMEM;
+  }
+
+  for (i = 0; i < n; i ++) {
+    vs_worker_set[i].id = i;
+    vs_worker_set[i].cpu = vs_worker_set[i].node = -1;
+    vs_worker_set[i].listener = -1;
+    vs_worker_set[i].poller.epoll_fd = -1;
+    pthread_mutex_init(&vs_worker_set[i].lock, NULL);
+    vs_n_worker_set ++;
+
+    if ((vs_worker_set[i].wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+      return ERR_NOMEM;
+    }
+  }
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Releases the workers and anything left in their mailboxes
+ */
+int worker_teardown() {
+  int i;
+  vsmail *m = NULL, *next = NULL;
+
+  for (i = 0; i < vs_n_worker_set; i ++) {
+    for (m = worker_take(&vs_worker_set[i]); m; m = next) {
+      next = m->next;
+
+      if (m->buf) {
+        vsbuf_release(&m->buf);
+      } else {
+        conn_destroy(&m->conn);
+      }
+
+      free(m);
+    }
+
+    if (vs_worker_set[i].wake_fd >= 0) {
+      close(vs_worker_set[i].wake_fd);
+    }
+
+    pthread_mutex_destroy(&vs_worker_set[i].lock);
+  }
+
+  free(vs_worker_set);
+  vs_worker_set = NULL;
+  vs_n_worker_set = 0;
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Finds the worker running on the calling thread
+ */
+vsworker* worker_self() {
+  return vs_worker_self;
+}
+
+/**
+ * Marks the calling thread as running a worker
+ */
+void worker_enter(vsworker *w) {
+  vs_worker_self = w;
+}
+
+/**
+ * Finds the worker pinned to a CPU
+ */
+vsworker* worker_for_cpu(int cpu) {
+  int i;
+
+  for (i = 0; i < vs_n_worker_set; i ++) {
+    if (vs_worker_set[i].cpu == cpu) {
+      return &vs_worker_set[i];
+    }
+  }
+
+  return NULL;
+}
+
+/**
+ * Interrupts a worker's wait. Only the first wake before the worker gets
+ * round to clearing it costs a system call; this is also safe to call from
+ * a signal handler
+ */
+void worker_wake(vsworker *w) {
+  uint64_t one = 1;
+
+  if (atomic_exchange(&w->woken, 1) == 0) {
+    while (write(w->wake_fd, &one, sizeof(one)) < 0 && errno == EINTR);
+  }
+}
+
+/**
+ * Wakes every worker
+ */
+void worker_wake_all() {
+  int i;
+
+  for (i = 0; i < vs_n_worker_set; i ++) {
+    worker_wake(&vs_worker_set[i]);
+  }
+}
+
+/**
+ * Wakes the other workers serving replicas
+ */
+void worker_wake_replicas() {
+  int i;
+
+  for (i = 0; i < vs_n_worker_set; i ++) {
+    if (&vs_worker_set[i] != vs_worker_self && atomic_load(&vs_worker_set[i].replicas) > 0) {
+      worker_wake(&vs_worker_set[i]);
+    }
+  }
+}
+
+/**
+ * Clears a worker's wake after it has been interrupted
+ */
+void worker_clear(vsworker *w) {
+  uint64_t count;
+
+  /* clear the flag first, so that a wake arriving during the read still
+   * leaves the eventfd readable */
+  atomic_store(&w->woken, 0);
+  while (read(w->wake_fd, &count, sizeof(count)) < 0 && errno == EINTR);
+}
+
+/**
+ * Appends to a worker's mailbox
+ */
+int worker_send(vsworker *w, vsconn *c, vsbuf *b) {
+  vsmail *m = (vsmail *)malloc(sizeof(vsmail));
+
+  if (m == NULL) {
+    return ERR_NOMEM;
+  }
+
+  m->next = NULL;
+  m->conn = c;
+  m->buf = b;
+
+  pthread_mutex_lock(&w->lock);
+
+  if (w->mail_tail) {
+    w->mail_tail->next = m;
+  } else {
+    w->mail_head = m;
+  }
+
+  w->mail_tail = m;
+  pthread_mutex_unlock(&w->lock);
+
+  worker_wake(w);
+
+  return ERR_SUCCESS;
+}
+
+/**
+ * Leaves output for one of a worker's connections
+ */
+int worker_post(vsworker *w, vsconn *c, vsbuf *b) {
+  int rc = worker_send(w, c, vsbuf_ref(b));
+
+  if (rc != ERR_SUCCESS) {
+    vsbuf_release(&b);
+  }
+
+  return rc;
+}
+
+/**
+ * Hands a connection over to a worker
+ */
+int worker_adopt(vsworker *w, vsconn *c) {
+  c->worker = w;
+
+  return worker_send(w, c, NULL);
+}
+
+/**
+ * Takes everything waiting in a worker's mailbox
+ */
+vsmail* worker_take(vsworker *w) {
+  vsmail *m = NULL;
+
+  pthread_mutex_lock(&w->lock);
+  m = w->mail_head;
+  w->mail_head = w->mail_tail = NULL;
+  pthread_mutex_unlock(&w->lock);
+
+  return m;
+}
+
+/**
+ * Discards output waiting in a worker's mailbox for a closing connection
+ */
+void worker_purge(vsworker *w, vsconn *c) {
+  vsmail **m = NULL, *gone = NULL;
+
+  pthread_mutex_lock(&w->lock);
+
+  for (m = &w->mail_head; *m; ) {
+    if ((*m)->conn == c && (*m)->buf) {
+      gone = *m;
+      *m = gone->next;
+      vsbuf_release(&gone->buf);
+      free(gone);
+    } else {
+      m = &(*m)->next;
+    }
+  }
+
+  /* the tail may have been among those discarded */
+  for (w->mail_tail = w->mail_head; w->mail_tail && w->mail_tail->next; w->mail_tail = w->mail_tail->next);
+
+  pthread_mutex_unlock(&w->lock);
+}
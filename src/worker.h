@@ -0,0 +1,140 @@
+#ifndef __varsvr_worker_h_
+
+#define __varsvr_worker_h_
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+#include <sys/poll.h>
+
+#include "./conn.h"
+#include "./vsbuf.h"
+#include "./poller.h"
+#include "./errors.h"
+
+/*
+ * Event loop threads. Each worker owns the connections in its descriptor
+ * table outright: only its own thread reads, writes or closes them. When
+ * another worker has something for one of them (a change notification, or
+ * a connection to take over) it is left in the owner's mailbox and the
+ * owner is woken through its eventfd.
+ */
+
+/* most workers that can be configured */
+#define WORKER_MAX 64
+
+/**
+ * @struct _tag_vsmail
+ * @brief Something handed to a worker by another thread
+ */
+typedef struct _tag_vsmail {
+  struct _tag_vsmail *next;
+
+  vsconn *conn;
+  vsbuf *buf;             /* output to queue on conn, or NULL to adopt conn */
+} vsmail;
+
+/**
+ * @struct _tag_vsworker
+ * @brief An event loop thread and the connections it serves
+ */
+typedef struct _tag_vsworker {
+  int id;
+  pthread_t thread;
+  int cpu;                /* CPU the thread is pinned to, or -1 */
+  int node;               /* NUMA node it allocates from, or -1 */
+
+  int wake_fd;            /* eventfd that interrupts its wait */
+  atomic_int woken;       /* set while a wake is outstanding */
+  atomic_int replicas;    /* downstream replica connections it serves */
+
+  pthread_mutex_t lock;   /* guards the mailbox */
+  vsmail *mail_head;
+  vsmail *mail_tail;
+
+  int listener;           /* TCP listener; shared port with SO_REUSEPORT */
+
+  struct pollfd *fds;     /* descriptor table: wake_fd, listeners, clients */
+  vsconn **conns;
+  int n_fds;
+  int n_listeners;        /* leading slots that aren't client connections */
+  int next_client;        /* client slot served first in the next pass */
+  vspoller poller;
+} vsworker;
+
+extern vsworker *vs_worker_set;
+extern int vs_n_worker_set;
+
+/**
+ * Creates the workers
+ */
+int worker_init(int n);
+
+/**
+ * Releases the workers and anything left in their mailboxes
+ */
+int worker_teardown();
+
+/**
+ * Finds the worker running on the calling thread
+ */
+vsworker* worker_self();
+
+/**
+ * Marks the calling thread as running a worker
+ */
+void worker_enter(vsworker *w);
+
+/**
+ * Finds the worker pinned to a CPU
+ * @returns The worker, otherwise NULL
+ */
+vsworker* worker_for_cpu(int cpu);
+
+/**
+ * Interrupts a worker's wait
+ */
+void worker_wake(vsworker *w);
+
+/**
+ * Wakes every worker
+ */
+void worker_wake_all();
+
+/**
+ * Wakes the other workers serving replicas, so they send on new mutations
+ */
+void worker_wake_replicas();
+
+/**
+ * Clears a worker's wake after it has been interrupted
+ */
+void worker_clear(vsworker *w);
+
+/**
+ * Leaves output for one of a worker's connections; the buffer gains a
+ * reference
+ */
+int worker_post(vsworker *w, vsconn *c, vsbuf *b);
+
+/**
+ * Hands a connection over to a worker
+ */
+int worker_adopt(vsworker *w, vsconn *c);
+
+/**
+ * Takes everything waiting in a worker's mailbox, oldest first
+ */
+vsmail* worker_take(vsworker *w);
+
+/**
+ * Discards output waiting in a worker's mailbox for a connection that is
+ * closing
+ */
+void worker_purge(vsworker *w, vsconn *c);
+
+#endif /* __varsvr_worker_h_ */
@@ -0,0 +1,294 @@
+#include "./harness.h"
+
+/*
+ * Drives the fuzz target without libFuzzer. Each file named, and each file
+ * in each directory named, is run through the target once; with no names
+ * the input is read from stdin, so that AFL can run it either way:
+ *
+ *   fuzz-proto [-n <runs>] [-s <seed>] [-m <max length>] [<file>|<dir> ...]
+ *
+ * Given a number of runs, it then fuzzes by itself: each run takes one of
+ * the inputs and mutates it, with bit flips, bytes the parser cares about,
+ * protocol words, and ranges cut, copied and spliced in from other inputs.
+ * Runs follow from the seed, and an input that brings a sanitizer down is
+ * written out to crash-<seed>-<run> first.
+ */
+
+#define FUZZ_MAX_INPUT  4096
+
+/**
+ * @struct _tag_vsinput
+ * @brief An input to run, and mutate
+ */
+typedef struct _tag_vsinput {
+  unsigned char *data;
+  size_t len;
+} vsinput;
+
+int LLVMFuzzerTestOneInput(const unsigned char *data, size_t size);
+
+/* set when built with a sanitizer, which calls back before it exits */
+void __sanitizer_set_death_callback(void (*callback)(void)) __attribute__((weak));
+
+const char *vs_fuzz_words[] = {
+  "GET ", "SET ", "DEL ", "INCR ", "VERSION ", "MULTI\r\n", "EXEC\r\n", "DISCARD\r\n",
+  "CHECK ", "WATCH ", "UNWATCH ", "SYNC ", "SHM\r\n", "STATS\r\n", "LATENCY", "SLOWLOG ",
+  "HOTKEYS ", " RESET", " VALUES", "\r\n", "\n", " ", "*", "-", "-1", "0", "4294967295",
+  "18446744073709551616", "99999999999999999999", "bit", "int8", "int16", "int32", "int64",
+  "float4", "float8", "text", "null", "nan", "1e308", "key", "key*", " 0\r\n\r\n", " 5\r\nhello\r\n"
+};
+
+const unsigned char vs_fuzz_bytes[] = { 0, '\r', '\n', ' ', '\t', '*', '-', '0', '9', 0x7f, 0x80, 0xff };
+
+vsinput *vs_fuzz_inputs = NULL;
+size_t vs_fuzz_n_inputs = 0;
+unsigned long long vs_fuzz_seed = 1;
+unsigned long long vs_fuzz_run = 0;
+unsigned char *vs_fuzz_current = NULL;
+size_t vs_fuzz_current_len = 0;
+
+/**
+ * Writes out the input being run, as a sanitizer brings the process down
+ */
+void fuzz_save() {
+  char path[64];
+  FILE *f = NULL;
+
+  snprintf(path, sizeof(path), "crash-%llu-%llu", vs_fuzz_seed, vs_fuzz_run);
+
+  if (vs_fuzz_current && (f = fopen(path, "wb")) != NULL) {
+    fwrite(vs_fuzz_current, 1, vs_fuzz_current_len, f);
+    fclose(f);
+    fprintf(stderr, "fuzz-proto: input written to %s\n", path);
+  }
+}
+
+/**
+ * Runs an input through the target
+ */
+void fuzz_run(unsigned char *data, size_t len) {
+  vs_fuzz_current = data;
+  vs_fuzz_current_len = len;
+  LLVMFuzzerTestOneInput(data, len);
+  vs_fuzz_current = NULL;
+}
+
+/**
+ * Reads a whole file
+ */
+int fuzz_read(FILE *f, vsinput *in) {
+  unsigned char buf[4096];
+  size_t n;
+
+  in->data = NULL;
+  in->len = 0;
+
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+    if ((in->data = (unsigned char *)realloc(in->data, in->len + n)) == NULL) {
+      return -1;
+    }
+
+    memcpy(in->data + in->len, buf, n);
+    in->len += n;
+  }
+
+  return ferror(f) ? -1 : 0;
+}
+
+/**
+ * Runs a file through the target, keeping it to mutate
+ */
+int fuzz_load(const char *path) {
+  FILE *f = fopen(path, "rb");
+  vsinput in;
+  int rc;
+
+  if (f == NULL) {
+    fprintf(stderr, "fuzz-proto: unable to open %s\n", path);
+    return -1;
+  }
+
+  rc = fuzz_read(f, &in);
+  fclose(f);
+
+  if (rc != 0) {
+    free(in.data);
+    fprintf(stderr, "fuzz-proto: unable to read %s\n", path);
+    return -1;
+  }
+
+  vs_fuzz_inputs = (vsinput *)realloc(vs_fuzz_inputs, (vs_fuzz_n_inputs + 1) * sizeof(vsinput));
+  vs_fuzz_inputs[vs_fuzz_n_inputs ++] = in;
+  fuzz_run(in.data, in.len);
+
+  return 0;
+}
+
+/**
+ * Runs a file, or every file in a directory, through the target
+ */
+int fuzz_load_path(const char *path) {
+  char sub[PATH_MAX];
+  struct stat st;
+  struct dirent *e = NULL;
+  DIR *d = NULL;
+  int rc = 0;
+
+  if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+    return fuzz_load(path);
+  }
+
+  if ((d = opendir(path)) == NULL) {
+    fprintf(stderr, "fuzz-proto: unable to open %s\n", path);
+    return -1;
+  }
+
+  while (rc == 0 && (e = readdir(d)) != NULL) {
+    if (e->d_name[0] != '.') {
+      snprintf(sub, sizeof(sub), "%s/%s", path, e->d_name);
+      rc = fuzz_load(sub);
+    }
+  }
+
+  closedir(d);
+
+  return rc;
+}
+
+/**
+ * Makes a random change to an input
+ */
+size_t fuzz_mutate(unsigned char *buf, size_t len, size_t max, unsigned long long *rng) {
+  const char *word = NULL;
+  unsigned char *range = NULL;
+  vsinput *other = NULL;
+  size_t at = len ? harness_rand(rng) % len : 0, n;
+
+  switch (harness_rand(rng) % 7) {
+    case 0:
+      if (len) {
+        buf[at] ^= (unsigned char)(1 << (harness_rand(rng) % 8));
+      }
+      break;
+    case 1:
+      if (len) {
+        buf[at] = vs_fuzz_bytes[harness_rand(rng) % sizeof(vs_fuzz_bytes)];
+      }
+      break;
+    case 2:
+      word = vs_fuzz_words[harness_rand(rng) % (sizeof(vs_fuzz_words) / sizeof(vs_fuzz_words[0]))];
+      n = strlen(word);
+
+      if (len + n <= max) {
+        memmove(buf + at + n, buf + at, len - at);
+        memcpy(buf + at, word, n);
+        len += n;
+      }
+      break;
+    case 3:
+      n = len - at ? 1 + harness_rand(rng) % (len - at) : 0;
+      memmove(buf + at, buf + at + n, len - at - n);
+      len -= n;
+      break;
+    case 4:
+      /* a range repeated elsewhere, as pipelined requests are */
+      n = len - at ? 1 + harness_rand(rng) % (len - at) : 0;
+
+      if (len + n <= max && (range = (unsigned char *)malloc(n)) != NULL) {
+        memcpy(range, buf + at, n);
+        at = harness_rand(rng) % (len + 1);
+        memmove(buf + at + n, buf + at, len - at);
+        memcpy(buf + at, range, n);
+        free(range);
+        len += n;
+      }
+      break;
+    case 5:
+      /* another input's tail in place of this one's */
+      other = &vs_fuzz_inputs[harness_rand(rng) % vs_fuzz_n_inputs];
+      n = other->len ? harness_rand(rng) % other->len : 0;
+
+      if (other->len > n && at + other->len - n <= max) {
+        memcpy(buf + at, other->data + n, other->len - n);
+        len = at + other->len - n;
+      }
+      break;
+    default:
+      len = len > 0 ? len - 1 : 0;
+      break;
+  }
+
+  return len;
+}
+
+int main(int argc, char **argv) {
+  unsigned long long runs = 0, rng;
+  size_t max = FUZZ_MAX_INPUT, len;
+  unsigned char *buf = NULL;
+  vsinput in;
+  int opt, i, n;
+
+  while ((opt = getopt(argc, argv, "n:s:m:")) != -1) {
+    if (opt == 'n') {
+      runs = strtoull(optarg, NULL, 10);
+    } else if (opt == 's') {
+      vs_fuzz_seed = strtoull(optarg, NULL, 10);
+    } else if (opt == 'm') {
+      max = strtoul(optarg, NULL, 10);
+    } else {
+      fprintf(stderr, "usage: %s [-n <runs>] [-s <seed>] [-m <max length>] [<file>|<dir> ...]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  if (max == 0) {
+    max = FUZZ_MAX_INPUT;
+  }
+
+  if (__sanitizer_set_death_callback) {
+    __sanitizer_set_death_callback(fuzz_save);
+  }
+
+  if (optind == argc) {
+    if (fuzz_read(stdin, &in) != 0) {
+      return 1;
+    }
+
+    vs_fuzz_inputs = (vsinput *)malloc(sizeof(vsinput));
+    vs_fuzz_inputs[vs_fuzz_n_inputs ++] = in;
+    fuzz_run(in.data, in.len);
+  }
+
+  for (i = optind; i < argc; i ++) {
+    if (fuzz_load_path(argv[i]) != 0) {
+      return 1;
+    }
+  }
+
+  if (runs == 0) {
+    return 0;
+  }
+
+  buf = (unsigned char *)malloc(max);
+  rng = vs_fuzz_seed;
+
+  for (vs_fuzz_run = 1; vs_fuzz_run <= runs; vs_fuzz_run ++) {
+    in = vs_fuzz_inputs[harness_rand(&rng) % vs_fuzz_n_inputs];
+    len = in.len < max ? in.len : max;
+
+    if (len > 0) {
+      memcpy(buf, in.data, len);
+    }
+
+    for (n = 1 + harness_rand(&rng) % 4; n > 0; n --) {
+      len = fuzz_mutate(buf, len, max, &rng);
+    }
+
+    fuzz_run(buf, len);
+  }
+
+  printf("fuzz-proto: %zu inputs, %llu runs, seed %llu: ok\n", vs_fuzz_n_inputs, runs, vs_fuzz_seed);
+  free(buf);
+
+  return 0;
+}
@@ -0,0 +1,54 @@
+#include "./harness.h"
+
+/*
+ * Fuzz target for the request parser and everything a request reaches. An
+ * input is sent down a fresh connection all at once, and then down another
+ * a few bytes at a time, so that requests split at every point are parsed
+ * too; the store is emptied between inputs. Tracing and the hot key cache
+ * are on, so that they see the same requests.
+ *
+ * This is a libFuzzer target, built as one with clang's -fsanitize=fuzzer
+ * (make fuzz); otherwise fuzz_main.c drives it (see there).
+ */
+
+/* bytes sent at a time the second time round */
+#define FUZZ_CHUNK  7
+
+/**
+ * Sends an input down a fresh connection
+ */
+void fuzz_send(const unsigned char *data, size_t size, size_t chunk) {
+  vstestconn t;
+
+  if (harness_open(&t, 0) != 0) {
+    return;
+  }
+
+  harness_send(&t, (const char *)data, size, chunk);
+  harness_replies(&t, NULL, 0);
+  harness_close(&t);
+}
+
+int LLVMFuzzerTestOneInput(const unsigned char *data, size_t size) {
+  static int ready = 0;
+
+  if (!ready) {
+    vs_trace = 1;
+    vs_hot_cache = 1;
+
+    if (harness_init(1) != 0) {
+      abort();
+    }
+
+    ready = 1;
+  }
+
+  fuzz_send(data, size, size ? size : 1);
+  fuzz_send(data, size, FUZZ_CHUNK);
+
+  store_write_lock();
+  store_clear();
+  store_unlock();
+
+  return 0;
+}
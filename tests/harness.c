@@ -0,0 +1,228 @@
+#include "./harness.h"
+
+/**
+ * Sets up the store and everything around it
+ */
+int harness_init(int workers) {
+  log_init(0);
+  setlogmask(LOG_UPTO(LOG_CRIT));
+
+  if (store_init() != ERR_SUCCESS || admit_init() != ERR_SUCCESS ||
+      pubsub_init() != ERR_SUCCESS || repl_init() != ERR_SUCCESS ||
+      worker_init(workers) != ERR_SUCCESS || trace_init(vs_n_worker_set) != ERR_SUCCESS ||
+      hotkey_init(vs_n_worker_set) != ERR_SUCCESS) {
+    fprintf(stderr, "harness: unable to set up the server\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * Tears everything down again
+ */
+void harness_teardown() {
+  hotkey_teardown();
+  trace_teardown();
+  worker_teardown();
+  repl_teardown();
+  pubsub_teardown();
+  admit_teardown();
+  defrag_teardown();
+  store_teardown();
+  vsbuf_pool_teardown();
+  log_teardown();
+}
+
+/**
+ * Opens a connection served by a worker
+ */
+int harness_open(vstestconn *t, int worker) {
+  int fds[2];
+
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds) < 0) {
+    return -1;
+  }
+
+  if ((t->c = conn_create(fds[0])) == NULL) {
+    close(fds[0]);
+    close(fds[1]);
+    return -1;
+  }
+
+  t->c->worker = &vs_worker_set[worker];
+  t->peer = fds[1];
+
+  if (admit_accept() != ERR_SUCCESS || admit_attach(t->c, NULL) != ERR_SUCCESS) {
+    harness_close(t);
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * Closes a connection the way its worker would
+ */
+void harness_close(vstestconn *t) {
+  store_write_lock();
+  pubsub_unwatch_all(t->c);
+  worker_purge(t->c->worker, t->c);
+  store_unlock();
+
+  conn_destroy(&t->c);
+  close(t->peer);
+  t->peer = -1;
+}
+
+/**
+ * Serves every complete request the connection has received, as the
+ * event loop would over however many passes it takes
+ */
+void harness_serve(vstestconn *t) {
+  vsconn *c = t->c;
+  unsigned int left;
+
+  worker_enter(c->worker);
+
+  while (!c->closing && c->in && c->in->len > 0) {
+    left = c->in->len;
+
+    if (proto_process(c) != ERR_SUCCESS) {
+      c->closing = 1;
+    }
+
+    if (c->downstream) {
+      store_read_lock();
+      repl_pump(c);
+      store_unlock();
+    }
+
+    /* a client paused for not reading its replies has them thrown away,
+     * so that it carries on */
+    if (c->paused) {
+      harness_replies(t, NULL, 0);
+    }
+
+    if (conn_flush(c) != ERR_SUCCESS) {
+      c->closing = 1;
+    }
+
+    /* what's left is an unfinished request waiting on more input, unless
+     * requests were put off to another pass or behind unread output */
+    if (c->in && c->in->len == left && !c->backlog && !c->paused) {
+      break;
+    }
+  }
+}
+
+/**
+ * Reports a test's failure and exits
+ */
+void harness_fail(const char *test, const char *fmt, ...) {
+  va_list ap;
+
+  fprintf(stderr, "%s: ", test);
+  va_start(ap, fmt);
+  vfprintf(stderr, fmt, ap);
+  va_end(ap);
+  fputc('\n', stderr);
+
+  exit(1);
+}
+
+/**
+ * Sends bytes down a connection, a chunk at a time
+ */
+int harness_send(vstestconn *t, const char *data, size_t len, size_t chunk) {
+  size_t off = 0, n;
+  ssize_t rc;
+
+  while (off < len && !t->c->closing) {
+    n = (len - off < chunk) ? len - off : chunk;
+
+    if ((rc = send(t->peer, data + off, n, MSG_NOSIGNAL)) <= 0) {
+      return -1;
+    }
+
+    off += rc;
+
+    while (!t->c->closing && conn_read(t->c) > 0) {
+      harness_serve(t);
+    }
+  }
+
+  return t->c->closing ? -1 : 0;
+}
+
+/**
+ * Reads whatever replies are waiting
+ */
+size_t harness_replies(vstestconn *t, char *out, size_t size) {
+  char scratch[4096];
+  size_t kept = 0;
+  ssize_t rc;
+
+  while ((rc = recv(t->peer, scratch, sizeof(scratch), 0)) > 0) {
+    if (out && kept + 1 < size) {
+      rc = (kept + rc + 1 > size) ? (ssize_t)(size - kept - 1) : rc;
+      memcpy(out + kept, scratch, rc);
+      kept += rc;
+    }
+  }
+
+  if (out && size > 0) {
+    out[kept] = 0;
+  }
+
+  return kept;
+}
+
+/**
+ * Sends a request and reads its reply
+ */
+void harness_request(const char *test, vstestconn *t, const char *req, char *reply, size_t size) {
+  if (harness_send(t, req, strlen(req), strlen(req)) != 0) {
+    harness_fail(test, "connection closed (request \"%.64s\")", req);
+  }
+
+  harness_replies(t, reply, size);
+}
+
+/**
+ * Acts on what other workers have left in a worker's mailbox
+ */
+void harness_drain(int worker) {
+  vsworker *w = &vs_worker_set[worker];
+  vsmail *m = NULL, *next = NULL;
+
+  worker_enter(w);
+
+  for (m = worker_take(w); m; m = next) {
+    next = m->next;
+
+    /* no connections are handed between workers here, only notifications */
+    if (m->buf) {
+      pubsub_deliver(m->conn, m->buf);
+      vsbuf_release(&m->buf);
+    }
+
+    free(m);
+  }
+
+  pubsub_flush();
+}
+
+/**
+ * Draws the next number from a seeded generator (xorshift64*)
+ */
+unsigned long long harness_rand(unsigned long long *state) {
+  unsigned long long x = *state ? *state : 0x9e3779b97f4a7c15ULL;
+
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  *state = x;
+
+  return x * 0x2545f4914f6cdd1dULL;
+}
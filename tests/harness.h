@@ -0,0 +1,96 @@
+#ifndef __varsvr_harness_h_
+
+#define __varsvr_harness_h_
+
+#include <dirent.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include "../src/daemon.h"
+
+/*
+ * Runs the server's request path in-process, without listeners or event
+ * loops. A test connection is one end of a socket pair handed to the
+ * server's connection code; the test holds the other end, writing
+ * requests into it and reading replies out of it. Whichever thread
+ * serves a connection acts as the worker it belongs to.
+ */
+
+/* most reply bytes kept for a test to look at */
+#define HARNESS_REPLY_MAX   (64 * 1024)
+
+/**
+ * @struct _tag_vstestconn
+ * @brief A connection to the in-process server, and the test's end of it
+ */
+typedef struct _tag_vstestconn {
+  vsconn *c;
+  int peer;
+} vstestconn;
+
+/**
+ * Sets up the store and everything around it for some number of workers;
+ * the server logs nothing below critical
+ */
+int harness_init(int workers);
+
+/**
+ * Tears everything down again
+ */
+void harness_teardown();
+
+/**
+ * Opens a connection served by a worker
+ */
+int harness_open(vstestconn *t, int worker);
+
+/**
+ * Closes a connection the way its worker would
+ */
+void harness_close(vstestconn *t);
+
+/**
+ * Reports a test's failure on stderr, prefixed with the test's name and
+ * formatted as printf would, and exits
+ */
+void harness_fail(const char *test, const char *fmt, ...);
+
+/**
+ * Sends bytes down a connection, a chunk at a time, serving whatever
+ * requests are complete after each chunk
+ * @returns 0, otherwise -1 once the server has closed the connection
+ */
+int harness_send(vstestconn *t, const char *data, size_t len, size_t chunk);
+
+/**
+ * Reads whatever replies are waiting, keeping up to size - 1 bytes of them
+ * NUL terminated in out (which may be NULL to discard them)
+ * @returns The number of bytes kept
+ */
+size_t harness_replies(vstestconn *t, char *out, size_t size);
+
+/**
+ * Sends a request and reads its reply, failing the test when the server
+ * closes the connection instead
+ */
+void harness_request(const char *test, vstestconn *t, const char *req, char *reply, size_t size);
+
+/**
+ * Acts on what other workers have left in a worker's mailbox, as its event
+ * loop would; the caller acts as that worker
+ */
+void harness_drain(int worker);
+
+/**
+ * Draws the next number from a seeded generator, so that a failing run can
+ * be repeated from its seed
+ */
+unsigned long long harness_rand(unsigned long long *state);
+
+#endif /* __varsvr_harness_h_ */
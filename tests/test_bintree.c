@@ -0,0 +1,331 @@
+#include "./harness.h"
+
+/*
+ * Differential test of the store's index: random inserts, finds and
+ * deletes are applied both to a tree and to a sorted array of the same
+ * keys, and every result the tree gives must match the array's. Keys are
+ * drawn from a pool built out of shared segments, so that the tree sees
+ * long common prefixes, keys that are prefixes of each other, and bytes on
+ * either side of the signed char boundary. Every so often both walks are
+ * checked against the array, the link walk moving nodes the way
+ * defragmentation does. Some keys are taken out and put back before they
+ * are deleted, as a transaction rolling back does. The whole run repeats
+ * with nodes allocated from slabs.
+ *
+ *   test-bintree [-n <operations>] [-s <seed>]
+ */
+
+#define TEST_POOL         4096
+#define TEST_CHECK_EVERY  1000
+
+/**
+ * @struct _tag_vsmodel
+ * @brief The reference the tree is checked against: its keys, sorted
+ */
+typedef struct _tag_vsmodel {
+  char **keys;
+  void **data;
+  unsigned int n;
+} vsmodel;
+
+/**
+ * @struct _tag_vslinkcheck
+ * @brief A link walk's progress through the model
+ */
+typedef struct _tag_vslinkcheck {
+  vsmodel *m;
+  unsigned int next;
+  unsigned int stop;
+  int slab;
+} vslinkcheck;
+
+const char *vs_test_segments[] = {
+  "a", "b", "ab", "user", "user:", "session", "0", "00", "/", "x/y", "\xff", "\x01", "\x80z"
+};
+
+char *vs_test_pool[TEST_POOL];
+unsigned long long vs_test_rng = 1;
+unsigned long long vs_test_op = 0;
+unsigned long long vs_test_seed = 1;
+bintree_alloc vs_test_alloc = NULL;
+bintree_release vs_test_release = NULL;
+
+/**
+ * Reports a mismatch and gives up
+ */
+void test_fail(const char *what, const char *key) {
+  fprintf(stderr, "test-bintree: %s (key \"%s\", operation %llu, seed %llu)\n",
+          what, key ? key : "", vs_test_op, vs_test_seed);
+  exit(1);
+}
+
+/**
+ * Builds a key out of shared segments and random bytes
+ */
+char* test_key() {
+  char key[256];
+  unsigned int len = 0, i, n, segs = harness_rand(&vs_test_rng) % 7;
+  const char *seg = NULL;
+
+  for (i = 0; i < segs; i ++) {
+    seg = vs_test_segments[harness_rand(&vs_test_rng) %
+                           (sizeof(vs_test_segments) / sizeof(vs_test_segments[0]))];
+
+    if (len + strlen(seg) + 1 < 200) {
+      memcpy(key + len, seg, strlen(seg));
+      len += strlen(seg);
+    }
+  }
+
+  for (n = harness_rand(&vs_test_rng) % 24, i = 0; i < n; i ++) {
+    key[len ++] = (char)(1 + harness_rand(&vs_test_rng) % 255);
+  }
+
+  key[len] = 0;
+
+  return strdup(key);
+}
+
+/**
+ * Finds where a key is, or would be, in the model
+ */
+unsigned int model_search(vsmodel *m, const char *key, int *found) {
+  unsigned int lo = 0, hi = m->n, mid;
+  int cmp;
+
+  *found = 0;
+
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+
+    if ((cmp = strcmp(m->keys[mid], key)) == 0) {
+      *found = 1;
+      return mid;
+    } else if (cmp < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  return lo;
+}
+
+/**
+ * Checks that a walk visits the model's keys in order
+ */
+int test_visit(void *key, void *data, void *arg) {
+  vslinkcheck *lc = (vslinkcheck *)arg;
+
+  if (lc->next >= lc->m->n || strcmp((char *)key, lc->m->keys[lc->next]) != 0) {
+    test_fail("walk visited an unexpected key", (char *)key);
+  }
+
+  if (data != lc->m->data[lc->next ++]) {
+    test_fail("walk handed back the wrong data", (char *)key);
+  }
+
+  return lc->next == lc->stop ? 2 : 0;
+}
+
+/**
+ * Checks that a link walk visits the model's keys in order, moving some of
+ * the nodes as it goes
+ */
+int test_visit_link(bintree_node **link, void *arg) {
+  vslinkcheck *lc = (vslinkcheck *)arg;
+  bintree_node *n = *link, *c = NULL;
+  size_t size = bintree_node_size(n->len);
+  int move;
+
+  if (n->len != strlen(n->key)) {
+    test_fail("node holds the wrong key length", n->key);
+  }
+
+  test_visit(n->key, n->data, arg);
+
+  move = lc->slab ? slab_movable(n, size) : (int)(harness_rand(&vs_test_rng) & 1);
+
+  if (move && (c = (bintree_node *)vs_test_alloc(size)) != NULL) {
+    memcpy(c, n, size);
+    *link = c;
+    vs_test_release(n);
+  }
+
+  return lc->next == lc->stop ? 2 : 0;
+}
+
+/**
+ * Walks the whole tree and part of it, checking both against the model
+ */
+void test_check(bintree *t, vsmodel *m, int slab) {
+  vslinkcheck lc;
+  const char *after = vs_test_pool[harness_rand(&vs_test_rng) % TEST_POOL];
+  int found, rc;
+
+  memset(&lc, 0, sizeof(lc));
+  lc.m = m;
+  lc.slab = slab;
+
+  if (bintree_walk(t, test_visit, &lc) != 0 || lc.next != m->n) {
+    test_fail("walk missed keys", NULL);
+  }
+
+  /* a link walk starts after its key, whether or not the key is held, and
+   * stops where its visitor says to */
+  lc.next = model_search(m, after, &found) + found;
+  lc.stop = (harness_rand(&vs_test_rng) & 1) ? lc.next + 1 + harness_rand(&vs_test_rng) % 64 : 0;
+  rc = bintree_walk_links(t, after, test_visit_link, &lc);
+
+  if (lc.stop && lc.stop <= m->n ? rc != 2 || lc.next != lc.stop : rc != 0 || lc.next != m->n) {
+    test_fail("link walk missed keys", after);
+  }
+}
+
+/**
+ * Runs random operations against the tree and the model
+ */
+void test_run(unsigned long long ops, int slab) {
+  bintree *t = bintree_create();
+  vsmodel m;
+  char *key = NULL, *fresh = NULL;
+  void *data = NULL, *odata = NULL;
+  bintree_node *n = NULL;
+  unsigned long long serial = 0, reserved, unused;
+  unsigned int i, r;
+  int found, rc;
+
+  memset(&m, 0, sizeof(m));
+  m.keys = (char **)malloc(TEST_POOL * sizeof(char *));
+  m.data = (void **)malloc(TEST_POOL * sizeof(void *));
+
+  vs_test_alloc = slab ? slab_alloc : malloc;
+  vs_test_release = slab ? slab_free : free;
+
+  if (slab) {
+    bintree_set_allocator(t, slab_alloc, slab_free);
+  }
+
+  for (vs_test_op = 0; vs_test_op < ops; vs_test_op ++) {
+    r = harness_rand(&vs_test_rng) % 100;
+
+    /* keys come from the pool, so that operations find each other's, but
+     * some lookups are for keys the tree is unlikely to hold */
+    fresh = (r >= 40 && r % 10 == 0) ? test_key() : NULL;
+    key = fresh ? fresh : vs_test_pool[harness_rand(&vs_test_rng) % TEST_POOL];
+    i = model_search(&m, key, &found);
+
+    if (r < 40) {
+      data = (void *)(uintptr_t)++ serial;
+      rc = bintree_insert(t, key, data);
+
+      if (found ? rc != -1 : rc != 0) {
+        test_fail(found ? "inserted a key twice" : "failed to insert", key);
+      }
+
+      if (!found) {
+        memmove(m.keys + i + 1, m.keys + i, (m.n - i) * sizeof(char *));
+        memmove(m.data + i + 1, m.data + i, (m.n - i) * sizeof(void *));
+        m.keys[i] = strdup(key);
+        m.data[i] = data;
+        m.n ++;
+      }
+    } else if (r < 70) {
+      if (bintree_find(t, key) != (found ? m.data[i] : NULL)) {
+        test_fail("found the wrong data", key);
+      }
+    } else {
+      /* a key taken out is gone until it's put back, in its own node */
+      if (found && (r & 1) &&
+          ((n = bintree_detach(t, key)) == NULL || n->data != m.data[i] ||
+           bintree_find(t, key) != NULL || bintree_attach(t, n) != 0 ||
+           bintree_attach(t, n) != -1 || bintree_find(t, key) != m.data[i])) {
+        test_fail("failed to take a key out and put it back", key);
+      }
+
+      odata = NULL;
+      rc = bintree_delete(t, key, &odata);
+
+      if (found ? rc != 0 || odata != m.data[i] : rc != -1) {
+        test_fail(found ? "failed to delete" : "deleted a missing key", key);
+      }
+
+      if (found) {
+        free(m.keys[i]);
+        memmove(m.keys + i, m.keys + i + 1, (m.n - i - 1) * sizeof(char *));
+        memmove(m.data + i, m.data + i + 1, (m.n - i - 1) * sizeof(void *));
+        m.n --;
+      }
+    }
+
+    free(fresh);
+
+    if (vs_test_op % TEST_CHECK_EVERY == 0) {
+      test_check(t, &m, slab);
+    }
+  }
+
+  test_check(t, &m, slab);
+
+  /* emptied in random order, the tree has nothing left */
+  while (m.n > 0) {
+    i = harness_rand(&vs_test_rng) % m.n;
+
+    if (bintree_delete(t, m.keys[i], &odata) != 0 || odata != m.data[i]) {
+      test_fail("failed to delete while emptying", m.keys[i]);
+    }
+
+    free(m.keys[i]);
+    m.keys[i] = m.keys[-- m.n];
+    m.data[i] = m.data[m.n];
+  }
+
+  if (t->root != NULL) {
+    test_fail("tree isn't empty", NULL);
+  }
+
+  bintree_destroy(&t);
+  free(m.keys);
+  free(m.data);
+
+  /* and every slab went back as its last node was freed */
+  slab_stats(&reserved, &unused);
+
+  if (reserved != 0) {
+    test_fail("slabs outlived their nodes", NULL);
+  }
+}
+
+int main(int argc, char **argv) {
+  unsigned long long ops = 1000000;
+  unsigned int i;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+    if (opt == 'n') {
+      ops = strtoull(optarg, NULL, 10);
+    } else if (opt == 's') {
+      vs_test_seed = strtoull(optarg, NULL, 10);
+    } else {
+      fprintf(stderr, "usage: %s [-n <operations>] [-s <seed>]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  vs_test_rng = vs_test_seed;
+
+  for (i = 0; i < TEST_POOL; i ++) {
+    vs_test_pool[i] = test_key();
+  }
+
+  test_run(ops, 0);
+  test_run(ops, 1);
+
+  for (i = 0; i < TEST_POOL; i ++) {
+    free(vs_test_pool[i]);
+  }
+
+  printf("test-bintree: %llu operations on each allocator, seed %llu: ok\n", ops, vs_test_seed);
+
+  return 0;
+}
@@ -0,0 +1,327 @@
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "./harness.h"
+#include "../client/vsclient.h"
+
+/*
+ * Round trips through the client library to a server run in a child
+ * process, over a unix domain socket: values of each type are set, read
+ * back and deleted, and a watch is notified with the value. The server is
+ * then stopped, which the client reports, and started again; the client
+ * reopens its connections on its own and makes the watch again there.
+ * Keys that wouldn't go on the wire as a single argument are refused
+ * before anything is sent.
+ *
+ *   test-client
+ */
+
+/* how long to wait on the server, or on the client's I/O thread */
+#define TEST_WAIT_MS  5000
+
+/**
+ * @struct _tag_vstestevents
+ * @brief What a client's notification callback has seen
+ */
+typedef struct _tag_vstestevents {
+  atomic_int disconnects;
+  atomic_int reconnects;
+  atomic_int notified;
+  atomic_int value;
+} vstestevents;
+
+char vs_test_socket[64];
+pid_t vs_test_server = -1;
+
+/**
+ * Stops a server a failed test left running
+ */
+void test_kill_server() {
+  if (vs_test_server > 0) {
+    kill(vs_test_server, SIGKILL);
+  }
+}
+
+/**
+ * Counts what a client is told
+ */
+void test_notify(const char *event, const char *key, const vsreply *r, void *arg) {
+  vstestevents *e = (vstestevents *)arg;
+
+  if (strcmp(event, "DISCONNECT") == 0) {
+    e->disconnects ++;
+  } else if (strcmp(event, "RECONNECT") == 0) {
+    e->reconnects ++;
+  } else if (strcmp(event, "SET") == 0 && key && strcmp(key, "w:1") == 0 && r) {
+    e->value = atoi(r->data);
+    e->notified ++;
+  }
+}
+
+/**
+ * Waits for a count to reach a number
+ */
+void test_wait(atomic_int *count, int n, const char *what) {
+  int waited;
+
+  for (waited = 0; atomic_load(count) < n; waited += 10) {
+    if (waited >= TEST_WAIT_MS) {
+      harness_fail("test-client", "%s (count %d)", what, atomic_load(count));
+    }
+
+    usleep(10000);
+  }
+}
+
+/**
+ * Waits for every connection in a client's pool to be broken, or to be
+ * open; a connection can be reopened to a server that's stopping, so
+ * counting events alone isn't enough
+ */
+void test_wait_pool(vsclient *c, int broken, const char *what) {
+  int i, waited, done = 0;
+
+  for (waited = 0; !done; waited += 10) {
+    if (waited >= TEST_WAIT_MS) {
+      harness_fail("test-client", "%s", what);
+    }
+
+    usleep(10000);
+
+    for (i = 0, done = 1; i < c->n_conns; i ++) {
+      done = done && atomic_load(&c->conns[i].broken) == broken;
+    }
+  }
+}
+
+/**
+ * Runs a server on the test's socket in a child process, returning once
+ * it takes connections
+ */
+void test_server() {
+  int fd, waited;
+  struct sockaddr_un addr;
+  pid_t pid = fork();
+
+  if (pid < 0) {
+    harness_fail("test-client", "unable to fork (errno %d)", errno);
+  }
+
+  if (pid == 0) {
+    log_init(0);
+    setlogmask(LOG_UPTO(LOG_CRIT));
+    vs_foreground = 1;
+    vs_port = 0;
+
+    if (config_set("unix-socket", vs_test_socket) == ERR_SUCCESS && daemon_init() == ERR_SUCCESS) {
+      daemon_run();
+      daemon_teardown();
+    }
+
+    _exit(0);
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, vs_test_socket);
+
+  for (waited = 0; waited < TEST_WAIT_MS; waited += 10) {
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+      harness_fail("test-client", "unable to create a socket (errno %d)", errno);
+    }
+
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+      close(fd);
+      vs_test_server = pid;
+      return;
+    }
+
+    close(fd);
+    usleep(10000);
+  }
+
+  vs_test_server = pid;
+  harness_fail("test-client", "server didn't start");
+}
+
+/**
+ * Stops the server run by test_server
+ */
+void test_stop() {
+  int status;
+  pid_t pid = vs_test_server;
+
+  vs_test_server = -1;
+  kill(pid, SIGTERM);
+
+  if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    harness_fail("test-client", "server didn't stop cleanly (status %d)", status);
+  }
+}
+
+/**
+ * Sets, reads back and deletes values of each type
+ */
+void test_round_trip(vsclient *c) {
+  int rc, i;
+  int32_t i32;
+  int64_t i64;
+  double d;
+  char *s = NULL, key[32];
+
+  if ((rc = vsc_set_int32(c, "i32", -7)) != ERR_SUCCESS ||
+      (rc = vsc_get_int32(c, "i32", &i32)) != ERR_SUCCESS || i32 != -7) {
+    harness_fail("test-client", "int32 didn't round trip (rc %d)", rc);
+  }
+
+  if ((rc = vsc_set_int64(c, "i64", 1LL << 40)) != ERR_SUCCESS ||
+      (rc = vsc_get_int64(c, "i64", &i64)) != ERR_SUCCESS || i64 != 1LL << 40) {
+    harness_fail("test-client", "int64 didn't round trip (rc %d)", rc);
+  }
+
+  if ((rc = vsc_set_double(c, "d", 0.125)) != ERR_SUCCESS ||
+      (rc = vsc_get_double(c, "d", &d)) != ERR_SUCCESS || d != 0.125) {
+    harness_fail("test-client", "double didn't round trip (rc %d)", rc);
+  }
+
+  if ((rc = vsc_set_text(c, "s", "hello\r\nworld")) != ERR_SUCCESS ||
+      (rc = vsc_get_text(c, "s", &s)) != ERR_SUCCESS || strcmp(s, "hello\r\nworld") != 0) {
+    harness_fail("test-client", "text didn't round trip (rc %d)", rc);
+  }
+
+  free(s);
+
+  if ((rc = vsc_del(c, "s")) != ERR_SUCCESS || (rc = vsc_get_text(c, "s", &s)) != ERR_NOTFOUND ||
+      (rc = vsc_del(c, "s")) != ERR_NOTFOUND) {
+    harness_fail("test-client", "deleted text was still there (rc %d)", rc);
+  }
+
+  /* enough to be spread over the pool */
+  for (i = 0; i < 100; i ++) {
+    snprintf(key, sizeof(key), "k:%d", i);
+
+    if ((rc = vsc_set_int32(c, key, i)) != ERR_SUCCESS) {
+      harness_fail("test-client", "SET failed (rc %d)", rc);
+    }
+  }
+
+  for (i = 0; i < 100; i ++) {
+    snprintf(key, sizeof(key), "k:%d", i);
+
+    if ((rc = vsc_get_int32(c, key, &i32)) != ERR_SUCCESS || i32 != i) {
+      harness_fail("test-client", "GET returned another value (rc %d)", rc);
+    }
+  }
+}
+
+/**
+ * Keys that would split a request, or that the server would drop the
+ * connection over, are refused by every request, and nothing is sent
+ */
+void test_keys(vsclient *c) {
+  const char *bad[] = { "", "a b", "a\tb", "a\rb", "a\r\nDEL b", "a\nb", NULL };
+  char longest[PROTO_MAX_KEY + 2];
+  int32_t i32;
+  unsigned int i;
+
+  memset(longest, 'k', sizeof(longest) - 1);
+  longest[sizeof(longest) - 1] = 0;
+  bad[sizeof(bad) / sizeof(bad[0]) - 1] = longest;
+
+  if (vsc_set_int32(c, "b", 1) != ERR_SUCCESS) {
+    harness_fail("test-client", "SET failed");
+  }
+
+  for (i = 0; i < sizeof(bad) / sizeof(bad[0]); i ++) {
+    if (vsc_get_async(c, bad[i], NULL, NULL) != ERR_BADREQ ||
+        vsc_set_int32(c, bad[i], 2) != ERR_BADREQ ||
+        vsc_del_async(c, bad[i], NULL, NULL) != ERR_BADREQ ||
+        vsc_watch_async(c, bad[i], 0, NULL, NULL) != ERR_BADREQ) {
+      harness_fail("test-client", "key that isn't a single argument was sent (key %u)", i);
+    }
+  }
+
+  /* nothing went out, so b is untouched and replies are still in step */
+  if (vsc_get_int32(c, "b", &i32) != ERR_SUCCESS || i32 != 1) {
+    harness_fail("test-client", "refused key reached the server");
+  }
+
+  /* the longest key the server takes is still sent */
+  longest[PROTO_MAX_KEY] = 0;
+
+  if (vsc_set_int32(c, longest, 3) != ERR_SUCCESS || vsc_get_int32(c, longest, &i32) != ERR_SUCCESS ||
+      i32 != 3) {
+    harness_fail("test-client", "longest key wasn't sent");
+  }
+}
+
+int main() {
+  int rc;
+  char address[80];
+  vsclient *client = NULL, *watcher = NULL;
+  vstestevents ce, we;
+
+  memset(&ce, 0, sizeof(ce));
+  memset(&we, 0, sizeof(we));
+  snprintf(vs_test_socket, sizeof(vs_test_socket), "/tmp/test-client-%d.sock", (int)getpid());
+  snprintf(address, sizeof(address), "unix:%s", vs_test_socket);
+  signal(SIGPIPE, SIG_IGN);
+  atexit(test_kill_server);
+
+  test_server();
+
+  if ((client = vsc_connect(address, 2)) == NULL || (watcher = vsc_connect(address, 1)) == NULL) {
+    harness_fail("test-client", "unable to connect (errno %d)", errno);
+  }
+
+  vsc_set_notify(client, test_notify, &ce);
+  vsc_set_notify(watcher, test_notify, &we);
+  test_round_trip(client);
+  test_keys(client);
+
+  if ((rc = vsc_watch(watcher, "w:*", 1)) != ERR_SUCCESS) {
+    harness_fail("test-client", "WATCH failed (rc %d)", rc);
+  }
+
+  vsc_set_int32(client, "w:1", 1);
+  test_wait(&we.notified, 1, "watcher wasn't notified");
+
+  /* a stopped server is reported, and requests fail until it's back */
+  test_stop();
+  test_wait_pool(client, 1, "client's connections didn't break");
+  test_wait_pool(watcher, 1, "watcher's connection didn't break");
+  test_wait(&ce.disconnects, 2, "client wasn't told its connections broke");
+  test_wait(&we.disconnects, 1, "watcher wasn't told its connection broke");
+
+  if ((rc = vsc_set_int32(client, "w:1", 2)) != ERR_CONNIO) {
+    harness_fail("test-client", "request went ahead without a server (rc %d)", rc);
+  }
+
+  test_server();
+  test_wait_pool(client, 0, "client didn't reconnect");
+  test_wait_pool(watcher, 0, "watcher didn't reconnect");
+  test_wait(&ce.reconnects, 2, "client wasn't told it reconnected");
+  test_wait(&we.reconnects, 1, "watcher wasn't told it reconnected");
+
+  /* the watch was made again ahead of anything else on its connection */
+  if ((rc = vsc_set_int32(watcher, "w:0", 0)) != ERR_SUCCESS ||
+      (rc = vsc_set_int32(client, "w:1", 3)) != ERR_SUCCESS) {
+    harness_fail("test-client", "SET failed after reconnecting (rc %d)", rc);
+  }
+
+  test_wait(&we.notified, 2, "watch wasn't made again");
+
+  if (atomic_load(&we.value) != 3) {
+    harness_fail("test-client", "watcher was notified of another value (%d)", atomic_load(&we.value));
+  }
+
+  test_round_trip(client);
+
+  vsc_destroy(&watcher);
+  vsc_destroy(&client);
+  test_stop();
+
+  printf("test-client: ok\n");
+
+  return 0;
+}
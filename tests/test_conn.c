@@ -0,0 +1,431 @@
+#include "./harness.h"
+
+/*
+ * Connection state across backpressure: a connection that stops being
+ * served because its client isn't reading, and is served again once the
+ * client catches up, comes back exactly as it was. Whatever it was
+ * watching it still watches, and closing it still removes its watches, so
+ * that nothing is published to it afterwards. A change reaches every prefix
+ * watch on the key, and is sent once the store lock is released; a watcher
+ * that can't be given it is dropped, whichever worker owns it. A shared
+ * memory channel is refused while replies are still queued. A replica
+ * keeps its place in
+ * the mutation log and is sent the store a step at a time; a link to a
+ * primary keeps streaming, and is dropped without counting a change, or
+ * a transaction, it couldn't apply. A descriptor that epoll can't watch is
+ * handed back to the loop with an error, for its connection to be closed.
+ *
+ *   test-conn
+ */
+
+extern bintree *vs_watch_index;
+extern unsigned long long vs_repl_applied;
+
+/**
+ * Queues more output than the client is reading, pausing the connection,
+ * then reads and flushes it all so that the connection is served again
+ */
+void test_backpressure(vstestconn *t) {
+  vsbuf *b = vsbuf_alloc(2 * CONN_HIGH_WATERMARK);
+
+  if (b == NULL) {
+    harness_fail("test-conn", "unable to allocate output");
+  }
+
+  memset(b->data, 'x', 2 * CONN_HIGH_WATERMARK);
+  b->len = 2 * CONN_HIGH_WATERMARK;
+
+  if (conn_queue(t->c, b) != ERR_SUCCESS || conn_flush(t->c) != ERR_SUCCESS || !t->c->paused) {
+    harness_fail("test-conn", "connection wasn't paused");
+  }
+
+  vsbuf_release(&b);
+
+  while (t->c->out_bytes > 0) {
+    harness_replies(t, NULL, 0);
+
+    if (conn_flush(t->c) != ERR_SUCCESS) {
+      harness_fail("test-conn", "connection failed to flush");
+    }
+  }
+
+  harness_replies(t, NULL, 0);
+
+  if (t->c->paused) {
+    harness_fail("test-conn", "connection wasn't served again");
+  }
+}
+
+/**
+ * A watcher that was paused keeps its watches, and closing it afterwards
+ * removes them
+ */
+void test_watcher() {
+  vstestconn client, watcher;
+  char reply[HARNESS_REPLY_MAX];
+
+  if (harness_open(&client, 0) != 0 || harness_open(&watcher, 0) != 0) {
+    harness_fail("test-conn", "unable to connect");
+  }
+
+  harness_request("test-conn", &watcher, "WATCH k\r\n", reply, sizeof(reply));
+  test_backpressure(&watcher);
+
+  if (watcher.c->watches != 1 || watcher.c->closing) {
+    harness_fail("test-conn", "watcher lost its state while paused");
+  }
+
+  harness_request("test-conn", &client, "SET k int32 1\r\n1\r\n", reply, sizeof(reply));
+  harness_replies(&watcher, reply, sizeof(reply));
+
+  if (strcmp(reply, "NOTIFY SET k\r\n") != 0) {
+    harness_fail("test-conn", "watcher wasn't notified after resuming (reply \"%.64s\")", reply);
+  }
+
+  /* once closed, it is no longer watching anything */
+  harness_close(&watcher);
+
+  if (bintree_find(vs_watch_index, "k") != NULL) {
+    harness_fail("test-conn", "closed watcher left its watch behind");
+  }
+
+  harness_request("test-conn", &client, "SET k int32 1\r\n2\r\n", reply, sizeof(reply));
+  harness_close(&client);
+}
+
+/**
+ * A change is published to every prefix watch matching the key, and to
+ * none that don't; the calling worker's watchers are sent it by
+ * pubsub_flush rather than with the store locked
+ */
+void test_prefixes() {
+  vstestconn client, watcher;
+  char reply[HARNESS_REPLY_MAX];
+
+  if (harness_open(&client, 0) != 0 || harness_open(&watcher, 0) != 0) {
+    harness_fail("test-conn", "unable to connect");
+  }
+
+  harness_request("test-conn", &watcher,
+                  "WATCH p:*\r\nWATCH p:a*\r\nWATCH p:ab\r\nWATCH p:abc*\r\nWATCH q*\r\n",
+                  reply, sizeof(reply));
+  harness_request("test-conn", &client, "SET p:ab int32 1\r\n1\r\n", reply, sizeof(reply));
+  harness_replies(&watcher, reply, sizeof(reply));
+
+  if (strcmp(reply, "NOTIFY SET p:ab\r\nNOTIFY SET p:ab\r\nNOTIFY SET p:ab\r\n") != 0) {
+    harness_fail("test-conn", "prefix watches weren't each notified once (reply \"%.64s\")", reply);
+  }
+
+  worker_enter(watcher.c->worker);
+  store_write_lock();
+  pubsub_publish("q", NULL);
+  store_unlock();
+
+  if (watcher.c->out_bytes == 0 || harness_replies(&watcher, reply, sizeof(reply)) != 0) {
+    harness_fail("test-conn", "notification was sent with the store locked (reply \"%.64s\")", reply);
+  }
+
+  pubsub_flush();
+  harness_replies(&watcher, reply, sizeof(reply));
+
+  if (strcmp(reply, "NOTIFY DEL q\r\n") != 0) {
+    harness_fail("test-conn", "queued notification wasn't flushed (reply \"%.64s\")", reply);
+  }
+
+  harness_close(&watcher);
+  harness_close(&client);
+}
+
+/**
+ * A watcher that can't be given a notification is dropped rather than
+ * left to miss the change, on whichever worker owns it; the others
+ * watching the key are still notified
+ */
+void test_missed() {
+  vstestconn local, remote, plain;
+  char reply[HARNESS_REPLY_MAX];
+  vsval v;
+
+  if (harness_open(&local, 0) != 0 || harness_open(&remote, 1) != 0 || harness_open(&plain, 0) != 0) {
+    harness_fail("test-conn", "unable to connect");
+  }
+
+  harness_request("test-conn", &local, "WATCH m VALUES\r\n", reply, sizeof(reply));
+  harness_request("test-conn", &remote, "WATCH m VALUES\r\n", reply, sizeof(reply));
+  harness_request("test-conn", &plain, "WATCH m\r\n", reply, sizeof(reply));
+
+  /* a value of no known type can't be encoded for those wanting values */
+  memset(&v, 0, sizeof(v));
+  v.type_id = 0xffffffff;
+
+  worker_enter(plain.c->worker);
+  store_write_lock();
+  pubsub_publish("m", &v);
+  store_unlock();
+  pubsub_flush();
+
+  if (!local.c->closing || local.c->out_bytes != 0) {
+    harness_fail("test-conn", "local watcher wasn't dropped");
+  }
+
+  if (!atomic_load(&remote.c->missed) || remote.c->closing) {
+    harness_fail("test-conn", "other worker wasn't told to drop its watcher");
+  }
+
+  harness_replies(&plain, reply, sizeof(reply));
+
+  if (plain.c->closing || strcmp(reply, "NOTIFY SET m\r\n") != 0) {
+    harness_fail("test-conn", "other watchers weren't notified (reply \"%.64s\")", reply);
+  }
+
+  harness_close(&plain);
+  harness_close(&remote);
+  harness_close(&local);
+}
+
+/**
+ * A shared memory channel isn't offered ahead of replies still queued for
+ * the client; queued replies the socket takes are sent first, and when it
+ * won't, the request is refused without a segment being left behind
+ */
+void test_shm_pending() {
+  vstestconn t;
+  vsbuf *b = vsbuf_alloc(CONN_HIGH_WATERMARK / 2);
+
+  if (b == NULL || harness_open(&t, 0) != 0) {
+    harness_fail("test-conn", "unable to connect");
+  }
+
+  t.c->local = 1;
+  memset(b->data, 'x', CONN_HIGH_WATERMARK / 2);
+  b->len = CONN_HIGH_WATERMARK / 2;
+
+  if (conn_queue(t.c, b) != ERR_SUCCESS || conn_flush(t.c) != ERR_SUCCESS || t.c->out_head == NULL) {
+    harness_fail("test-conn", "output wasn't left queued");
+  }
+
+  vsbuf_release(&b);
+
+  if (shm_attach(t.c) != ERR_PENDING || t.c->link != NULL) {
+    harness_fail("test-conn", "channel was offered ahead of queued replies");
+  }
+
+  while (t.c->out_bytes > 0) {
+    harness_replies(&t, NULL, 0);
+
+    if (conn_flush(t.c) != ERR_SUCCESS) {
+      harness_fail("test-conn", "connection failed to flush");
+    }
+  }
+
+  harness_close(&t);
+}
+
+/**
+ * Sends a replica whatever it's due, as its worker does each pass, and
+ * reads it
+ */
+void test_pump(vstestconn *t, char *reply, size_t size) {
+  store_read_lock();
+  repl_pump(t->c);
+  store_unlock();
+
+  if (conn_flush(t->c) != ERR_SUCCESS) {
+    harness_fail("test-conn", "replica failed to flush");
+  }
+
+  harness_replies(t, reply, size);
+}
+
+/**
+ * A replica that was paused part way through being sent the store carries
+ * on from where it was, and is then sent what changed meanwhile
+ */
+void test_replica() {
+  vstestconn client, replica;
+  char req[64], reply[HARNESS_REPLY_MAX];
+  unsigned long long offset;
+  int i, steps = 1;
+
+  if (harness_open(&client, 0) != 0 || harness_open(&replica, 0) != 0) {
+    harness_fail("test-conn", "unable to connect");
+  }
+
+  /* more keys than are sent in a step */
+  for (i = 0; i < 3 * REPL_SNAPSHOT_BATCH; i ++) {
+    snprintf(req, sizeof(req), "SET r:%d int32 1\r\n1\r\n", i);
+    harness_request("test-conn", &client, req, reply, sizeof(reply));
+  }
+
+  harness_request("test-conn", &replica, "SYNC - 0\r\n", reply, sizeof(reply));
+
+  if (strncmp(reply, "FULLSYNC ", 9) != 0 || !replica.c->repl_snapshot) {
+    harness_fail("test-conn", "replica wasn't sent the store a step at a time (reply \"%.64s\")", reply);
+  }
+
+  offset = replica.c->repl_offset;
+  test_backpressure(&replica);
+
+  if (!replica.c->downstream || !replica.c->repl_snapshot || replica.c->repl_offset != offset ||
+      replica.c->closing) {
+    harness_fail("test-conn", "replica lost its place while paused");
+  }
+
+  harness_request("test-conn", &client, "SET r:0 int32 2\r\n-1\r\n", reply, sizeof(reply));
+
+  while (replica.c->repl_snapshot || replica.c->out_bytes > 0) {
+    test_pump(&replica, reply, sizeof(reply));
+    steps ++;
+  }
+
+  snprintf(req, sizeof(req), "STREAM %llu\r\n", offset);
+
+  if (steps < 3 || strstr(reply, req) == NULL) {
+    harness_fail("test-conn", "replica wasn't streamed the log after the store (reply \"%.64s\")", reply);
+  }
+
+  test_pump(&replica, reply, sizeof(reply));
+
+  if (strcmp(reply, "SET r:0 int32 2\r\n-1\r\n") != 0) {
+    harness_fail("test-conn", "replica wasn't sent a change made meanwhile (reply \"%.64s\")", reply);
+  }
+
+  harness_close(&replica);
+  harness_close(&client);
+}
+
+/**
+ * A link to a primary that was paused carries on streaming; a change it
+ * can't apply drops the link, and isn't counted as applied
+ */
+void test_primary() {
+  vstestconn client, primary;
+  char reply[HARNESS_REPLY_MAX];
+  const char *sync = "FULLSYNC 0123456789abcdef\r\nSET p int32 1\r\n1\r\nSTREAM 100\r\n";
+  const char *change = "SET p int32 1\r\n2\r\n";
+  unsigned long long applied;
+
+  if (harness_open(&client, 0) != 0 || harness_open(&primary, 0) != 0) {
+    harness_fail("test-conn", "unable to connect");
+  }
+
+  primary.c->upstream = 1;
+  harness_request("test-conn", &primary, sync, reply, sizeof(reply));
+  test_backpressure(&primary);
+  harness_request("test-conn", &primary, change, reply, sizeof(reply));
+
+  if (!primary.c->upstream || primary.c->closing || vs_repl_applied != 100 + strlen(change)) {
+    harness_fail("test-conn", "link to the primary lost its place while paused");
+  }
+
+  applied = vs_repl_applied;
+  harness_send(&primary, "SET p int8 3\r\n999\r\n", 19, 19);
+
+  if (!primary.c->closing || vs_repl_applied != applied) {
+    harness_fail("test-conn", "change that couldn't be applied was counted");
+  }
+
+  harness_request("test-conn", &client, "GET p\r\n", reply, sizeof(reply));
+
+  if (strcmp(reply, "VALUE int32 1\r\n2\r\n") != 0) {
+    harness_fail("test-conn", "primary's changes weren't applied (reply \"%.64s\")", reply);
+  }
+
+  harness_close(&primary);
+  repl_upstream_lost();
+  harness_close(&client);
+}
+
+/**
+ * A transaction from the primary that fails part way through is rolled
+ * back, and the link dropped without counting it
+ */
+void test_primary_unit() {
+  vstestconn client, primary;
+  char reply[HARNESS_REPLY_MAX];
+  const char *unit = "MULTI\r\nDEL d\r\nINCR t 1\r\nEXEC\r\n";
+  unsigned long long applied;
+
+  if (harness_open(&client, 0) != 0 || harness_open(&primary, 0) != 0) {
+    harness_fail("test-conn", "unable to connect");
+  }
+
+  primary.c->upstream = 1;
+  harness_request("test-conn", &primary, "STREAM 200\r\nSET d int32 1\r\n1\r\nSET t text 1\r\nx\r\n",
+                  reply, sizeof(reply));
+
+  applied = vs_repl_applied;
+  harness_send(&primary, unit, strlen(unit), strlen(unit));
+
+  if (!primary.c->closing || vs_repl_applied != applied) {
+    harness_fail("test-conn", "transaction that couldn't be applied was counted");
+  }
+
+  harness_request("test-conn", &client, "GET d\r\n", reply, sizeof(reply));
+
+  if (strcmp(reply, "VALUE int32 1\r\n1\r\n") != 0) {
+    harness_fail("test-conn", "transaction wasn't rolled back (reply \"%.64s\")", reply);
+  }
+
+  harness_close(&primary);
+  repl_upstream_lost();
+  harness_close(&client);
+}
+
+/**
+ * A descriptor that can't be added to the epoll set comes back with an
+ * error, and the others are still watched
+ */
+void test_poller() {
+  vspoller p;
+  vstestconn t;
+  struct pollfd fds[2];
+  int engine = vs_io_engine;
+  FILE *f = NULL;
+
+  vs_io_engine = POLLER_EPOLL;
+
+  if (poller_init(&p, 2) != ERR_SUCCESS || harness_open(&t, 0) != 0) {
+    harness_fail("test-conn", "unable to set up epoll");
+  }
+
+  /* epoll refuses regular files */
+  if ((f = tmpfile()) == NULL) {
+    harness_fail("test-conn", "unable to create a file");
+  }
+
+  fds[0].fd = fileno(f);
+  fds[0].events = POLLIN;
+  fds[1].fd = t.c->fd;
+  fds[1].events = POLLIN;
+
+  if (write(t.peer, "x", 1) != 1 || poller_wait(&p, fds, 2, 1000) != 2 ||
+      fds[0].revents != POLLERR || fds[1].revents != POLLIN) {
+    harness_fail("test-conn", "descriptor that couldn't be watched wasn't reported");
+  }
+
+  fclose(f);
+  harness_close(&t);
+  poller_teardown(&p);
+  vs_io_engine = engine;
+}
+
+int main() {
+  if (harness_init(2) != 0) {
+    return 1;
+  }
+
+  test_watcher();
+  test_prefixes();
+  test_missed();
+  test_shm_pending();
+  test_replica();
+  test_primary();
+  test_primary_unit();
+  test_poller();
+  harness_teardown();
+
+  printf("test-conn: ok\n");
+
+  return 0;
+}
@@ -0,0 +1,251 @@
+#include "./harness.h"
+
+/*
+ * Multi-threaded stress test: a thread per worker serves its own client
+ * and a watcher, all of them hammering a small set of shared keys with
+ * sets, reads of a hot key, deletes, counters and transactions, while the
+ * first also runs defragmentation as aggressively as it goes. Built with
+ * ThreadSanitizer (make test does) it checks the locking; either way, at
+ * the end no counter has lost an increment and transfers between accounts
+ * have kept their total.
+ *
+ *   test-stress [-t <threads>] [-n <requests per thread>] [-s <seed>]
+ */
+
+#define STRESS_KEYS       64
+#define STRESS_ACCOUNTS   8
+#define STRESS_BALANCE    1000
+
+/**
+ * @struct _tag_vsstress
+ * @brief A thread's share of the test
+ */
+typedef struct _tag_vsstress {
+  pthread_t thread;
+  int id;
+  unsigned long long rng;
+  unsigned long long requests;
+  unsigned long long counted;   /* increments of its own counter */
+  unsigned long long totalled;  /* increments of the shared one */
+} vsstress;
+
+unsigned long long vs_stress_seed = 1;
+
+/* how failures are reported, naming the seed so the run can be repeated */
+char vs_stress_name[64] = "test-stress";
+
+/**
+ * Reads the number a VALUE reply carries
+ */
+long long stress_number(int id, const char *reply) {
+  const char *data = strstr(reply, "\r\n");
+
+  if (strncmp(reply, "VALUE int64 ", 12) != 0 || data == NULL) {
+    harness_fail(vs_stress_name, "thread %d: expected a number (reply \"%.64s\")", id, reply);
+  }
+
+  return strtoll(data + 2, NULL, 10);
+}
+
+/**
+ * Serves one worker's clients
+ */
+void* stress_thread(void *arg) {
+  vsstress *s = (vsstress *)arg;
+  vstestconn client, watcher;
+  char req[1024], value[640], reply[HARNESS_REPLY_MAX];
+  unsigned long long i;
+  unsigned int r, k, len, j;
+  int a, b, d;
+
+  if (harness_open(&client, s->id) != 0 || harness_open(&watcher, s->id) != 0) {
+    harness_fail(vs_stress_name, "thread %d: unable to connect", s->id);
+  }
+
+  harness_request(vs_stress_name, &watcher, "WATCH s:* VALUES\r\n", reply, sizeof(reply));
+
+  for (i = 0; i < s->requests; i ++) {
+    r = harness_rand(&s->rng) % 100;
+    k = harness_rand(&s->rng) % STRESS_KEYS;
+
+    if (r < 20) {
+      /* values either side of the largest that goes in a slab */
+      len = harness_rand(&s->rng) % sizeof(value);
+
+      for (j = 0; j < len; j ++) {
+        value[j] = 'a' + harness_rand(&s->rng) % 26;
+      }
+
+      value[len] = 0;
+      snprintf(req, sizeof(req), "SET s:%u text %u\r\n%s\r\n", k, len, value);
+      harness_request(vs_stress_name, &client, req, reply, sizeof(reply));
+
+      if (strcmp(reply, "OK\r\n") != 0) {
+        harness_fail(vs_stress_name, "thread %d: SET failed (reply \"%.64s\")", s->id, reply);
+      }
+    } else if (r < 45) {
+      snprintf(req, sizeof(req), "GET %s\r\n", (r & 1) ? "hot" : "s:0");
+      harness_request(vs_stress_name, &client, req, reply, sizeof(reply));
+
+      if (strncmp(reply, "VALUE ", 6) != 0 && strcmp(reply, "NOTFOUND\r\n") != 0) {
+        harness_fail(vs_stress_name, "thread %d: GET failed (reply \"%.64s\")", s->id, reply);
+      }
+    } else if (r < 50) {
+      len = snprintf(value, sizeof(value), "%llu", i % 100000);
+      snprintf(req, sizeof(req), "SET hot int32 %u\r\n%s\r\n", len, value);
+      harness_request(vs_stress_name, &client, req, reply, sizeof(reply));
+    } else if (r < 60) {
+      snprintf(req, sizeof(req), "DEL s:%u\r\n", k);
+      harness_request(vs_stress_name, &client, req, reply, sizeof(reply));
+    } else if (r < 75) {
+      snprintf(req, sizeof(req), "INCR c:%d\r\nINCR total\r\n", s->id);
+      harness_request(vs_stress_name, &client, req, reply, sizeof(reply));
+
+      if (stress_number(s->id, reply) != (long long)++ s->counted) {
+        harness_fail(vs_stress_name, "thread %d: counter lost an increment (reply \"%.64s\")", s->id, reply);
+      }
+
+      s->totalled ++;
+    } else if (r < 90) {
+      a = harness_rand(&s->rng) % STRESS_ACCOUNTS;
+      b = harness_rand(&s->rng) % STRESS_ACCOUNTS;
+      d = harness_rand(&s->rng) % 100;
+      snprintf(req, sizeof(req), "MULTI\r\nINCR acct:%d %d\r\nINCR acct:%d %d\r\nEXEC\r\n", a, -d, b, d);
+      harness_request(vs_stress_name, &client, req, reply, sizeof(reply));
+
+      if (strstr(reply, "EXEC 2\r\n") == NULL) {
+        harness_fail(vs_stress_name, "thread %d: transfer failed (reply \"%.64s\")", s->id, reply);
+      }
+    } else {
+      /* a transfer that only goes ahead if the account hasn't changed */
+      snprintf(req, sizeof(req), "VERSION acct:%u\r\n", k % STRESS_ACCOUNTS);
+      harness_request(vs_stress_name, &client, req, reply, sizeof(reply));
+      snprintf(req, sizeof(req), "MULTI\r\nCHECK acct:%u %llu\r\nINCR acct:%u -1\r\nINCR acct:%u 1\r\nEXEC\r\n",
+               k % STRESS_ACCOUNTS, strtoull(reply + 8, NULL, 10), k % STRESS_ACCOUNTS,
+               (k + 1) % STRESS_ACCOUNTS);
+      harness_request(vs_stress_name, &client, req, reply, sizeof(reply));
+
+      if (strstr(reply, "EXEC 3\r\n") == NULL && strstr(reply, "CONFLICT ") == NULL) {
+        harness_fail(vs_stress_name, "thread %d: checked transfer failed (reply \"%.64s\")", s->id, reply);
+      }
+    }
+
+    /* notifications other workers left for the watcher */
+    harness_drain(s->id);
+    harness_replies(&watcher, NULL, 0);
+
+    if (watcher.c->closing) {
+      harness_fail(vs_stress_name, "thread %d: watcher disconnected", s->id);
+    }
+
+    if (s->id == 0) {
+      defrag_cron();
+    }
+  }
+
+  harness_close(&watcher);
+  harness_close(&client);
+
+  return NULL;
+}
+
+int main(int argc, char **argv) {
+  vsstress *threads = NULL;
+  vstestconn t;
+  char req[64], reply[HARNESS_REPLY_MAX];
+  unsigned long long requests = 20000, total = 0;
+  long long sum = 0;
+  int n = 4, opt, i;
+
+  while ((opt = getopt(argc, argv, "t:n:s:")) != -1) {
+    if (opt == 't') {
+      n = atoi(optarg);
+    } else if (opt == 'n') {
+      requests = strtoull(optarg, NULL, 10);
+    } else if (opt == 's') {
+      vs_stress_seed = strtoull(optarg, NULL, 10);
+    } else {
+      fprintf(stderr, "usage: %s [-t <threads>] [-n <requests per thread>] [-s <seed>]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  if (n <= 0) {
+    n = 4;
+  }
+
+  snprintf(vs_stress_name, sizeof(vs_stress_name), "test-stress (seed %llu)", vs_stress_seed);
+
+  vs_trace = 1;
+  vs_hot_cache = 1;
+  vs_defrag = 1;
+  vs_defrag_threshold = 0;
+  vs_defrag_step = 200;
+  vs_defrag_min_waste = 0;
+
+  if (harness_init(n) != 0 || harness_open(&t, 0) != 0) {
+    return 1;
+  }
+
+  for (i = 0; i < STRESS_ACCOUNTS; i ++) {
+    snprintf(req, sizeof(req), "SET acct:%d int64 4\r\n%d\r\n", i, STRESS_BALANCE);
+    harness_request(vs_stress_name, &t, req, reply, sizeof(reply));
+  }
+
+  threads = (vsstress *)calloc(n, sizeof(vsstress));
+
+  for (i = 0; i < n; i ++) {
+    threads[i].id = i;
+    threads[i].rng = vs_stress_seed * 1000003 + i;
+    threads[i].requests = requests;
+
+    if (pthread_create(&threads[i].thread, NULL, stress_thread, &threads[i]) != 0) {
+      harness_fail(vs_stress_name, "thread %d: unable to start", i);
+    }
+  }
+
+  for (i = 0; i < n; i ++) {
+    pthread_join(threads[i].thread, NULL);
+    total += threads[i].totalled;
+  }
+
+  /* every counter saw every increment, and no transfer lost money */
+  for (i = 0; i < n; i ++) {
+    snprintf(req, sizeof(req), "GET c:%d\r\n", i);
+    harness_request(vs_stress_name, &t, req, reply, sizeof(reply));
+
+    if (threads[i].counted && stress_number(-1, reply) != (long long)threads[i].counted) {
+      harness_fail(vs_stress_name, "thread %d: counter is off (reply \"%.64s\")", i, reply);
+    }
+  }
+
+  harness_request(vs_stress_name, &t, "GET total\r\n", reply, sizeof(reply));
+
+  if (total && stress_number(-1, reply) != (long long)total) {
+    harness_fail(vs_stress_name, "thread %d: shared counter is off (reply \"%.64s\")", -1, reply);
+  }
+
+  for (i = 0; i < STRESS_ACCOUNTS; i ++) {
+    snprintf(req, sizeof(req), "GET acct:%d\r\n", i);
+    harness_request(vs_stress_name, &t, req, reply, sizeof(reply));
+    sum += stress_number(-1, reply);
+  }
+
+  if (sum != (long long)STRESS_ACCOUNTS * STRESS_BALANCE) {
+    harness_fail(vs_stress_name, "thread %d: accounts don't add up (reply \"%.64s\")", -1, reply);
+  }
+
+  harness_close(&t);
+
+  for (i = 0; i < n; i ++) {
+    harness_drain(i);
+  }
+
+  harness_teardown();
+  free(threads);
+
+  printf("test-stress: %d threads, %llu requests each, seed %llu: ok (%llu objects moved)\n",
+         n, requests, vs_stress_seed, vs_defrag_moved);
+
+  return 0;
+}
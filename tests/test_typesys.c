@@ -0,0 +1,274 @@
+#include "./harness.h"
+
+/*
+ * Property tests of the type system: every value parsed from its wire form
+ * prints back to a form that parses to the same value, numbers that don't
+ * fit their type are refused, integers wrap at the width of their type
+ * however they are added to, copies are equal to their source, and
+ * malformed wire forms are refused.
+ *
+ *   test-typesys [-n <values>] [-s <seed>]
+ */
+
+unsigned long long vs_test_rng = 1;
+unsigned long long vs_test_seed = 1;
+
+const char *vs_test_malformed[] = {
+  "", " ", "1 ", "1x", "x", "--1", "1e", "1.5.5", "1\r\n", "12345678901234567890123456789012"
+};
+
+const char *vs_test_out_of_range[][2] = {
+  { "bit", "2" }, { "bit", "-1" }, { "int8", "128" }, { "int8", "-129" },
+  { "int16", "32768" }, { "int16", "-32769" }, { "int32", "2147483648" },
+  { "int32", "-2147483649" }, { "int64", "9223372036854775808" },
+  { "int64", "-9223372036854775809" }, { "float4", "3.5e38" }, { "float4", "-1e39" },
+  { "float8", "1e309" }, { "float8", "-2e308" }
+};
+
+/**
+ * Reports a failed property and gives up
+ */
+void test_fail(const char *what, const char *type, const char *wire) {
+  fprintf(stderr, "test-typesys: %s (%s \"%s\", seed %llu)\n", what, type, wire, vs_test_seed);
+  exit(1);
+}
+
+/**
+ * Creates a value of a type from its wire form, as SET does
+ */
+int test_parse(const char *type, const char *wire, unsigned int length, vsval **v) {
+  int rc;
+
+  if ((rc = vsval_create((char *)type, v)) != ERR_SUCCESS) {
+    return rc;
+  }
+
+  if ((rc = vsval_parse(*v, (*v)->type_id, wire, length)) != ERR_SUCCESS) {
+    vsval_destroy(v);
+  }
+
+  return rc;
+}
+
+/**
+ * Checks that a value's wire form parses back to the same bytes
+ */
+void test_round_trip(const char *type, vsval *v, const char *wire) {
+  char scratch[64];
+  const void *data = NULL;
+  unsigned int length;
+  vsval *w = NULL;
+
+  if (vsval_payload(v, scratch, sizeof(scratch), &data, &length) != ERR_SUCCESS) {
+    test_fail("no wire form", type, wire);
+  }
+
+  if (test_parse(type, (const char *)data, length, &w) != ERR_SUCCESS) {
+    test_fail("wire form doesn't parse", type, wire);
+  }
+
+  if (w->length != v->length || memcmp(w->data, v->data, v->length) != 0) {
+    test_fail("wire form parses to another value", type, wire);
+  }
+
+  vsval_destroy(&w);
+}
+
+/**
+ * Checks integers of a width: parsing refuses what doesn't fit the type,
+ * and adding wraps at its width
+ */
+void test_integer(const char *type, unsigned int width) {
+  char wire[32];
+  unsigned long long mask = width == 8 ? ~0ULL : (1ULL << (width * 8)) - 1, expect, got = 0;
+  long long x = (long long)harness_rand(&vs_test_rng), delta;
+  vsval *v = NULL, *c = NULL;
+
+  /* small numbers as often as large ones */
+  if (harness_rand(&vs_test_rng) & 1) {
+    x %= 1000;
+  }
+
+  snprintf(wire, sizeof(wire), "%lld", x);
+
+  /* bits are 0 or 1, and other integers are signed */
+  if (strcmp(type, "bit") == 0 ? x < 0 || x > 1 :
+      width < 8 && (x < -(1LL << (width * 8 - 1)) || x >= (1LL << (width * 8 - 1)))) {
+    if (test_parse(type, wire, strlen(wire), &v) != ERR_INVTYPE) {
+      test_fail("accepted a number that doesn't fit", type, wire);
+    }
+
+    x = strcmp(type, "bit") == 0 ? x & 1 : width == 1 ? (signed char)x :
+        width == 2 ? (short)x : (int)x;
+    snprintf(wire, sizeof(wire), "%lld", x);
+  }
+
+  if (test_parse(type, wire, strlen(wire), &v) != ERR_SUCCESS) {
+    test_fail("refused a number", type, wire);
+  }
+
+  memcpy(&got, v->data, width);
+
+  if (v->length != width || got != ((unsigned long long)x & mask)) {
+    test_fail("parsed to the wrong value", type, wire);
+  }
+
+  test_round_trip(type, v, wire);
+
+  delta = (long long)harness_rand(&vs_test_rng);
+  delta = (harness_rand(&vs_test_rng) & 1) ? delta % 3 : delta;
+  expect = ((unsigned long long)x + (unsigned long long)delta) & mask;
+
+  if (vsval_add(v, delta) != ERR_SUCCESS) {
+    test_fail("refused to add", type, wire);
+  }
+
+  got = 0;
+  memcpy(&got, v->data, width);
+
+  if (got != expect) {
+    test_fail("didn't wrap at its width", type, wire);
+  }
+
+  if (vsval_copy(v, &c) != ERR_SUCCESS || c->type_id != v->type_id ||
+      c->length != v->length || c->data == v->data || memcmp(c->data, v->data, width) != 0) {
+    test_fail("copied to another value", type, wire);
+  }
+
+  vsval_destroy(&c);
+  vsval_destroy(&v);
+}
+
+/**
+ * Checks floating point values: the wire form keeps every bit
+ */
+void test_floating(const char *type, unsigned int width) {
+  char wire[64];
+  unsigned long long bits = harness_rand(&vs_test_rng);
+  double d;
+  float f;
+  vsval *v = NULL;
+
+  /* any finite value, from its bits */
+  if (width == 4) {
+    memcpy(&f, &bits, sizeof(f));
+    d = (f != f || f - f != 0) ? 1.5 : f;
+  } else {
+    memcpy(&d, &bits, sizeof(d));
+    d = (d != d || d - d != 0) ? -0.25 : d;
+  }
+
+  snprintf(wire, sizeof(wire), "%.17g", d);
+
+  if (test_parse(type, wire, strlen(wire), &v) != ERR_SUCCESS) {
+    test_fail("refused a number", type, wire);
+  }
+
+  test_round_trip(type, v, wire);
+
+  if (vsval_add(v, 1) != ERR_SUCCESS) {
+    test_fail("refused to add", type, wire);
+  }
+
+  vsval_destroy(&v);
+}
+
+/**
+ * Checks text: any bytes at all, of any length, are kept verbatim
+ */
+void test_text() {
+  char text[512];
+  unsigned int i, length = harness_rand(&vs_test_rng) % sizeof(text);
+  vsval *v = NULL, *c = NULL;
+
+  for (i = 0; i < length; i ++) {
+    text[i] = (char)harness_rand(&vs_test_rng);
+  }
+
+  if (test_parse("text", text, length, &v) != ERR_SUCCESS) {
+    test_fail("refused text", "text", "");
+  }
+
+  if (v->length != length || memcmp(v->data, text, length) != 0) {
+    test_fail("changed text", "text", "");
+  }
+
+  test_round_trip("text", v, "");
+
+  if (vsval_add(v, 1) != ERR_INVTYPE) {
+    test_fail("added to text", "text", "");
+  }
+
+  if (vsval_copy(v, &c) != ERR_SUCCESS || c->length != length ||
+      memcmp(c->data, text, length) != 0) {
+    test_fail("copied to other text", "text", "");
+  }
+
+  vsval_destroy(&c);
+  vsval_destroy(&v);
+}
+
+/**
+ * Checks that malformed wire forms are refused by every fixed width type
+ */
+void test_malformed() {
+  const char *types[] = { "bit", "int8", "int16", "int32", "int64", "float4", "float8" };
+  unsigned int i, j;
+  vsval *v = NULL;
+
+  for (i = 0; i < sizeof(types) / sizeof(types[0]); i ++) {
+    for (j = 0; j < sizeof(vs_test_malformed) / sizeof(vs_test_malformed[0]); j ++) {
+      if (test_parse(types[i], vs_test_malformed[j], strlen(vs_test_malformed[j]), &v) == ERR_SUCCESS) {
+        test_fail("accepted a malformed value", types[i], vs_test_malformed[j]);
+      }
+    }
+  }
+
+  /* numbers just past the ends of their types */
+  for (i = 0; i < sizeof(vs_test_out_of_range) / sizeof(vs_test_out_of_range[0]); i ++) {
+    if (test_parse(vs_test_out_of_range[i][0], vs_test_out_of_range[i][1],
+                   strlen(vs_test_out_of_range[i][1]), &v) == ERR_SUCCESS) {
+      test_fail("accepted a number that doesn't fit", vs_test_out_of_range[i][0],
+                vs_test_out_of_range[i][1]);
+    }
+  }
+
+  /* there's no such type, and null can't be created */
+  if (vsval_create("int128", &v) != ERR_INVTYPE || vsval_create("null", &v) != ERR_INVTYPE) {
+    test_fail("created a value of no type", "", "");
+  }
+}
+
+int main(int argc, char **argv) {
+  unsigned long long n = 200000, i;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+    if (opt == 'n') {
+      n = strtoull(optarg, NULL, 10);
+    } else if (opt == 's') {
+      vs_test_seed = strtoull(optarg, NULL, 10);
+    } else {
+      fprintf(stderr, "usage: %s [-n <values>] [-s <seed>]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  vs_test_rng = vs_test_seed;
+  test_malformed();
+
+  for (i = 0; i < n; i ++) {
+    test_integer("bit", 1);
+    test_integer("int8", 1);
+    test_integer("int16", 2);
+    test_integer("int32", 4);
+    test_integer("int64", 8);
+    test_floating("float4", 4);
+    test_floating("float8", 8);
+    test_text();
+  }
+
+  printf("test-typesys: %llu values of each type, seed %llu: ok\n", n, vs_test_seed);
+
+  return 0;
+}